@@ -0,0 +1,77 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "levels.h"
+
+// generates a lot of levels through LevelGenerator, the way the game does, with 1 .. N
+// worker threads and reports how throughput scales against a plain serial loop
+// usage: levelgen [numLevels] [maxThreads] [batchSize] [slots]
+
+static uint32_t checksumLevels(const vector<LevelLayout>& levels) {
+    uint32_t sum = 0;
+    for(auto& l : levels) sum = sum * 31 + l.solid;
+    return sum;
+}
+
+int main(int argc, char** argv) {
+    size_t numLevels = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    int maxThreads = argc > 2 ? atoi(argv[2]) : (int)thread::hardware_concurrency();
+    size_t batchSize = argc > 3 ? strtoull(argv[3], NULL, 10) : 16384;
+    size_t numSlots = argc > 4 ? strtoull(argv[4], NULL, 10) : 4;
+    if(maxThreads <= 0) maxThreads = 1;
+    if(batchSize == 0) batchSize = 1;
+    if(numSlots == 0) numSlots = 1;
+    size_t numBatches = (numLevels + batchSize - 1) / batchSize;
+
+    vector<LevelLayout> levels(numLevels);
+
+    // the baseline runs on this thread with no pool at all
+    auto start = chrono::steady_clock::now();
+    for(size_t i=0; i<numLevels; i++) levels[i] = generateLevel(1234, i);
+    auto end = chrono::steady_clock::now();
+    uint32_t checksum = checksumLevels(levels);
+    double baseline = chrono::duration<double, milli>(end - start).count();
+
+    printf("%8s %14s %10s %8s\n", "threads", "levels/s", "ms", "speedup");
+    printf("%8s %14.0f %10.2f %8.2f\n", "serial", numLevels / (baseline / 1000.0), baseline, 1.0);
+
+    for(int t=1; t<=maxThreads; t++) {
+        ThreadPool pool(t);
+        LevelGenerator gen(&pool, 1234, batchSize, numSlots);
+        fill(levels.begin(), levels.end(), LevelLayout());
+
+        // keep every slot busy: request batches ahead, and as each one turns up copy it
+        // out, release its slot and request the next one into it
+        start = chrono::steady_clock::now();
+        size_t requested = 0;
+        for(; requested < numBatches && requested < numSlots; requested++) gen.request(requested);
+        for(size_t b=0; b<numBatches; b++) {
+            const LevelLayout* batch;
+            while(!(batch = gen.poll(b))) this_thread::yield();
+
+            size_t first = b * batchSize;
+            size_t n = min(batchSize, numLevels - first);
+            copy(batch, batch + n, levels.begin() + first);
+            gen.release(b);
+            if(requested < numBatches) gen.request(requested++);
+        }
+        end = chrono::steady_clock::now();
+
+        // make sure every run produced the same levels (and that the work isn't optimized out)
+        if(checksumLevels(levels) != checksum) {
+            cerr << "level mismatch with " << t << " threads\n";
+            return 1;
+        }
+
+        double ms = chrono::duration<double, milli>(end - start).count();
+        printf("%8d %14.0f %10.2f %8.2f\n", t, numLevels / (ms / 1000.0), ms, baseline / ms);
+    }
+
+    return 0;
+}
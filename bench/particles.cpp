@@ -0,0 +1,96 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "particles.h"
+
+// times the particle update kernel against a plain scalar loop doing the same work,
+// plus filling the instance buffer, and reports particles per millisecond
+// usage: particles [numParticles] [frames]
+
+// one particle at a time, for comparison
+void updateParticlesScalar(ParticleSystem* ps, float dt, float floorY) {
+    for(int i=0; i<ps->count; i++) {
+        ps->vy[i] += -9.8f * dt;
+        ps->px[i] += ps->vx[i] * dt;
+        ps->py[i] += ps->vy[i] * dt;
+        ps->pz[i] += ps->vz[i] * dt;
+
+        float bottom = floorY + ps->size[i];
+        if(ps->py[i] < bottom) {
+            ps->py[i] = bottom;
+            ps->vy[i] *= -.4f;
+            ps->vx[i] *= .6f;
+            ps->vz[i] *= .6f;
+        }
+        ps->life[i] -= dt;
+    }
+    compactParticles(ps);
+}
+
+void fill(ParticleSystem* ps, int n) {
+    initParticles(ps, n, 1234);
+    ParticleEmitter e;
+    e.position = glm::vec3(0.f, 5.f, 0.f);
+    e.extent = glm::vec3(2.f, .5f, 2.f);
+    e.velocity = glm::vec3(0.f, 1.f, 0.f);
+    e.spread = 2.f;
+    e.color = glm::vec3(0.f, 0.f, 1.f);
+    e.size = .04f;
+    // long enough that nothing dies during the run, so every frame does the same work
+    e.life = 1e6f;
+    emitParticles(ps, e, n);
+}
+
+template<typename F>
+double run(int n, int frames, F update, float* checksum) {
+    ParticleSystem ps;
+    fill(&ps, n);
+
+    auto start = chrono::steady_clock::now();
+    for(int f=0; f<frames; f++) update(&ps);
+    auto end = chrono::steady_clock::now();
+
+    // also keeps the work from being optimized out
+    float sum = 0.f;
+    for(int i=0; i<ps.count; i++) sum += ps.py[i];
+    *checksum = sum;
+
+    return chrono::duration<double, milli>(end - start).count();
+}
+
+int main(int argc, char** argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 50000;
+    int frames = argc > 2 ? atoi(argv[2]) : 1000;
+    float dt = 1.f / 60.f;
+
+    vector<ParticleInstance> instances(n);
+    float scalarSum, simdSum, writeSum;
+
+    double scalar = run(n, frames, [&](ParticleSystem* ps) { updateParticlesScalar(ps, dt, 0.f); }, &scalarSum);
+    double simd = run(n, frames, [&](ParticleSystem* ps) { updateParticles(ps, dt, 0.f); }, &simdSum);
+    double write = run(n, frames, [&](ParticleSystem* ps) {
+        updateParticles(ps, dt, 0.f);
+        writeParticleInstances(ps, &instances[0], n);
+    }, &writeSum);
+
+    // same operations in the same order, only fused multiply-adds could make them differ
+    if(fabs(simdSum - scalarSum) > 1e-4f * fabs(scalarSum)) {
+        cerr << "simd and scalar results differ: " << simdSum << " vs " << scalarSum << "\n";
+        return 1;
+    }
+
+    double total = (double)n * frames;
+    printf("%d particles, %d frames\n", n, frames);
+    printf("%-16s %14s %12s\n", "", "particles/ms", "ms/frame");
+    printf("%-16s %14.0f %12.4f\n", "scalar", total / scalar, scalar / frames);
+    printf("%-16s %14.0f %12.4f\n", "simd", total / simd, simd / frames);
+    printf("%-16s %14.0f %12.4f\n", "simd + instances", total / write, write / frames);
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "mesh.h"
+#include "levels.h"
+#include "collision.h"
+#include "particles.h"
+#include "raster.h"
+
+// renders the default tower with the software renderer, the tower turning a little every
+// frame and a cloud of particles around it, one pixel at a time and with the widest
+// vectors the build has, on one thread and on all of them. the images have to be the same
+// bit for bit, it reports what a frame took for each
+// usage: raster [width] [height] [frames] [particles]
+
+struct BenchMesh {
+    vector<uint8_t> data;
+    int numVertices;
+    glm::vec3 positionBias, positionScale;
+};
+
+template<typename F>
+BenchMesh buildMesh(F generator) {
+    BenchMesh m;
+    VertexWriter out(compactVertexLayout, &m.data);
+    generator(out);
+    m.numVertices = out.numVertices;
+    m.positionBias = out.positionBias;
+    m.positionScale = out.positionScale;
+    return m;
+}
+
+struct BenchObject {
+    const BenchMesh* mesh;
+    glm::mat4 transform;
+    glm::vec3 color;
+    bool instanced;
+};
+
+struct BenchScene {
+    BenchMesh cylinder, sphere, platform, particle;
+    vector<LevelLayout> levels;
+    vector<ParticleInstance> particles;
+    vector<glm::vec3> lights;
+};
+
+// what the game's Draw hands the renderer, with the tower turned by rotation
+void drawScene(RasterRenderer* r, const BenchScene& s, int width, int height, float rotation, RasterShading shading) {
+    const PlatformGeometry& g = platformGeometry;
+    float top = s.levels.size() * g.levelHeight;
+    glm::mat4 view = glm::lookAt(glm::vec3(0.f, top + 1.f, 5.f), glm::vec3(0.f, top + .5f, 0.f), glm::vec3(0.f, 1.f, 0.f));
+    glm::mat4 vp = glm::perspective(glm::radians(70.f), (float)width / height, .1f, 100.f) * view;
+
+    vector<BenchObject> objects;
+    glm::mat4 tower = glm::rotate(glm::mat4(1.f), rotation, glm::vec3(0.f, 1.f, 0.f));
+    objects.push_back({ &s.cylinder, tower, glm::vec3(0.f, 0.f, 1.f), false });
+    objects.push_back({ &s.sphere, glm::translate(glm::mat4(1.f), glm::vec3(0.f, top + .5f, 1.5f)), glm::vec3(1.f, 0.f, 0.f), false });
+    for(size_t l=0; l<s.levels.size(); l++) {
+        glm::mat4 base = glm::translate(tower, glm::vec3(0.f, l * g.levelHeight, 0.f));
+        for(int i=0; i<g.sections; i++) {
+            if(!((s.levels[l].solid >> i) & 1)) continue;
+            glm::mat4 t = glm::rotate(base, i * 2.f * (float)M_PI / g.sections, glm::vec3(0.f, 1.f, 0.f));
+            objects.push_back({ &s.platform, t, glm::vec3(0.f, 0.f, 1.f), false });
+        }
+    }
+    if(!s.particles.empty()) objects.push_back({ &s.particle, glm::mat4(1.f), glm::vec3(1.f), true });
+
+    vector<glm::vec3> lights;
+    for(const glm::vec3& l : s.lights) lights.push_back(glm::vec3(view * glm::vec4(l, 1.f)));
+    beginRasterFrame(r, width, height, glm::vec3(0.f, .1f, 0.f), lights.data(), (int)lights.size());
+    for(const BenchObject& o : objects) {
+        glm::mat4 mv = view * o.transform;
+        RasterDraw d = { vp * o.transform, mv, glm::inverseTranspose(glm::mat3(mv)), o.color,
+            o.mesh->positionBias, o.mesh->positionScale, o.mesh->data.data(), o.mesh->numVertices,
+            compactVertexLayout, o.instanced ? s.particles.data() : NULL, (int)s.particles.size(), shading };
+        rasterDraw(r, d);
+    }
+    endRasterFrame(r);
+}
+
+uint64_t hashTarget(const RasterTarget& t) {
+    uint64_t h = 1469598103934665603ull;
+    for(int y=0; y<t.height; y++) {
+        for(int x=0; x<t.width; x++) {
+            h = (h ^ t.color[(size_t)y * t.stride + x]) * 1099511628211ull;
+        }
+    }
+    return h;
+}
+
+struct Result {
+    double ms;
+    uint64_t hash;
+    uint64_t triangles, flushes;
+};
+
+Result run(const BenchScene& s, int width, int height, int frames, RasterShading shading, bool scalar, int helpers) {
+    RasterRenderer* r = new RasterRenderer();
+    initRasterRenderer(r, helpers);
+    r->scalar = scalar;
+    // the first frame sizes the buffers
+    drawScene(r, s, width, height, 0.f, shading);
+
+    uint64_t hash = 0;
+    auto start = chrono::steady_clock::now();
+    for(int f=0; f<frames; f++) {
+        drawScene(r, s, width, height, f * .05f, shading);
+        hash ^= hashTarget(r->target) + f;
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+    Result result = { ms, hash, r->drawnTriangles, r->flushes };
+    deleteRasterRenderer(r);
+    delete r;
+    return result;
+}
+
+int main(int argc, char** argv) {
+    int width = argc > 1 ? atoi(argv[1]) : 800;
+    int height = argc > 2 ? atoi(argv[2]) : 600;
+    int frames = argc > 3 ? atoi(argv[3]) : 20;
+    int numParticles = argc > 4 ? atoi(argv[4]) : 400;
+    if(width <= 0 || height <= 0 || frames <= 0 || numParticles < 0) {
+        cerr << "usage: " << argv[0] << " [width] [height] [frames] [particles]\n";
+        return 1;
+    }
+
+    // the game's default scene
+    const PlatformGeometry& g = platformGeometry;
+    BenchScene s;
+    for(int l=0; l<5; l++) s.levels.push_back(generateLevel(1, l, g.sections));
+    float top = s.levels.size() * g.levelHeight;
+    s.cylinder = buildMesh([&](VertexWriter& out) { generateCylinder(out, 40, top); });
+    s.sphere = buildMesh([](VertexWriter& out) { generateUVSphere(out, 40, BALL_RADIUS); });
+    s.platform = buildMesh([&](VertexWriter& out) { generatePlatformSection(out, g.sections, 5); });
+    s.particle = buildMesh([](VertexWriter& out) { generateUVSphere(out, 6, 1.f); });
+    for(int i=0; i<10; i++) s.lights.push_back(glm::vec3(2.f, top + 5.f - 1.5f * i, -2.f));
+
+    ParticleSystem ps;
+    initParticles(&ps, numParticles, 1234);
+    ParticleEmitter e;
+    e.position = glm::vec3(0.f, top - 1.f, 0.f);
+    e.extent = glm::vec3(2.5f, 1.f, 2.5f);
+    e.velocity = glm::vec3(0.f);
+    e.spread = 0.f;
+    e.color = glm::vec3(0.f, 0.f, 1.f);
+    e.size = .04f;
+    e.life = 1.f;
+    emitParticles(&ps, e, numParticles);
+    s.particles.resize(numParticles);
+    writeParticleInstances(&ps, s.particles.data(), numParticles);
+
+    int threads = max(1u, thread::hardware_concurrency());
+    printf("%dx%d, %d frames, %d particles, %d lanes, %d threads\n",
+        width, height, frames, numParticles, RASTER_LANES, threads);
+
+    struct Shading { const char* name; RasterShading shading; };
+    const Shading tiers[] = { { "per pixel", { 10, true, false } }, { "per vertex", { 4, false, true } } };
+    bool same = true;
+    for(const Shading& t : tiers) {
+        Result scalar = run(s, width, height, frames, t.shading, true, 0);
+        Result wide = run(s, width, height, frames, t.shading, false, 0);
+        Result threaded = run(s, width, height, frames, t.shading, false, threads - 1);
+        printf("%-10s %8.2f ms scalar, %8.2f ms %d wide, %8.2f ms %d wide on %d threads, %llu triangles in %llu batches\n",
+            t.name, scalar.ms, wide.ms, RASTER_LANES, threaded.ms, RASTER_LANES, threads,
+            (unsigned long long)wide.triangles, (unsigned long long)wide.flushes);
+        if(scalar.hash != wide.hash || wide.hash != threaded.hash) {
+            cerr << t.name << ": the images differ\n";
+            same = false;
+        }
+    }
+    return same ? 0 : 1;
+}
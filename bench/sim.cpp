@@ -0,0 +1,124 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "validate.h"
+
+// checks the sweep on grazing motion first, then steps a batch of independent games with
+// 1 .. N threads, reports aggregate steps per second and how it scales per core, then how
+// each input policy did on those levels
+// usage: sim [numInstances] [steps] [maxThreads]
+
+const SimPolicy policies[] = { POLICY_IDLE, POLICY_RANDOM, POLICY_SEEK };
+const char* policyNames[] = { "idle", "random", "seek" };
+const int numPolicies = 3;
+
+// grazing motion makes the sweep's conservative steps tiny, so it runs out of iterations.
+// a ball falling right beside a section's end face has to slide past it, and one closing
+// in on the top at a shallow angle has to land where it touches
+bool checkGrazingSweeps() {
+    const float r1 = 1.f, r2 = 2.f, a0 = -.1f, a1 = .1f, y0 = 0.f, y1 = .1f;
+    glm::vec3 face(std::cos(a1), 0.f, std::sin(a1));
+    glm::vec3 away(-std::sin(a1), 0.f, std::cos(a1));
+    bool ok = true;
+
+    const float clearances[] = { .002f, .001f, .0005f, .0002f };
+    for(float clearance : clearances) {
+        glm::vec3 p0 = face * 1.5f + away * (BALL_RADIUS + clearance);
+        p0.y = .25f;
+        float toi;
+        glm::vec3 n;
+        if(sweepSphereSector(p0, glm::vec3(0.f, -.3f, 0.f), BALL_RADIUS, r1, r2, a0, a1, y0, y1, &toi, &n)) {
+            printf("falling %.4f beside a face hits it at t=%.3f\n", clearance, toi);
+            ok = false;
+        }
+    }
+
+    // closes .01 over the step while moving .8 sideways, touches at t=.01/.012
+    glm::vec3 p0(1.1f, y1 + BALL_RADIUS + .01f, 0.f), d(.8f, -.012f, 0.f);
+    float toi;
+    glm::vec3 n;
+    if(!sweepSphereSector(p0, d, BALL_RADIUS, r1, r2, a0, a1, y0, y1, &toi, &n)) {
+        printf("closing in on the top at a shallow angle misses it\n");
+        ok = false;
+    } else if(std::fabs(toi - .01f / .012f) > .01f || n.y < .99f) {
+        printf("closing in on the top at a shallow angle hits at t=%.3f, normal y %.3f\n", toi, n.y);
+        ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 4096;
+    int steps = argc > 2 ? atoi(argv[2]) : 2000;
+    int maxThreads = argc > 3 ? atoi(argv[3]) : (int)thread::hardware_concurrency();
+    if(maxThreads <= 0) maxThreads = 1;
+
+    if(!checkGrazingSweeps()) return 1;
+
+    // 16ms steps, like the game at 60fps
+    float dt = .016f;
+    SceneConfig scene = defaultScene;
+    scene.levels = 20;
+
+    // the same towers the game builds, filtered like it does
+    LevelValidator validator;
+    initLevelValidator(&validator, platformGeometry, VALIDATE_GAME_DT);
+    LevelFilter accept = playableLevelFilter(validator);
+
+    SimBatch batch;
+    uint64_t checksum = 0;
+    double baseline = 0.0;
+
+    printf("%d instances, %d levels, up to %d steps each\n", n, scene.levels, steps);
+    printf("%8s %14s %10s %8s %10s\n", "threads", "steps/s", "ms", "speedup", "per core");
+    for(int t=1; t<=maxThreads; t++) {
+        initSimBatch(&batch, n, scene, 1, policies, numPolicies, accept);
+        // the caller participates in parallelFor, so t threads means t-1 workers
+        ThreadPool pool(t > 1 ? t-1 : 1);
+
+        auto start = chrono::steady_clock::now();
+        stepSimBatch(&batch, t > 1 ? &pool : NULL, steps, dt);
+        auto end = chrono::steady_clock::now();
+
+        // every instance is deterministic, so every thread count has to end up the same
+        uint64_t sum = 0, totalSteps = 0;
+        for(auto& a : batch.agents) {
+            sum = sum * 31 + a.steps * 7 + a.bounces;
+            totalSteps += a.steps;
+        }
+        if(t == 1) checksum = sum;
+        else if(sum != checksum) {
+            cerr << "results differ with " << t << " threads\n";
+            return 1;
+        }
+
+        double ms = chrono::duration<double, milli>(end - start).count();
+        if(t == 1) baseline = ms;
+        printf("%8d %14.0f %10.2f %8.2f %10.2f\n", t, totalSteps / (ms / 1000.0), ms, baseline / ms, baseline / ms / t);
+    }
+
+    printf("\n%8s %10s %14s %10s\n", "policy", "finished", "steps/finish", "bounces");
+    for(int p=0; p<numPolicies; p++) {
+        int count = 0, finished = 0;
+        uint64_t finishSteps = 0, bounces = 0;
+        for(auto& a : batch.agents) {
+            if(a.policy != policies[p]) continue;
+            count++;
+            bounces += a.bounces;
+            if(a.finishedAt) {
+                finished++;
+                finishSteps += a.finishedAt;
+            }
+        }
+        printf("%8s %9.1f%% %14.0f %10.1f\n", policyNames[p], 100.0 * finished / count,
+            finished ? (double)finishSteps / finished : 0.0, (double)bounces / count);
+    }
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sim.h"
+#include "spectate.h"
+
+// plays seeded games with the batch policies, encodes every step the way the game streams
+// it to spectators, decodes it again and checks the result is the real state up to the
+// quantization. reports what encoding, decoding and sending a frame costs, and how big
+// the packets are
+// usage: spectate [games] [steps]
+
+const SimPolicy policies[] = { POLICY_IDLE, POLICY_RANDOM, POLICY_SEEK };
+
+struct RecordedStep {
+    GameState state;
+    int numEvents;
+    uint16_t events[SPECTATE_MAX_EVENTS];
+};
+
+// the broken levels go into the step being recorded
+struct RecordEffects {
+    RecordedStep* step;
+    void bounce(glm::vec3) {}
+    void levelBroken(int l, uint64_t) {
+        if(step->numEvents < SPECTATE_MAX_EVENTS) step->events[step->numEvents++] = (uint16_t)l;
+    }
+};
+
+double nsSince(chrono::steady_clock::time_point start, size_t n) {
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / n;
+}
+
+int main(int argc, char** argv) {
+    int games = argc > 1 ? atoi(argv[1]) : 64;
+    int steps = argc > 2 ? atoi(argv[2]) : 2000;
+    if(games <= 0 || steps <= 0) {
+        cerr << "usage: " << argv[0] << " [games] [steps]\n";
+        return 1;
+    }
+
+    // 16ms steps, like the game at 60fps
+    float dt = .016f;
+    SceneConfig scene = defaultScene;
+    scene.levels = 20;
+
+    SimBatch batch;
+    initSimBatch(&batch, games, scene, 1, policies, 3);
+    vector<RecordedStep> recorded((size_t)games * steps);
+    for(int g=0; g<games; g++) {
+        Sim& sim = batch.sims[g];
+        SimAgent* a = &batch.agents[g];
+        for(int s=0; s<steps; s++) {
+            RecordedStep* r = &recorded[(size_t)g * steps + s];
+            r->numEvents = 0;
+            RecordEffects fx = { r };
+            simStep(sim, simPolicyInput(sim, a), dt, fx);
+            r->state = *sim.state;
+        }
+    }
+    printf("%d games, %d levels, %d steps each\n", games, scene.levels, steps);
+
+    // encode everything, one encoder per game like one game per spectator stream
+    size_t frames = recorded.size();
+    vector<uint8_t> packets(frames * SPECTATE_MAX_PACKET);
+    vector<uint16_t> sizes(frames);
+    SpectateEncoder encoder;
+    auto start = chrono::steady_clock::now();
+    for(int g=0; g<games; g++) {
+        encoder = SpectateEncoder();
+        encoder.open = true;
+        resetSpectateEncoder(&encoder, { g + 1, (uint16_t)scene.levels, (uint8_t)scene.sections,
+            (uint8_t)scene.lights, (uint8_t)scene.detail });
+        for(int s=0; s<steps; s++) {
+            size_t i = (size_t)g * steps + s;
+            const RecordedStep& r = recorded[i];
+            for(int e=0; e<r.numEvents; e++) spectateLevelBroken(&encoder, r.events[e]);
+            sizes[i] = (uint16_t)encodeSpectateFrame(&encoder, r.state, 16);
+            memcpy(&packets[i * SPECTATE_MAX_PACKET], encoder.packet, sizes[i]);
+        }
+    }
+    double encodeNs = nsSince(start, frames);
+
+    SpectateDecoder decoder;
+    vector<SpectateFrame> decoded(frames);
+    start = chrono::steady_clock::now();
+    for(int g=0; g<games; g++) {
+        decoder = SpectateDecoder();
+        for(int s=0; s<steps; s++) {
+            size_t i = (size_t)g * steps + s;
+            if(!decodeSpectateFrame(&decoder, &packets[i * SPECTATE_MAX_PACKET], sizes[i], &decoded[i])) {
+                cerr << "packet " << s << " of game " << g << " didn't decode\n";
+                return 1;
+            }
+        }
+    }
+    double decodeNs = nsSince(start, frames);
+
+    // the decoded state has to be the real one up to the quantization
+    float positionError = 0.f, velocityError = 0.f, rotationError = 0.f;
+    for(size_t i=0; i<frames; i++) {
+        const GameState& real = recorded[i].state;
+        GameState s = real;
+        dequantizeSpectateState(decoded[i].values, &s);
+        positionError = max(positionError, fabsf(s.cameraHeight - real.cameraHeight));
+        for(int k=0; k<3; k++) {
+            positionError = max(positionError, fabsf(s.ballPosition[k] - real.ballPosition[k]));
+            velocityError = max(velocityError, fabsf(s.ballVelocity[k] - real.ballVelocity[k]));
+        }
+        rotationError = max(rotationError, fabsf(remainderf(s.cylinderRotation - real.cylinderRotation, 2.f * (float)M_PI)));
+        bool sameEvents = decoded[i].numEvents == recorded[i].numEvents &&
+            equal(recorded[i].events, recorded[i].events + recorded[i].numEvents, decoded[i].brokenLevels);
+        if(!sameEvents) {
+            cerr << "frame " << i << " has the wrong broken levels\n";
+            return 1;
+        }
+    }
+    // half a step, give or take float rounding
+    if(positionError > .6f / SPECTATE_POSITION_SCALE || velocityError > .6f / SPECTATE_VELOCITY_SCALE ||
+       rotationError > 1.2f * (float)M_PI / 65536.f) {
+        cerr << "decoded state is off by more than the quantization\n";
+        return 1;
+    }
+
+    size_t bytes = 0, keyframes = 0, keyframeBytes = 0;
+    for(size_t i=0; i<frames; i++) {
+        bytes += sizes[i];
+        if(decoded[i].keyframe) {
+            keyframes++;
+            keyframeBytes += sizes[i];
+        }
+    }
+
+    // through a real socket, received right away so the queue never fills up
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/bouncy-spectate-bench.%d.sock", (int)getpid());
+    int fd = bindSpectateSocket(path);
+    if(fd < 0 || !openSpectateEncoder(&encoder, path, { 1, (uint16_t)scene.levels, (uint8_t)scene.sections,
+            (uint8_t)scene.lights, (uint8_t)scene.detail })) {
+        cerr << "Could not set up a socket at " << path << "\n";
+        return 1;
+    }
+    uint8_t packet[SPECTATE_MAX_PACKET];
+    size_t sendFrames = min(frames, (size_t)200000);
+    start = chrono::steady_clock::now();
+    for(size_t i=0; i<sendFrames; i++) {
+        sendSpectateFrame(&encoder, recorded[i].state, 16);
+        if(recv(fd, packet, sizeof(packet), 0) <= 0) {
+            cerr << "packet " << i << " didn't arrive\n";
+            return 1;
+        }
+    }
+    double sendNs = nsSince(start, sendFrames);
+    closeSpectateEncoder(&encoder);
+    close(fd);
+    unlink(path);
+
+    printf("%-10s %10.1f ns per frame\n", "encode", encodeNs);
+    printf("%-10s %10.1f ns per frame\n", "decode", decodeNs);
+    printf("%-10s %10.1f ns per frame, with the encode and the receiving end\n", "send", sendNs);
+    printf("%-10s %10.1f bytes per frame, %.1f per keyframe, %zu raw\n", "size",
+        (double)bytes / frames, keyframes ? (double)keyframeBytes / keyframes : 0.0,
+        sizeof(float) * 2 + sizeof(glm::vec3) * 2);
+    printf("%-10s %10.6f position, %.6f velocity, %.6f rotation (max)\n", "error",
+        positionError, velocityError, rotationError);
+    printf("%-10s %10.4f%% of a 16.7ms frame to encode and send\n", "cost", sendNs / 1e6 / 16.7 * 100.0);
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "validate.h"
+
+// scores a lot of generated levels with 1 .. N threads and reports how throughput scales,
+// then what the scores look like at the game's rotation speed and at a slower one. last it
+// checks that the generator's filter turns down levels it should and that they get
+// generated again, up to MAX_LEVEL_ATTEMPTS times, and fails if it doesn't
+// usage: validate [numLevels] [maxThreads]
+
+void summarize(const char* name, const vector<LevelScore>& scores) {
+    size_t rejected = 0;
+    double difficulty = 0.0;
+    size_t histogram[VALIDATE_MAX_BOUNCES + 2] = {};
+    for(auto& s : scores) {
+        if(!levelPlayable(s)) rejected++;
+        difficulty += s.difficulty;
+        histogram[(int)(s.difficulty + .5f)]++;
+    }
+    printf("%-8s %8zu rejected (%.3f%%), mean difficulty %.2f bounces\n", name, rejected,
+        100.0 * rejected / scores.size(), difficulty / scores.size());
+    for(int b=0; b<VALIDATE_MAX_BOUNCES + 2; b++) {
+        if(histogram[b]) printf("%8s %2d bounces: %zu\n", "", b, histogram[b]);
+    }
+}
+
+// a ring with the first width sections left open
+LevelLayout holeLevel(int width) {
+    LevelLayout l = {};
+    l.numHoles = width > 0;
+    l.holeWidth = width;
+    l.solid = (~0ull >> (64 - platformGeometry.sections)) & ~((1ull << width) - 1);
+    return l;
+}
+
+bool expectPlayable(const LevelValidator& v, const char* name, const LevelLayout& l, bool playable) {
+    LevelScore s = validateLevel(v, l);
+    printf("%-32s passable %d, reachable %.2f, %s\n", name, s.passable, s.reachable,
+        levelPlayable(s) ? "kept" : "rejected");
+    if(levelPlayable(s) == playable) return true;
+    cerr << name << " should have been " << (playable ? "kept" : "rejected") << "\n";
+    return false;
+}
+
+// generates n levels through LevelGenerator with v as the filter, the way the game does,
+// and checks each against generateAcceptedLevel. returns how many times the filter ran
+// (n if nothing was turned down), or 0 if the levels don't match
+size_t generateFiltered(const LevelValidator& v, ThreadPool* pool, size_t n, size_t* gaveUp) {
+    atomic<size_t> calls(0);
+    LevelFilter check = playableLevelFilter(v);
+    LevelFilter accept = [&](const LevelLayout& l) {
+        calls++;
+        return check(l);
+    };
+    LevelGenerator gen(pool, 1234, n, 1, platformGeometry.sections, accept);
+    gen.request(0);
+    const LevelLayout* levels = gen.wait(0);
+
+    *gaveUp = 0;
+    size_t attempts = 0;
+    for(size_t i=0; i<n; i++) {
+        uint32_t a;
+        LevelLayout l = generateAcceptedLevel(1234, i, platformGeometry.sections, check, &a);
+        if(l.solid != levels[i].solid) {
+            cerr << "level " << i << " differs from a serial generateAcceptedLevel\n";
+            return 0;
+        }
+        attempts += a;
+        if(!check(l)) (*gaveUp)++;
+    }
+    gen.release(0);
+    if(attempts != calls) {
+        cerr << "the generator ran the filter " << calls << " times, serially it takes " << attempts << "\n";
+        return 0;
+    }
+    return calls;
+}
+
+int main(int argc, char** argv) {
+    size_t numLevels = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    int maxThreads = argc > 2 ? atoi(argv[2]) : (int)thread::hardware_concurrency();
+    if(maxThreads <= 0) maxThreads = 1;
+
+    vector<LevelLayout> levels(numLevels);
+    for(size_t i=0; i<numLevels; i++) levels[i] = generateLevel(1234, i);
+
+    LevelValidator v;
+    initLevelValidator(&v, platformGeometry, VALIDATE_GAME_DT);
+    printf("entry %d steps, bounce %d steps\n", v.entrySteps, v.bounceSteps);
+
+    vector<LevelScore> scores(numLevels);
+    float checksum = 0.f;
+    double baseline = 0.0;
+
+    printf("%8s %14s %10s %8s\n", "threads", "levels/s", "ms", "speedup");
+    for(int t=1; t<=maxThreads; t++) {
+        // the caller participates in parallelFor, so t threads means t-1 workers
+        ThreadPool pool(t > 1 ? t-1 : 1);
+
+        auto start = chrono::steady_clock::now();
+        validateLevels(v, &levels[0], numLevels, &scores[0], t > 1 ? &pool : NULL);
+        auto end = chrono::steady_clock::now();
+
+        // make sure every run scored the same (and that the work isn't optimized out)
+        float sum = 0.f;
+        for(auto& s : scores) sum += s.difficulty;
+        if(t == 1) checksum = sum;
+        else if(sum != checksum) {
+            cerr << "score mismatch with " << t << " threads\n";
+            return 1;
+        }
+
+        double ms = chrono::duration<double, milli>(end - start).count();
+        if(t == 1) baseline = ms;
+        printf("%8d %14.0f %10.2f %8.2f\n", t, numLevels / (ms / 1000.0), ms, baseline / ms);
+    }
+
+    printf("\n");
+    summarize("game", scores);
+
+    // a third of the game's speed, about what someone tapping the keys manages
+    LevelValidator relaxed;
+    initLevelValidator(&relaxed, platformGeometry, VALIDATE_GAME_DT, .05f / 3.f);
+    validateLevels(relaxed, &levels[0], numLevels, &scores[0], NULL);
+    summarize("relaxed", scores);
+
+    // generated levels always have a hole of 4 or more sections and nearly all pass at any
+    // sensible speed, so the filter is checked with layouts built to fail. holes of up to
+    // 3 sections are narrower than the ball
+    printf("\n");
+    bool ok = true;
+    ok &= expectPlayable(v, "solid ring", holeLevel(0), false);
+    ok &= expectPlayable(v, "3 section hole", holeLevel(3), false);
+    ok &= expectPlayable(v, "4 section hole", holeLevel(4), true);
+    // a single 4 wide hole at a crawl can't be turned under the ball from the far side
+    LevelValidator crawl;
+    initLevelValidator(&crawl, platformGeometry, VALIDATE_GAME_DT, .004f);
+    ok &= expectPlayable(crawl, "4 section hole, crawling", holeLevel(4), false);
+
+    // at a crawl the single hole levels are turned down and generated again until they
+    // come out with two holes. slower still nothing passes, and every level runs out of
+    // attempts and keeps its last one
+    ThreadPool pool(maxThreads);
+    size_t n = min(numLevels, (size_t)20000);
+    size_t gaveUp;
+    size_t calls = generateFiltered(crawl, &pool, n, &gaveUp);
+    printf("crawling %8zu levels, filter ran %zu times, %zu gave up\n", n, calls, gaveUp);
+    if(calls <= n || gaveUp > 0) {
+        cerr << "expected levels to be regenerated at a crawl, and all of them to pass in the end\n";
+        ok = false;
+    }
+
+    LevelValidator stuck;
+    initLevelValidator(&stuck, platformGeometry, VALIDATE_GAME_DT, .002f);
+    calls = generateFiltered(stuck, &pool, n, &gaveUp);
+    printf("stuck    %8zu levels, filter ran %zu times, %zu gave up\n", n, calls, gaveUp);
+    if(calls != n * MAX_LEVEL_ATTEMPTS || gaveUp != n) {
+        cerr << "expected every level to use all " << MAX_LEVEL_ATTEMPTS << " attempts\n";
+        ok = false;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+#include <iostream>
+#include <vector>
+#include <functional>
+using namespace std;
+
+#include <stdio.h>
+
+#include "mesh.h"
+#include "scene.h"
+#include "collision.h"
+
+// runs the mesh generators for the default scene at build time and prints them as a
+// header of static arrays (baked_meshes.h), which the library uses instead of generating
+// the meshes in Initialize when it is built with BAKED=1
+// usage: bake > baked_meshes.h
+
+// the parameters have to match what Initialize passes to the generators
+const int detail = defaultScene.detail;
+const int sections = defaultScene.sections;
+const float towerHeight = defaultScene.levels * platformGeometry.levelHeight;
+
+void bake(const char* name, function<void(VertexWriter&)> generator, VertexLayout layout) {
+    vector<uint8_t> data;
+    VertexWriter out(layout, &data);
+    generator(out);
+
+    // every layout has a stride that is a multiple of 4, words keep the header small
+    vector<uint32_t> words(data.size() / 4);
+    memcpy(&words[0], &data[0], words.size() * 4);
+
+    printf("static const uint32_t %sData[%zu] = {", name, words.size());
+    for(size_t i=0; i<words.size(); i++) {
+        printf("%s0x%08x,", i % 8 == 0 ? "\n    " : " ", words[i]);
+    }
+    printf("\n};\n");
+
+    const char* positionFormats[] = { "POSITION_FLOAT", "POSITION_HALF", "POSITION_SNORM16" };
+    const char* normalFormats[] = { "NORMAL_FLOAT", "NORMAL_INT_2_10_10_10" };
+    printf("const BakedMesh %s = { %sData, sizeof(%sData), %d, { %s, %s },\n",
+        name, name, name, out.numVertices, positionFormats[layout.position], normalFormats[layout.normal]);
+    // %.9g is enough for a float to come back exactly the same
+    printf("    glm::vec3(%.9g, %.9g, %.9g), glm::vec3(%.9g, %.9g, %.9g) };\n\n",
+        out.positionBias.x, out.positionBias.y, out.positionBias.z,
+        out.positionScale.x, out.positionScale.y, out.positionScale.z);
+}
+
+int main() {
+    printf("#pragma once\n\n");
+    printf("// generated by bake.cpp, don't edit\n\n");
+    printf("#include \"mesh.h\"\n\n");
+    printf("// what the meshes were baked for, anything else is generated as usual\n");
+    printf("const int bakedDetail = %d;\n", detail);
+    printf("const int bakedSections = %d;\n", sections);
+    printf("const float bakedTowerHeight = %.9g;\n\n", towerHeight);
+
+    bake("bakedCylinder", [](VertexWriter& out) { generateCylinder(out, 40 * detail, towerHeight); }, compactVertexLayout);
+    bake("bakedSphere", [](VertexWriter& out) { generateUVSphere(out, 40 * detail, BALL_RADIUS); }, compactVertexLayout);
+    bake("bakedPlatform", [](VertexWriter& out) { generatePlatformSection(out, sections, 4 * detail + 1); }, compactVertexLayout);
+    bake("bakedParticle", [](VertexWriter& out) { generateUVSphere(out, 6, 1.f); }, compactVertexLayout);
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cmath>
+#include <glm/glm.hpp>
+
+#include "levels.h"
+#include "mesh.h"
+
+// continuous collision of the ball against the platforms
+// the ball is swept along its motion for the whole step and stopped where it touches a
+// platform (to within a 1e-4 gap), so a large step can't carry it through a 0.1 thick
+// platform anymore
+
+// matches generatePlatformSection and the level placement in main.cpp
+struct PlatformGeometry {
+    float innerRadius;
+    float outerRadius;
+    float thickness;
+    float levelHeight;
+    int sections;
+};
+
+const PlatformGeometry platformGeometry = { 1.f, 2.f, .1f, 2.f, 32 };
+
+#define BALL_RADIUS .3f
+
+struct SweepHit {
+    // fraction of the motion at the moment of impact, in [0, 1]
+    float t;
+    // from the platform towards the ball's center
+    glm::vec3 normal;
+    int level, section;
+};
+
+// closest point of a solid annular sector to p. the sector lies between the radii, the
+// angles a0 < a1 (measured like atan2(z, x)) and the heights y0 < y1
+inline glm::vec3 closestPointOnSector(glm::vec3 p, float r1, float r2, float a0, float a1, float y0, float y1) {
+    float r = std::sqrt(p.x*p.x + p.z*p.z);
+    float angle = std::atan2(p.z, p.x);
+    float rel = std::fmod(angle - a0, 2*PI);
+    if(rel < 0.f) rel += 2*PI;
+
+    glm::vec3 c;
+    if(rel <= a1 - a0 && r > 0.f) {
+        // within the wedge, the closest point is straight in or out along the radius
+        float cr = glm::clamp(r, r1, r2);
+        c = glm::vec3(p.x / r * cr, 0.f, p.z / r * cr);
+    } else {
+        // outside the wedge, the closest point lies on one of the two flat ends
+        // (the sector is far narrower than pi, so the wedge is convex)
+        glm::vec3 e0(std::cos(a0), 0.f, std::sin(a0));
+        glm::vec3 e1(std::cos(a1), 0.f, std::sin(a1));
+        glm::vec3 c0 = e0 * glm::clamp(p.x*e0.x + p.z*e0.z, r1, r2);
+        glm::vec3 c1 = e1 * glm::clamp(p.x*e1.x + p.z*e1.z, r1, r2);
+        glm::vec2 d0(p.x - c0.x, p.z - c0.z);
+        glm::vec2 d1(p.x - c1.x, p.z - c1.z);
+        c = glm::dot(d0, d0) < glm::dot(d1, d1) ? c0 : c1;
+    }
+    c.y = glm::clamp(p.y, y0, y1);
+    return c;
+}
+
+// sweeps a sphere from p0 along d against one sector (conservative advancement: the
+// distance to a convex-enough solid can only shrink as fast as the sphere moves, so
+// stepping by the current gap never skips over the surface)
+// spheres that already overlap the sector at t = 0 are ignored, that only happens when
+// the platforms were rotated into the ball and it should be let through
+// a sphere moving nearly parallel to a face takes smaller and smaller steps and can run out
+// of iterations, whether it is closing in or just sliding past. the rest of the step is
+// then searched for the smallest gap (the distance along a line to a convex face is
+// convex), a miss if that stays clear, otherwise bisected for where it first drops below eps
+inline bool sweepSphereSector(glm::vec3 p0, glm::vec3 d, float radius,
+        float r1, float r2, float a0, float a1, float y0, float y1,
+        float* toi, glm::vec3* normal) {
+    const float eps = 1e-4f;
+    float len = glm::length(d);
+
+    auto gapAt = [&](float t) {
+        glm::vec3 p = p0 + d * t;
+        return glm::length(p - closestPointOnSector(p, r1, r2, a0, a1, y0, y1)) - radius;
+    };
+
+    float t = 0.f;
+    for(int i=0; i<64; i++) {
+        glm::vec3 p = p0 + d * t;
+        glm::vec3 c = closestPointOnSector(p, r1, r2, a0, a1, y0, y1);
+        float dist = glm::length(p - c);
+        float gap = dist - radius;
+
+        if(gap < eps) {
+            glm::vec3 n = dist > 0.f ? (p - c) / dist : glm::vec3(0.f, 1.f, 0.f);
+            // already inside, or just touching and moving away
+            if(t == 0.f && (gap < -eps || glm::dot(d, n) >= 0.f)) return false;
+            *toi = t;
+            *normal = n;
+            return true;
+        }
+        if(len == 0.f) return false;
+
+        t += gap / len;
+        if(t > 1.f) return false;
+    }
+
+    // ternary search for the closest approach in [t, 1]
+    float lo = t, hi = 1.f;
+    for(int i=0; i<32; i++) {
+        float m1 = lo + (hi - lo) / 3.f, m2 = hi - (hi - lo) / 3.f;
+        if(gapAt(m1) < gapAt(m2)) hi = m2;
+        else lo = m1;
+    }
+    float closest = (lo + hi) / 2.f;
+    if(gapAt(closest) >= eps) return false;
+
+    // the gap is still clear at t, so the first contact lies between t and the closest point
+    lo = t;
+    hi = closest;
+    for(int i=0; i<32; i++) {
+        float m = (lo + hi) / 2.f;
+        if(gapAt(m) < eps) hi = m;
+        else lo = m;
+    }
+    glm::vec3 p = p0 + d * hi;
+    glm::vec3 c = closestPointOnSector(p, r1, r2, a0, a1, y0, y1);
+    float dist = glm::length(p - c);
+    *toi = hi;
+    *normal = dist > 0.f ? (p - c) / dist : glm::vec3(0.f, 1.f, 0.f);
+    return true;
+}
+
+// sweeps the ball from p0 along d against every solid section of the levels
+// rotation is the tower's current rotation (st->cylinderRotation)
+inline bool sweepBallAgainstLevels(glm::vec3 p0, glm::vec3 d, float radius, float rotation,
+        const LevelLayout* levels, int numLevels, const PlatformGeometry& pg, SweepHit* hit) {
+    float delta = 2*PI / pg.sections;
+
+    float lo = std::fmin(p0.y, p0.y + d.y) - radius;
+    float hi = std::fmax(p0.y, p0.y + d.y) + radius;
+
+    // section i is drawn rotated by i*delta + rotation, and glm::rotate about y turns angle a
+    // into a - angle. so with the ball turned by +rotation, section i covers the angles
+    // [-i*delta, -(i-1)*delta], and the sections don't have to be rotated at all
+    float c = std::cos(rotation), s = std::sin(rotation);
+    auto toLevel = [&](glm::vec3 v) {
+        return glm::vec3(c*v.x - s*v.z, v.y, s*v.x + c*v.z);
+    };
+    glm::vec3 lp0 = toLevel(p0);
+    glm::vec3 ld = toLevel(d);
+
+    bool found = false;
+    hit->t = 2.f;
+    for(int l=0; l<numLevels; l++) {
+        float y0 = l * pg.levelHeight;
+        float y1 = y0 + pg.thickness;
+        if(y1 < lo || y0 > hi) continue;
+
+        for(int i=0; i<pg.sections; i++) {
+            if(!((levels[l].solid >> i) & 1)) continue;
+
+            float toi;
+            glm::vec3 n;
+            if(sweepSphereSector(lp0, ld, radius, pg.innerRadius, pg.outerRadius,
+                    -i*delta, -(i-1)*delta, y0, y1, &toi, &n) && toi < hit->t) {
+                hit->t = toi;
+                // back to world space
+                hit->normal = glm::vec3(c*n.x + s*n.z, n.y, -s*n.x + c*n.z);
+                hit->level = l;
+                hit->section = i;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
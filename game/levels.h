@@ -0,0 +1,194 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include <functional>
+
+#include "threadpool.h"
+
+// one bit per section
+#define MAX_LEVEL_SECTIONS 64
+
+// platform layout of a single level
+// a level is generated purely from (seed, level index), so any level can be generated
+// on any thread, in any order, and still come out the same
+struct LevelLayout {
+    uint8_t numHoles;
+    uint8_t holeWidth; // in sections
+    uint8_t holeOffset;
+    // bit i is set if section i is solid
+    uint64_t solid;
+};
+
+// splitmix32-ish hash, used to derive an independent random stream for each level
+inline uint32_t levelHash(uint32_t x) {
+    x += 0x9e3779b9u;
+    x = (x ^ (x >> 16)) * 0x85ebca6bu;
+    x = (x ^ (x >> 13)) * 0xc2b2ae35u;
+    return x ^ (x >> 16);
+}
+
+// is section i in [begin, end), where a hole running past the last section wraps around
+inline bool holeInRange(int i, int begin, int end) {
+    if(end < begin) return i >= begin || i < end;
+    return i >= begin && i < end;
+}
+
+// a generator that rejects levels gets this many tries per level before it gives up and
+// keeps the last one
+#define MAX_LEVEL_ATTEMPTS 16
+
+// sections is how many sections make up the ring, holes are sized for 32 and scaled
+// attempt picks another layout for the same level, for when the first one got rejected
+inline LevelLayout generateLevel(int seed, uint32_t index, int sections = 32, uint32_t attempt = 0) {
+    uint32_t rng = levelHash((uint32_t)seed ^ levelHash(index));
+    if(attempt > 0) rng = levelHash(rng + attempt);
+    auto next = [&]() {
+        // xorshift32
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        return rng;
+    };
+    if(rng == 0) rng = 1;
+
+    LevelLayout l;
+    l.numHoles = 1 + next() % 2;
+    l.holeWidth = (4 + next() % 4) * sections / 32;
+    if(l.holeWidth < 1) l.holeWidth = 1;
+    l.holeOffset = next() % sections;
+
+    l.solid = 0;
+    for(int i=0; i<sections; i++) {
+        bool v = true;
+
+        int holeBegin = l.holeOffset;
+        int holeEnd = (holeBegin + l.holeWidth) % sections;
+        if(holeInRange(i, holeBegin, holeEnd)) v = false;
+
+        if(l.numHoles > 1) {
+            int holeBegin = (l.holeOffset + sections / 2) % sections;
+            int holeEnd = (holeBegin + l.holeWidth) % sections;
+            if(holeInRange(i, holeBegin, holeEnd)) v = false;
+        }
+
+        if(v) l.solid |= 1ull << i;
+    }
+
+    return l;
+}
+
+// the levels accept() turns down are generated again (see validate.h), up to
+// MAX_LEVEL_ATTEMPTS times. it is called on the pool's threads
+typedef std::function<bool(const LevelLayout&)> LevelFilter;
+
+// the level, or the first retry accept() takes. after MAX_LEVEL_ATTEMPTS the last try is
+// kept anyway. attempts, if given, gets how many were generated
+inline LevelLayout generateAcceptedLevel(int seed, uint32_t index, int sections, const LevelFilter& accept,
+                                         uint32_t* attempts = NULL) {
+    uint32_t attempt = 0;
+    LevelLayout l;
+    do {
+        l = generateLevel(seed, index, sections, attempt);
+    } while(accept && !accept(l) && ++attempt < MAX_LEVEL_ATTEMPTS);
+    if(attempts) *attempts = attempt < MAX_LEVEL_ATTEMPTS ? attempt + 1 : MAX_LEVEL_ATTEMPTS;
+    return l;
+}
+
+// a batch is split into about this many tasks per worker, so a worker that draws slow
+// levels (ones the filter keeps turning down) doesn't hold up the batch
+#define LEVEL_CHUNKS_PER_WORKER 4
+
+// generates levels in fixed size batches on a thread pool
+// batches go into a ring of preallocated slots; the owner requests a batch, keeps
+// playing, and later picks it up with poll() once it has been filled in. each batch is
+// split into chunks that run on all the workers, the last chunk to finish marks it ready
+class LevelGenerator {
+public:
+    LevelGenerator(ThreadPool* pool, int seed, size_t batchSize, size_t numSlots, int sections = 32,
+                   LevelFilter accept = nullptr)
+        : pool(pool), seed(seed), sections(sections), batchSize(batchSize),
+          levels(batchSize * numSlots), slots(numSlots), accept(accept) {
+        for(auto& s : slots) s.batch = -1;
+    }
+
+    ~LevelGenerator() {
+        // tasks write into our slots, so they have to be finished before we go away
+        for(auto& s : slots) {
+            while(s.state.load(std::memory_order_acquire) == Pending) {
+                if(!pool->runPendingTask()) std::this_thread::yield();
+            }
+        }
+    }
+
+    // queue generation of batch b (levels b*batchSize .. (b+1)*batchSize-1)
+    // returns false if its slot is still busy with an unreleased batch
+    bool request(uint32_t b) {
+        Slot& s = slots[b % slots.size()];
+        int expected = Free;
+        if(!s.state.compare_exchange_strong(expected, Pending, std::memory_order_acq_rel)) return false;
+
+        s.batch = b;
+        LevelLayout* out = &levels[(b % slots.size()) * batchSize];
+        size_t n = batchSize;
+        size_t chunks = (size_t)pool->size() * LEVEL_CHUNKS_PER_WORKER;
+        if(chunks > n) chunks = n;
+        s.chunksLeft.store(chunks, std::memory_order_relaxed);
+        for(size_t c=0; c<chunks; c++) {
+            size_t begin = n * c / chunks, end = n * (c+1) / chunks;
+            pool->submit([this, &s, out, n, b, begin, end] {
+                for(size_t i=begin; i<end; i++) {
+                    out[i] = generateAcceptedLevel(seed, b*n + i, sections, accept);
+                }
+                if(s.chunksLeft.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    s.state.store(Ready, std::memory_order_release);
+                }
+            });
+        }
+        return true;
+    }
+
+    // the batch's levels, or NULL if it has not finished yet
+    const LevelLayout* poll(uint32_t b) const {
+        const Slot& s = slots[b % slots.size()];
+        if(s.state.load(std::memory_order_acquire) != Ready || s.batch != (int64_t)b) return NULL;
+        return &levels[(b % slots.size()) * batchSize];
+    }
+
+    // block until batch b is ready, generating levels on this thread too; only meant
+    // for startup
+    const LevelLayout* wait(uint32_t b) const {
+        const LevelLayout* l;
+        while(!(l = poll(b))) {
+            if(!pool->runPendingTask()) std::this_thread::yield();
+        }
+        return l;
+    }
+
+    // hand the slot back once the caller has copied what it needs out of it
+    void release(uint32_t b) {
+        Slot& s = slots[b % slots.size()];
+        if(s.batch != (int64_t)b) return;
+        s.batch = -1;
+        s.state.store(Free, std::memory_order_release);
+    }
+
+private:
+    enum { Free = 0, Pending, Ready };
+
+    struct Slot {
+        std::atomic<int> state{Free};
+        int64_t batch;
+        // of the batch's tasks, the last one to finish marks the slot ready
+        std::atomic<size_t> chunksLeft{0};
+    };
+
+    ThreadPool* pool;
+    int seed;
+    int sections;
+    size_t batchSize;
+    std::vector<LevelLayout> levels;
+    std::vector<Slot> slots;
+    LevelFilter accept;
+};
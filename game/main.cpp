@@ -3,18 +3,47 @@
 #include <sstream>
 #include <vector>
 #include <functional>
+#include <atomic>
+#include <algorithm>
 using namespace std;
 
+#ifndef BACKWARD_HAS_BFD
 #define BACKWARD_HAS_BFD 1
+#endif
 #include <backward.hpp>
 
 #define GL_GLEXT_PROTOTYPES 1
+#ifdef __APPLE__
 #define GL_SILENCE_DEPRECATION // make osx complain less
 #include <OpenGL/gl3.h> // this should normally be GL/gl3.h
+#else
+#include <GL/glcorearb.h>
+#endif
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "registry.h"
+#include "streambuffer.h"
+#include "shaders.h"
 
 #include <stdio.h>
 
+#include "threadpool.h"
+#include "levels.h"
+#include "mesh.h"
+#include "state.h"
+#include "collision.h"
+#include "particles.h"
+#include "scene.h"
+#include "sim.h"
+#include "validate.h"
+#include "spectate.h"
+#include "raster.h"
+#ifdef BAKED_MESHES
+// generated by bake.cpp, see the Makefile
+#include "baked_meshes.h"
+#endif
+
 struct KeyState {
     // virtual game pad with 2 analogs, a d-pad and 16 "regular" buttons
 
@@ -35,26 +64,32 @@ extern "C" int Initialize(bool, void*);
 extern "C" void Update(KeyState, uint64_t);
 extern "C" void Draw();
 extern "C" void Cleanup();
+// optional, see the launcher's postprocess.h
+extern "C" void FrameCamera(float, float, float*, float*);
+// optional, see glstate.h
+extern "C" void FrameGLCalls(GLCallCounts*);
 
-struct GameState {
-    float cameraHeight;
-
-    float cylinderRotation;
-
-    glm::vec3 ballPosition;
-    glm::vec3 ballVelocity;
-    glm::vec3 ballForce;
-
-    int randomSeed;
-};
-
-// persisted game state
+// persisted game state, points into the launcher's block (after the layout header)
 GameState* st;
 
 struct Mesh {
-    vector<float> data;
+    // owner tag for its GL objects, see registry.h
+    const char* name;
+    vector<uint8_t> data;
+    // data, or the baked array. what the software renderer draws from
+    const uint8_t* vertices;
     // TODO: Store vertices in a separate array and use an element array buffer
+    int numVertices;
+    VertexLayout layout;
+    // stored position -> model space, see VertexWriter
+    glm::vec3 positionBias, positionScale;
     GLuint vao, vbo;
+    // bytes of data already in the vbo, the mesh is only drawn once all of it is
+    size_t uploaded;
+    bool ready;
+    // no vertices, a quad the shaders ray cast a sphere in: positionBias is the center and
+    // positionScale.x the radius (see vertex.gl)
+    bool impostor;
 };
 
 struct Drawable {
@@ -65,411 +100,520 @@ struct Drawable {
     const Mesh* mesh;
     // rgb value
     glm::vec3 color;
+    // drawn this many times with per instance data if > 0 (only the particles so far)
+    int numInstances;
+    // picks the shader permutation it is drawn with, together with the quality tier
+    Material material;
 };
 
 // temporaries - regenerated in initialize
 Mesh cylinderMesh;
 Mesh sphereMesh;
 Mesh platformMesh;
+Mesh particleMesh;
 
 Drawable cylinder;
 Drawable ball;
+
+// balls besides the player's (stress scenes only). not part of the saved state, a
+// reload starts them over
+struct ExtraBall {
+    glm::vec3 position, velocity, force;
+};
+vector<ExtraBall> extraBalls;
+vector<Drawable> extraBallDrawables;
 vector<Drawable> platformSections;
-GLuint program;
+// which sections are solid, per level, for collisions
+vector<LevelLayout> levelLayouts;
+// the game's simulation, runs on st and levelLayouts
+Sim sim;
+// levels it says can't be played get generated again
+LevelValidator levelValidator;
+
+// read from the environment in Initialize, see scene.h
+SceneConfig scene;
+PlatformGeometry platform;
+
+#define MAX_PARTICLES 65536
+ParticleSystem particleSystem;
+// all particles are a single drawable, instanced from particleStream
+Drawable particles;
+StreamBuffer particleStream;
+// every permutation this instance uses, see shaders.h
+ShaderCache shaders;
+QualityTier quality;
+const ShaderProgram* materialPrograms[MATERIAL_COUNT];
+// the same for sphere impostors
+const ShaderProgram* impostorPrograms[MATERIAL_COUNT];
+// some permutation has fewer lights than the scene, it gets the ones closest to the camera
+bool nearestLights;
+
+// everything the vertex shader needs per object, laid out as rgba texels
+// (see OBJECT_TEXELS in vertex.gl)
+struct ObjectRecord {
+    glm::mat4 mvp;
+    glm::mat4 mv;
+    glm::vec4 normalMatrix[3];
+    glm::vec4 color;
+    glm::vec4 positionBias;
+    glm::vec4 positionScale;
+};
+static_assert(sizeof(ObjectRecord) == 14 * 16, "ObjectRecord has to match OBJECT_TEXELS");
+
+// per object records for every frame in flight
+StreamBuffer objectStream;
+size_t maxObjects;
+
+const glm::vec3 clearColor(0.f, .1f, 0.f);
 
 glm::mat4 cylinderTransform;
 glm::mat4 view;
 glm::mat4 projection;
+// clip space offset of the next Draw's projection, the launcher's temporal antialiasing
+// sets it through FrameCamera
+glm::vec2 jitter;
 
 // the memory layout of this is continous x y z x y z x ... valuues
 // so it should work ok when passed to a shader as &vec[0]
 vector<glm::vec3> lightPositions;
-
-void generateMesh(Mesh* m, function<void(function<void(float)>)> generator) {
-    *m = { vector<float>(), 0, 0 };
-    generator([&](float f){ m->data.push_back(f); });
-
-    glGenVertexArrays(1, &m->vao);
-    glBindVertexArray(m->vao);
-    glGenBuffers(1, &m->vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*m->data.size(), &m->data[0], GL_STATIC_DRAW);
+// same thing in camera space, recomputed once per frame in Draw
+vector<glm::vec3> lightPositionsCameraspace;
+
+// the spectator stream, open while BOUNCY_SPECTATE is set (see spectate.h)
+SpectateEncoder spectator;
+
+// BOUNCY_RENDERER=software draws on the cpu with raster.h, and GL only puts the image on
+// the screen: a textured triangle that also writes the depth, for the launcher's antialiasing
+bool softwareRenderer;
+RasterRenderer* raster;
+vector<ParticleInstance> softwareParticles;
+GLuint softwareColor, softwareDepth;
+int softwareWidth, softwareHeight;
+GLuint softwareProgram, softwareVao;
+GLint softwareOrigin;
+
+// worker threads for level and mesh generation, owned by this instance of the library
+// (they have to be joined in Cleanup, before the code they run gets unloaded)
+ThreadPool* pool;
+
+// a mesh whose vertices are being generated on the pool. once they are, uploadMeshes
+// copies them into the vbo a slice per frame
+struct MeshJob {
+    Mesh* mesh;
+    std::atomic<bool> generated;
+};
+vector<MeshJob*> meshJobs;
+
+// at most this many bytes of vertex data go to the gpu per frame, so a big mesh can't
+// stall a frame
+#define MESH_UPLOAD_BUDGET (1 << 20)
+
+// the mesh is empty until the job finishes, drawables using it are skipped until then
+void generateMesh(Mesh* m, const char* name, function<void(VertexWriter&)> generator, VertexLayout layout) {
+    *m = {};
+    m->name = name;
+    m->layout = layout;
+
+    MeshJob* job = new MeshJob();
+    job->mesh = m;
+    job->generated = false;
+    meshJobs.push_back(job);
+
+    pool->submit([job, generator] {
+        Mesh* m = job->mesh;
+        VertexWriter out(m->layout, &m->data);
+        generator(out);
+        m->numVertices = out.numVertices;
+        m->positionBias = out.positionBias;
+        m->positionScale = out.positionScale;
+        job->generated.store(true, std::memory_order_release);
+    });
 }
 
-void deleteMesh(Mesh* m) {
-    glDeleteBuffers(1, &m->vbo);
-    glDeleteVertexArrays(1, &m->vao);
-}
-
-// pass the view and projection matrices to draw it
-void drawDrawable(const Drawable* d, glm::mat4 v, glm::mat4 p) {
-    if(!d->visible) return;
-
-    GLuint mLocation = glGetUniformLocation(program, "M");
-    glUniformMatrix4fv(mLocation, 1, GL_FALSE, &d->transform[0][0]);
-
-    GLuint vLocation = glGetUniformLocation(program, "V");
-    glUniformMatrix4fv(vLocation, 1, GL_FALSE, &v[0][0]);
-    
-    GLuint pLocation = glGetUniformLocation(program, "P");
-    glUniformMatrix4fv(pLocation, 1, GL_FALSE, &p[0][0]);
-
-    GLuint colorLocation = glGetUniformLocation(program, "ObjectColor");
-    glUniform3fv(colorLocation, 1, &d->color[0]);
-
-    GLuint lightLocation = glGetUniformLocation(program, "LightPositions_worldspace");
-    glUniform3fv(lightLocation, 1, &lightPositions[0][0]);
-
-    int numVertices = d->mesh->data.size() / 6;
-
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(2);
-    glBindBuffer(GL_ARRAY_BUFFER, d->mesh->vao);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (void*)0);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (void*)(3*sizeof(GLfloat)));
-    glDrawArrays(GL_TRIANGLES, 0, numVertices);
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(2);
-}
-
-#define PI 3.141592f
-
-#define ADD_FACE(i, j, k, ni, nj, nk) { \
-    addItem(vertices[(i)].x); \
-    addItem(vertices[(i)].y); \
-    addItem(vertices[(i)].z); \
-    addItem(normals[(ni)].x); \
-    addItem(normals[(ni)].y); \
-    addItem(normals[(ni)].z); \
-    \
-    addItem(vertices[(j)].x); \
-    addItem(vertices[(j)].y); \
-    addItem(vertices[(j)].z); \
-    addItem(normals[(nj)].x); \
-    addItem(normals[(nj)].y); \
-    addItem(normals[(nj)].z); \
-    \
-    addItem(vertices[(k)].x); \
-    addItem(vertices[(k)].y); \
-    addItem(vertices[(k)].z); \
-    addItem(normals[(nk)].x); \
-    addItem(normals[(nk)].y); \
-    addItem(normals[(nk)].z); \
-}
-
-void generateCylinder(function<void(float)> addItem) {
-    vector<glm::vec3> vertices;
-    vector<glm::vec3> normals;
-    
-    // how many vertices in a circle
-    int k = 40;
-
-    float h = 10.0f;
-
-    float delta = 2*PI / k;
-
-    // vertex 0 is bottom face center
-    // vertex 1 .. k is bottom face edges
-    // vertex k+1 is top face center
-    // vertex k+2 .. 2k+1 is top face edges
-
-    // normal 0 is bottom face
-    // normals 1 .. k are outwards from the edges
-    // normal k+1 is top face
-    
-    vertices.push_back({ 0.0f, 0.0f, 0.0f }); // center
-    normals.push_back({ 0.f, -1.f, 0.f });
-    float rads = 0.0;
-    for(int i=0; i<k; i++) {
-        float x = cos(rads);
-        float z = sin(rads);
-        vertices.push_back({x, 0.0f, z});
-        normals.push_back({ x, 0.f, z });
-
-        rads += delta;
+// allocates the vbo and sets up the vao, data can be NULL to fill the vbo in later
+void createMeshBuffers(Mesh* m, const void* data, size_t size) {
+    m->vao = genVertexArray(m->name);
+    bindVertexArray(m->vao);
+    m->vbo = genBuffer(m->name);
+    bindBuffer(GL_ARRAY_BUFFER, m->vbo);
+    bufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+
+    // the attribute setup lives in the vao, so drawing only has to bind it
+    const VertexLayout& layout = m->layout;
+    GLsizei stride = vertexStride(layout);
+    switch(layout.position) {
+    case POSITION_FLOAT:
+        vertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        break;
+    case POSITION_HALF:
+        vertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, stride, (void*)0);
+        break;
+    case POSITION_SNORM16:
+        vertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, stride, (void*)0);
+        break;
     }
 
-    normals.push_back({ 0.f, 1.f, 0.f });
-
-    // the second circle
-    vertices.push_back({ 0.0f, h, 0.0f }); // center
-    rads = 0.0;
-    for(int i=0; i<k; i++) {
-        float x = cos(rads);
-        float z = sin(rads);
-        vertices.push_back({x, h, z});
-
-        rads += delta;
-    }
-
-    // index 0 is center
-    // index 1 - (k-1) is all the vertices minus the last one
-
-    // the bottom face all has bottom face normals, obviously
-
-    for(int i=1; i<k; i++) {
-        // for each face in the center, what you do is take point i+1, center, point i
-        // to get a counter-clockwise winding order
-        // (for the bottom face, the top face is reversed)
-        ADD_FACE(i+1, 0, i, 0, 0, 0);
-    }
-    // for the final face, we need to do vertex 1, center, vertex k
-    ADD_FACE(1, 0, k, 0, 0, 0);
-
-    // for the second circle (the top circle), everything is offset by k+1
-    int offset = k+1;
-    for(int i=1; i<k; i++) {
-        ADD_FACE(offset+i, offset+0, offset+i+1, k+1, k+1, k+1);
+    void* normalOffset = (void*)(size_t)positionSize(layout.position);
+    switch(layout.normal) {
+    case NORMAL_FLOAT:
+        vertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, normalOffset);
+        break;
+    case NORMAL_INT_2_10_10_10:
+        vertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, normalOffset);
+        break;
     }
-    // for the final face, we need to do vertex k, center, vertex 1
-    ADD_FACE(offset+k, offset+0, offset+1, k+1, k+1, k+1);
 
-    // for the sides, we need to add bottom i, top i+1, bottom i+1
-    // then top i+1, bottom i, top i
+    enableVertexAttribArray(0);
+    enableVertexAttribArray(2);
+    bindVertexArray(0);
+}
 
-    // for the side normals, vertex i has the normal i as well
+// called once per frame, moves finished meshes to the gpu within MESH_UPLOAD_BUDGET
+void uploadMeshes() {
+    size_t budget = MESH_UPLOAD_BUDGET;
+    size_t i = 0;
+    while(i < meshJobs.size() && budget > 0) {
+        MeshJob* job = meshJobs[i];
+        if(!job->generated.load(std::memory_order_acquire)) {
+            i++;
+            continue;
+        }
 
-    for(int i=1; i<k; i++) {
-        ADD_FACE(i, offset+i, i+1, i, i, i+1);
-        ADD_FACE(offset+i+1, i+1, offset+i, i+1, i+1, i);
-    }
+        Mesh* m = job->mesh;
+        if(!m->vao) createMeshBuffers(m, NULL, m->data.size());
 
-    // for the last side, instead of i and i+1, use k and 1
-    ADD_FACE(k, offset+k, 1, k, k, 1);
-    ADD_FACE(offset+1, 1, offset+k, 1, 1, k);
-}
-
-void generateSphere(function<void(float)> addItem) {
-    vector<glm::vec3> vertices;
-    vector<glm::vec3> normals;
-
-    #define ADD_FACE2(i, j, k) ADD_FACE(i, j, k, i, j, k)
-
-    // how many vertices in a circle
-    int k = 40;
-    // radius of the sphere
-    float r = .3f;
-    
-    // the sphere has k "levels"
-    // the sphere's "levels" are denoted by an angle phi, between pi/2 and -pi/2
-
-    float delta_phi = PI / k;
-    float phi = PI / 2;
-    for(int i=0; i<k; i++) {
-        float y = r*sin(phi);
-        float currR = r*cos(phi);
-
-        // each level then contains a circle
-        float theta = 0.0f;
-        float delta_th = 2 * PI / k;
-        for(int i=0; i<k; i++) {
-            float x = currR*cos(theta);
-            float z = currR*sin(theta);
-            vertices.push_back({x, y, z});
-            // for normals, each vertex has its own normal and its value is equal to itself
-            normals.push_back({x, y, z});
-
-            theta += delta_th;
+        size_t n = min(budget, m->data.size() - m->uploaded);
+        if(n > 0) {
+            bindBuffer(GL_ARRAY_BUFFER, m->vbo);
+            bufferSubData(GL_ARRAY_BUFFER, m->uploaded, n, &m->data[m->uploaded]);
+            bindBuffer(GL_ARRAY_BUFFER, 0);
+            m->uploaded += n;
+            budget -= n;
         }
 
-        phi -= delta_phi;
+        if(m->uploaded < m->data.size()) {
+            i++;
+            continue;
+        }
+        m->vertices = m->data.data();
+        m->ready = true;
+        delete job;
+        meshJobs.erase(meshJobs.begin() + i);
     }
+}
 
-    // to get vertex (i, j) we need to do i*k+j (+1 for 1 based index)
-    #define IDX0(i, j) ((i)*k+(j))
-
-    // for each level i >= 1, face j >= 1
-    // we connect (i, j) - (i-1, j) - (i, j-1)
-    // and (i-1, j-1) - (i, j-1) - (i-1, j)
-    for(int i=1; i<k; i++) {
-        for(int j=1; j<k; j++) {
-            ADD_FACE2(IDX0(i, j), IDX0(i-1, j), IDX0(i, j-1));
-            ADD_FACE2(IDX0(i-1, j-1), IDX0(i, j-1), IDX0(i-1, j));
-        }
+// baked meshes go straight from the library's read only data to the vbo, there is nothing
+// to generate or keep around
+void useBakedMesh(Mesh* m, const char* name, const BakedMesh* baked) {
+    *m = {};
+    m->name = name;
+    m->numVertices = baked->numVertices;
+    m->layout = baked->layout;
+    m->positionBias = baked->positionBias;
+    m->positionScale = baked->positionScale;
+    m->vertices = (const uint8_t*)baked->data;
+    createMeshBuffers(m, baked->data, baked->size);
+    m->uploaded = baked->size;
+    m->ready = true;
+}
 
-        // add the final face, use j-1 = k-1, j=0
-        ADD_FACE2(IDX0(i, 0), IDX0(i-1, 0), IDX0(i, k-1));
-        ADD_FACE2(IDX0(i-1, k-1), IDX0(i, k-1), IDX0(i-1, 0));
-    }
+// a sphere of that radius around the origin, drawn from 4 vertices however close it gets.
+// the vao is only there for the per instance attributes
+void useImpostorMesh(Mesh* m, const char* name, float radius) {
+    *m = {};
+    m->name = name;
+    m->numVertices = 4;
+    m->positionScale = glm::vec3(radius);
+    m->vao = genVertexArray(name);
+    m->impostor = true;
+    m->ready = true;
+}
 
-    // add a 2d circle for closing the final layer (use i=k-1)
-    vertices.push_back({ 0.0f, -r, 0.0f }); // center of the circle, has index k*k
-    normals.push_back({ 0.0f, -1.0f, 0.0f });
-    int final_center = k*k;
+// the baked mesh if the library has one made with these parameters, NULL otherwise
+#ifdef BAKED_MESHES
+#define BAKED_MESH(mesh, matches) ((matches) ? &(mesh) : NULL)
+#else
+#define BAKED_MESH(mesh, matches) ((const BakedMesh*)NULL)
+#endif
 
-    for(int j=1; j<k; j++) {
-        // for each face in the center, what you do is take point i, center, point i+1
-        // to get a counter clockwise winding order
+void buildMesh(Mesh* m, const char* name, const BakedMesh* baked, function<void(VertexWriter&)> generator, VertexLayout layout) {
+    if(baked) useBakedMesh(m, name, baked);
+    else generateMesh(m, name, generator, layout);
+}
 
-        ADD_FACE2(IDX0(k-1, j-1), final_center, IDX0(k-1, j));
-    }
-    ADD_FACE2(IDX0(k-1, k-1), final_center, IDX0(k-1, 0));
-
-    #undef ADD_FACE2
-    #undef IDX0
-}
-
-void generatePlatformSection(function<void(float)> addItem) {
-    vector<glm::vec3> vertices;
-    vector<glm::vec3> normals;
-
-    // how many vertices in an arc
-    int k = 5;
-
-    float h = .1f;
-    // inner & outer radii
-    float r1 = 1.f;
-    float r2 = 2.f;
-
-    // each platform has 32 segments
-    float delta = (2*PI/32) / (k-1);
-    // the angle of each line within the arc is actually 1/(k-1) times the total length since 
-    // one of the points is supposed to interact with the next one
-
-    // vertices consist of 4 "rings"
-    // vertex 0 .. k-1 => bottom inner
-    // vertex k .. 2k-1 => bottom outer
-    // vertex 2k .. 3k-1 => top inner
-    // vertex 3k .. 4k-1 => top outer
-
-    // the normals are as follows:
-    // normal 0 => bottom face
-    // normal 1 => top face
-    // normal 2 .. k+1 => inner face
-    // normal k+2 .. 2k+1 => outer face
-    // normal 2k+2 => side a (theta = 0)
-    // normal 2k+3 => side b (theta != 0)
-
-    normals.push_back({ 0.f, -1.f, 0.f });
-    normals.push_back({ 0.f, 1.f, 0.f });
-    
-    float rads = 0.f;
-    for(int i=0; i<k; i++) {
-        float x = r1*cos(rads);
-        float z = r1*sin(rads);
-        vertices.push_back({x, 0.f, z});
-        normals.push_back({-x, 0.f, -z});
-
-        rads += delta;
-    }
+// the vertices go too, a generated mesh keeps its copy after the upload
+void deleteMesh(Mesh* m) {
+    releaseGLObject(GL_OBJECT_BUFFER, &m->vbo);
+    releaseGLObject(GL_OBJECT_VERTEX_ARRAY, &m->vao);
+    *m = {};
+}
 
-    rads = 0.f;
-    for(int i=0; i<k; i++) {
-        float x = r2*cos(rads);
-        float z = r2*sin(rads);
-        vertices.push_back({x, 0.f, z});
-        normals.push_back({x, 0.f, z});
+// fills in the drawable's record, everything per object is computed here once instead
+// of once per vertex
+void writeObjectRecord(ObjectRecord* r, const Drawable* d, const glm::mat4& v, const glm::mat4& vp) {
+    glm::mat4 mv = v * d->transform;
+    glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(mv));
+
+    // impostors are built in camera space, they only need the (jittered) projection
+    r->mvp = d->mesh->impostor ? projection : vp * d->transform;
+    r->mv = mv;
+    for(int i=0; i<3; i++) r->normalMatrix[i] = glm::vec4(normalMatrix[i], 0.f);
+    r->color = glm::vec4(d->color, 1.f);
+    r->positionBias = glm::vec4(d->mesh->positionBias, 0.f);
+    r->positionScale = glm::vec4(d->mesh->positionScale, 0.f);
+}
 
-        rads += delta;
+// the object's record has to be written already, index is its position in the stream buffer
+void drawDrawable(const Drawable* d, const ShaderProgram* p, int index) {
+    uniform1i(p->objectIndex, index);
+    bindVertexArray(d->mesh->vao);
+    GLenum mode = d->mesh->impostor ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+    if(d->numInstances > 0) {
+        drawArraysInstanced(mode, 0, d->mesh->numVertices, d->numInstances);
+    } else {
+        drawArrays(mode, 0, d->mesh->numVertices);
     }
+}
 
-    rads = 0.f;
-    normals.push_back({ -1, 0, 0 });
-    for(int i=0; i<k; i++) {
-        float x = r1*cos(rads);
-        float z = r1*sin(rads);
-        vertices.push_back({x, h, z});
+// copies the live particles into this frame's region of the particle stream and points
+// the particle mesh's instance attributes at it. the mesh has to be ready
+void uploadParticles() {
+    ParticleInstance* instances = (ParticleInstance*)beginStreamFrame(&particleStream);
+    int n = writeParticleInstances(&particleSystem, instances, MAX_PARTICLES);
+    endStreamFrame(&particleStream, n * sizeof(ParticleInstance));
+    particles.numInstances = n;
+
+    size_t offset = particleStream.persistent ? particleStream.region * particleStream.regionSize : 0;
+    bindVertexArray(particleMesh.vao);
+    bindBuffer(GL_ARRAY_BUFFER, particleStream.buffer);
+    vertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), (void*)offset);
+    vertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ParticleInstance),
+        (void*)(offset + offsetof(ParticleInstance, color)));
+    vertexAttribDivisor(3, 1);
+    vertexAttribDivisor(4, 1);
+    enableVertexAttribArray(3);
+    enableVertexAttribArray(4);
+    bindVertexArray(0);
+}
 
-        rads += delta;
-    }
+// the vertex shader's per instance attributes for everything that isn't instanced:
+// no offset, unscaled, white (leaves the object's own color alone)
+void setDefaultInstanceAttributes() {
+    vertexAttrib4f(3, 0.f, 0.f, 0.f, 1.f);
+    vertexAttrib4f(4, 1.f, 1.f, 1.f, 1.f);
+}
 
-    rads = 0.f;
-    for(int i=0; i<k; i++) {
-        float x = r2*cos(rads);
-        float z = r2*sin(rads);
-        vertices.push_back({x, h, z});
+// calls f on every visible drawable, always in the same order
+template<typename F>
+void forEachDrawable(F f) {
+    // meshes still being built are skipped
+    auto drawable = [](const Drawable* d) { return d->visible && d->mesh->ready; };
 
-        rads += delta;
+    if(drawable(&cylinder)) f(&cylinder);
+    if(drawable(&ball)) f(&ball);
+    for(auto& b : extraBallDrawables) {
+        if(drawable(&b)) f(&b);
     }
-    normals.push_back({ -cos(rads), 0, -sin(rads) });
-
-    // bottom face
-    for(int i=0; i<k-1; i++) {
-        ADD_FACE(i, k+i, i+1, 0, 0, 0);
-        ADD_FACE(i+1, k+i, k+i+1, 0, 0, 0);
+    for(auto& ps : platformSections) {
+        if(drawable(&ps)) f(&ps);
     }
+    if(drawable(&particles)) f(&particles);
+}
 
-    // top face
-    for(int i=0; i<k-1; i++) {
-        ADD_FACE(2*k+i+1, 3*k+i, 2*k+i, 1, 1, 1);
-        ADD_FACE(3*k+i+1, 3*k+i, 2*k+i+1, 1, 1, 1);
+// the software renderer's image goes on the screen with these
+const char* softwareVertexSource = R"(#version 330 core
+// one triangle over the whole viewport
+void main() {
+    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+const char* softwareFragmentSource = R"(#version 330 core
+uniform sampler2D Color;
+uniform sampler2D Depth;
+// the viewport's corner, the image starts there
+uniform ivec2 Origin;
+out vec4 color;
+void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy) - Origin;
+    color = texelFetch(Color, p, 0);
+    gl_FragDepth = texelFetch(Depth, p, 0).r;
+}
+)";
+
+bool createSoftwarePresenter() {
+    softwareProgram = linkShaderProgram(softwareVertexSource, softwareFragmentSource, "software renderer");
+    if(!softwareProgram) return false;
+    useProgram(softwareProgram);
+    uniform1i(glGetUniformLocation(softwareProgram, "Color"), 0);
+    uniform1i(glGetUniformLocation(softwareProgram, "Depth"), 1);
+    softwareOrigin = glGetUniformLocation(softwareProgram, "Origin");
+    useProgram(0);
+
+    // core profile draws need a vao, even without any attributes
+    softwareVao = genVertexArray("software renderer");
+    softwareColor = genTexture("software renderer");
+    softwareDepth = genTexture("software renderer");
+    for(GLuint t : { softwareColor, softwareDepth }) {
+        bindTexture(GL_TEXTURE_2D, t);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     }
+    bindTexture(GL_TEXTURE_2D, 0);
+    softwareWidth = softwareHeight = 0;
+    return true;
+}
 
-    // side faces similar
-    // bottom i, top i, bottom i+1
-    // bottom i+1, top i, top i+1
-    for(int i=0; i<k-1; i++) {
-        // inner ring
-        // the winding is reverse, since the "inside" face is front-facing
-        ADD_FACE(i+1, 2*k+i, i, i+3, i+2, i+2);
-        ADD_FACE(2*k+i+1, 2*k+i, i+1, i+3, i+2, i+3);
-        // outer ring
-        ADD_FACE(k+i, 3*k+i, k+i+1, k+i+2, k+i+2, k+i+3);
-        ADD_FACE(k+i+1, 3*k+i, 3*k+i+1, k+i+3, k+i+2, k+i+3);
+// the target's rows are padded, the textures only get what was drawn
+void uploadSoftwareTexture(GLuint texture, GLenum internalFormat, GLenum format, GLenum type, const void* pixels) {
+    const RasterTarget& t = raster->target;
+    bindTexture(GL_TEXTURE_2D, texture);
+    if(t.width != softwareWidth || t.height != softwareHeight) {
+        texImage2D(GL_TEXTURE_2D, 0, internalFormat, t.width, t.height, 0, format, type, pixels);
+    } else {
+        texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, t.width, t.height, format, type, pixels);
     }
+}
 
-    // side with i=0
-    // top outer - bottom outer - bottom inner
-    // top inner - top outer - bottom inner
-    ADD_FACE(3*k, k, 0, 2*k+2, 2*k+2, 2*k+2);
-    ADD_FACE(2*k, 3*k, 0, 2*k+2, 2*k+2, 2*k+2);
+// the same drawables with the same records as the GL path, in the same order
+void drawSoftware(const glm::mat4& vp) {
+    GLint viewport[4];
+    getIntegerv(GL_VIEWPORT, viewport);
+    beginRasterFrame(raster, viewport[2], viewport[3], clearColor,
+        lightPositionsCameraspace.data(), (int)lightPositionsCameraspace.size());
 
-    // similarly with i=k-1
-    // but the winding is reversed again
-    ADD_FACE(k-1, k+k-1, 3*k+k-1, 2*k+3, 2*k+3, 2*k+3);
-    ADD_FACE(k-1, 3*k+k-1, 2*k+k-1, 2*k+3, 2*k+3, 2*k+3);
+    if(particles.visible && particleMesh.ready) {
+        particles.numInstances = writeParticleInstances(&particleSystem, softwareParticles.data(), MAX_PARTICLES);
+    }
+    forEachDrawable([&](const Drawable* d) {
+        ObjectRecord r;
+        writeObjectRecord(&r, d, view, vp);
+        const Mesh* m = d->mesh;
+        const ShaderFeatures& f = materialPrograms[d->material]->features;
+        RasterDraw draw = { r.mvp, r.mv,
+            glm::mat3(glm::vec3(r.normalMatrix[0]), glm::vec3(r.normalMatrix[1]), glm::vec3(r.normalMatrix[2])),
+            d->color, m->positionBias, m->positionScale, m->vertices, m->numVertices, m->layout,
+            d->numInstances > 0 ? softwareParticles.data() : NULL, d->numInstances,
+            { f.lights, f.specular, f.vertexLighting } };
+        rasterDraw(raster, draw);
+    });
+    endRasterFrame(raster);
+
+    const RasterTarget& t = raster->target;
+    pixelStorei(GL_UNPACK_ROW_LENGTH, t.stride);
+    activeTexture(GL_TEXTURE1);
+    uploadSoftwareTexture(softwareDepth, GL_R32F, GL_RED, GL_FLOAT, t.depth.data());
+    activeTexture(GL_TEXTURE0);
+    uploadSoftwareTexture(softwareColor, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, t.color.data());
+    pixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    softwareWidth = t.width;
+    softwareHeight = t.height;
+
+    useProgram(softwareProgram);
+    uniform2i(softwareOrigin, viewport[0], viewport[1]);
+    depthFunc(GL_ALWAYS);
+    bindVertexArray(softwareVao);
+    drawArrays(GL_TRIANGLES, 0, 3);
+    bindVertexArray(0);
+    depthFunc(GL_LESS);
 }
 
-#undef ADD_FACE
-
 void generatePlatforms() {
     glm::vec3 blue(0.f, 0.f, 1.f);
 
-    int numLevels = 5;
-    float levelHeight = 2.f;
-    float height = 0.f;
+    int numLevels = scene.levels;
+
+    // all levels fit in a single batch for now, taller towers would request further
+    // batches ahead of time and poll() them from Update. the batch is spread over the
+    // pool's workers, and wait() generates on this thread as well until it's done
+    LevelGenerator gen(pool, st->randomSeed, numLevels, 1, scene.sections, playableLevelFilter(levelValidator));
+    gen.request(0);
+    const LevelLayout* levels = gen.wait(0);
+    levelLayouts.assign(levels, levels + numLevels);
+
+    platformSections.reserve(platformSections.size() + numLevels * scene.sections);
     for(int l=0; l<numLevels; l++) {
-        int numHoles = 1 + rand() % 2;
-        int holeWidth = 4 + rand() % 4; // in sections
-        int holeOffset = rand() % 32;
-
-        for(int i=0; i<32; i++) {
-            bool v = true;
-
-            int holeBegin = holeOffset;
-            int holeEnd = (holeBegin + holeWidth) % 32;
-            if(i >= holeBegin && i < holeEnd) v = false;
-            if(holeEnd < holeBegin && i < holeEnd) v = false;
-
-            if(numHoles > 1) {
-                int holeBegin = (holeOffset + 16) % 32;
-                int holeEnd = (holeBegin + holeWidth) % 32;
-                if(i >= holeBegin && i < holeEnd) v = false;
-                if(holeEnd < holeBegin && i < holeEnd) v = false;
-            }
+        for(int i=0; i<scene.sections; i++) {
+            bool v = (levels[l].solid >> i) & 1;
 
             // transforms will be updated by the update function
-            platformSections.push_back({ v, glm::mat4(1.f), &platformMesh, blue });
+            platformSections.push_back({ v, glm::mat4(1.f), &platformMesh, blue, 0, MATERIAL_WORLD });
         }
     }
+    gen.release(0);
+}
+
+// the center of a platform section in world space, see sweepBallAgainstLevels for the angles
+glm::vec3 platformSectionCenter(int level, int section) {
+    const PlatformGeometry& g = platform;
+    float delta = 2*PI / g.sections;
+    float angle = -(section - .5f) * delta - st->cylinderRotation;
+    float r = (g.innerRadius + g.outerRadius) / 2.f;
+    return glm::vec3(r * cos(angle), level * g.levelHeight + g.thickness / 2.f, r * sin(angle));
 }
 
+// a little splash of the ball's color where it touched down
+void emitBounceParticles(glm::vec3 contact) {
+    ParticleEmitter e;
+    e.position = contact;
+    e.extent = glm::vec3(.1f, 0.f, .1f);
+    e.velocity = glm::vec3(0.f, 1.5f, 0.f);
+    e.spread = 1.2f;
+    e.color = ball.color;
+    e.size = .05f;
+    e.life = .6f;
+    emitParticles(&particleSystem, e, 64);
+}
+
+// shows what the simulation reports: particles where the balls bounce, and broken levels
+// disappear in a burst of their pieces
+// particles is false when restoring a game after a reload, the pieces are long gone by then
+struct GameEffects {
+    bool particles;
+
+    void bounce(glm::vec3 contact) {
+        if(particles) emitBounceParticles(contact);
+    }
+
+    void levelBroken(int l, uint64_t solid) {
+        spectateLevelBroken(&spectator, l);
+        const PlatformGeometry& g = platform;
+        for(int i=0; i<g.sections; i++) {
+            if(!((solid >> i) & 1)) continue;
+            Drawable* d = &platformSections[l*g.sections + i];
+            d->visible = false;
+            if(!particles) continue;
+
+            glm::vec3 center = platformSectionCenter(l, i);
+            glm::vec3 outwards = glm::normalize(glm::vec3(center.x, 0.f, center.z));
+            ParticleEmitter e;
+            e.position = center;
+            e.extent = glm::vec3(.3f, g.thickness / 2.f, .3f);
+            e.velocity = outwards * 2.f + glm::vec3(0.f, 1.f, 0.f);
+            e.spread = 1.f;
+            e.color = d->color;
+            e.size = .04f;
+            e.life = 2.f;
+            emitParticles(&particleSystem, e, 400);
+        }
+    }
+};
+
 void updatePlatformTransformsFromState() {
     float theta = 0.0;
-    float delta = 2*PI / 32;
+    float delta = 2*PI / platform.sections;
     glm::vec3 axis(0.f, 1.f, 0.f);
 
-    int numLevels = 5;
-    float levelHeight = 2.f;
     float height = 0.f;
-    for(int l=0; l<numLevels; l++) {
+    for(int l=0; l<scene.levels; l++) {
         glm::mat4 base = glm::translate(cylinderTransform, glm::vec3(0.f, height, 0.f));
-        for(int i=0; i<32; i++) {
-            Drawable* d = &platformSections[l*32+i];
+        for(int i=0; i<platform.sections; i++) {
+            Drawable* d = &platformSections[l*platform.sections+i];
             d->transform = glm::rotate(base, theta + st->cylinderRotation, axis);
             theta += delta;
         }
-        height += levelHeight;
+        height += platform.levelHeight;
     }
 }
 
@@ -481,6 +625,15 @@ glm::mat4 cylinderTransformFromState() {
     return glm::rotate(glm::mat4(1.f), st->cylinderRotation, glm::vec3(0.f, 1.f, 0.f));
 }
 
+// the launcher draws at whatever size fits its frame budget and the window, and sets the
+// viewport to it before Draw
+glm::mat4 projectionFromViewport() {
+    GLint viewport[4];
+    getIntegerv(GL_VIEWPORT, viewport);
+    float aspect = viewport[3] > 0 ? (float)viewport[2] / viewport[3] : 4.f / 3.f;
+    return glm::perspective(glm::radians(70.0f), aspect, 0.1f, 100.f);
+}
+
 glm::mat4 cameraTransformFromState() {
     return glm::lookAt(
         glm::vec3(0.f, st->cameraHeight, 5.f),
@@ -489,126 +642,163 @@ glm::mat4 cameraTransformFromState() {
     );
 }
 
+// the state of a fresh game
+void resetGameState(GameState* s) {
+    // a fixed seed makes runs reproducible (the headless renderer relies on that)
+    const char* seed = getenv("BOUNCY_SEED");
+    resetSimState(s, scene.levels, platform, seed ? atoi(seed) : time(NULL));
+}
+
+// spreads the extra balls around the ring above the top level
+void placeExtraBalls(int n) {
+    extraBalls.clear();
+    extraBallDrawables.clear();
+    extraBalls.reserve(n);
+    extraBallDrawables.reserve(n);
+
+    float top = scene.levels * platform.levelHeight + 1.f;
+    float r = (platform.innerRadius + platform.outerRadius) / 2.f;
+    for(int i=0; i<n; i++) {
+        // golden angle, so any number of balls covers the ring evenly
+        float angle = i * 2.39996f;
+        ExtraBall b;
+        b.position = glm::vec3(r * cos(angle), top + (i % 8) * .4f, r * sin(angle));
+        b.velocity = glm::vec3(0.f);
+        b.force = glm::vec3(0.f, 10.f, 0.f);
+        extraBalls.push_back(b);
+        extraBallDrawables.push_back({ true, glm::translate(glm::mat4(1.f), b.position), &sphereMesh, ball.color, 0, MATERIAL_WORLD });
+    }
+}
+
 int Initialize(bool reinit, void* state_) {
     backward::SignalHandling sh;
-    st = (GameState*)state_;
 
-    cylinderTransform = glm::mat4(1.f);
-    projection = glm::perspective(glm::radians(70.0f), 4.0f / 3.0f, 0.1f, 100.f);
+    // everything filled in below starts out empty, and Cleanup empties it again
+    beginRegistryGeneration();
+    resetGLState();
+    registerContainer("platform sections", &platformSections);
+    registerContainer("level layouts", &levelLayouts);
+    registerContainer("extra balls", &extraBalls);
+    registerContainer("extra ball drawables", &extraBallDrawables);
+    registerContainer("light positions", &lightPositions);
+    registerContainer("light positions (camera space)", &lightPositionsCameraspace);
+    registerContainer("mesh jobs", &meshJobs);
+    registerContainer("software particles", &softwareParticles);
+    registerContainer("level validator", &levelValidator.footprints);
+    registerContainer("shader cache",
+        [] { return shaders.vertexSource.size() + shaders.fragmentSource.size() +
+            shaders.lightingSource.size() + shaders.programs.capacity() * sizeof(ShaderProgram); },
+        [] { shaders = ShaderCache(); });
+    registerContainer("particles",
+        [] { return particleSystem.capacity * (8 * sizeof(float) + sizeof(uint32_t)); },
+        [] { particleSystem = ParticleSystem(); });
+
+    scene = sceneConfigFromEnv();
+    platform = platformGeometry;
+    platform.sections = scene.sections;
+
+    // the block may have been written by a build with a different GameState
+    GameState defaults;
+    resetGameState(&defaults);
+    if(reinit && !migrateState(state_, defaults)) reinit = false;
+
+    st = stateFromBlock(state_);
     if(!reinit) {
-        st->ballPosition = glm::vec3(0.f, 11.f, 1.f);
-        st->ballVelocity = glm::vec3(0.f);
-        st->ballForce = glm::vec3(0.f, 10.f, 0.f);
-
-        st->cameraHeight = st->ballPosition.y;
-
-        st->randomSeed = time(NULL);
+        *st = defaults;
+        writeStateHeader((StateHeader*)state_);
     }
 
-    srand(st->randomSeed);
+    cylinderTransform = glm::mat4(1.f);
+    projection = projectionFromViewport();
+
+    pool = new ThreadPool();
 
     view = cameraTransformFromState();
 
-    glEnable(GL_DEPTH_TEST);
-    glClearColor(0.0f, 0.1f, 0.0f, 0.0f);
+    const char* renderer = getenv("BOUNCY_RENDERER");
+    softwareRenderer = renderer && strcmp(renderer, "software") == 0;
+    if(renderer && *renderer && !softwareRenderer && strcmp(renderer, "gl") != 0) {
+        cerr << "Unknown renderer " << renderer << ", expected gl or software\n";
+    }
+
+    setCapability(GL_DEPTH_TEST, true);
+    glClearColor(clearColor.x, clearColor.y, clearColor.z, 0.f);
     glm::vec3 red(1.f, 0.f, 0.f);
     glm::vec3 blue(0.f, 0.f, 1.f);
 
-    generateMesh(&cylinderMesh, generateCylinder);
-    generateMesh(&sphereMesh, generateSphere);
-    generateMesh(&platformMesh, generatePlatformSection);
-    cylinder = { true, cylinderTransformFromState(), &cylinderMesh, blue };
-    ball = { true, ballTransformFromState(), &sphereMesh, red };
+    // the generators run on the pool, so they get copies of everything they need
+    int detail = scene.detail;
+    int sections = scene.sections;
+    float towerHeight = scene.levels * platform.levelHeight;
+    // (or are baked in already, if the scene is the one bake.cpp made them for)
+    buildMesh(&cylinderMesh, "cylinder mesh", BAKED_MESH(bakedCylinder, detail == bakedDetail && towerHeight == bakedTowerHeight),
+        [=](VertexWriter& out) { generateCylinder(out, 40 * detail, towerHeight); }, compactVertexLayout);
+    buildMesh(&platformMesh, "platform mesh", BAKED_MESH(bakedPlatform, detail == bakedDetail && sections == bakedSections),
+        [=](VertexWriter& out) { generatePlatformSection(out, sections, 4 * detail + 1); }, compactVertexLayout);
+    // the balls and the particles are impostors on GL, the software renderer only draws
+    // triangles. the particles are unit spheres, scaled by each particle's size
+    if(softwareRenderer) {
+        buildMesh(&sphereMesh, "sphere mesh", BAKED_MESH(bakedSphere, detail == bakedDetail),
+            [=](VertexWriter& out) { generateUVSphere(out, 40 * detail, BALL_RADIUS); }, compactVertexLayout);
+        buildMesh(&particleMesh, "particle mesh", BAKED_MESH(bakedParticle, true),
+            [](VertexWriter& out) { generateUVSphere(out, 6, 1.f); }, compactVertexLayout);
+    } else {
+        useImpostorMesh(&sphereMesh, "sphere impostor", BALL_RADIUS);
+        useImpostorMesh(&particleMesh, "particle impostor", 1.f);
+    }
+    cylinder = { true, cylinderTransformFromState(), &cylinderMesh, blue, 0, MATERIAL_WORLD };
+    ball = { true, ballTransformFromState(), &sphereMesh, red, 0, MATERIAL_WORLD };
+    initLevelValidator(&levelValidator, platform, VALIDATE_GAME_DT);
     generatePlatforms();
+    sim = { st, levelLayouts.data(), (int)levelLayouts.size(), platform };
+    GameEffects restore = { false };
+    simBreakPassedLevels(sim, restore);
+    placeExtraBalls(scene.balls - 1);
     updatePlatformTransformsFromState();
 
-    float lightY = 15.f;
-    for(int i=0; i<10; i++) {
+    initParticles(&particleSystem, MAX_PARTICLES, st->randomSeed);
+    particles = { false, glm::mat4(1.f), &particleMesh, glm::vec3(1.f), 0, MATERIAL_PARTICLES };
+
+    float lightY = towerHeight + 5.f;
+    for(int i=0; i<scene.lights; i++) {
         lightPositions.push_back({ 2.f, lightY, -2.f });
         lightY -= 1.5f;
     }
-
-    GLuint vert = glCreateShader(GL_VERTEX_SHADER);
-    GLuint frag = glCreateShader(GL_FRAGMENT_SHADER);
-
-    ifstream vertFile("vertex.gl");
-    ifstream fragFile("fragment.gl");
-
-    string vertSrc;
-    string fragSrc;
-
-    if(vertFile.is_open()) {
-        stringstream sstr;
-        sstr << vertFile.rdbuf();
-        vertSrc = sstr.str();
-        vertFile.close();
-    } else {
-        cerr << "Could not open vertex shader file\n";
-        return 1;
-    }
-
-    if(fragFile.is_open()) {
-        stringstream sstr;
-        sstr << fragFile.rdbuf();
-        fragSrc = sstr.str();
-        fragFile.close();
-    } else {
-        cerr << "Could not open fragment shader file\n";
-        return 1;
-    }
-
-    int rc;
-    char const* vertCSrc = vertSrc.c_str();
-    char const* fragCSrc = fragSrc.c_str();
-
-    glShaderSource(vert, 1, &vertCSrc, NULL);
-    glCompileShader(vert);
-
-    glGetShaderiv(vert, GL_COMPILE_STATUS, &rc);
-    if(rc != GL_TRUE) {
-        int len;
-        glGetShaderiv(vert, GL_INFO_LOG_LENGTH, &len);
-        char* msg = new char[len];
-        glGetShaderInfoLog(vert, len, NULL, msg);
-        cerr << "Vertex shader compile error:\n" << msg << "\n";
-        delete[] msg;
-        return 1;
+    lightPositionsCameraspace.resize(lightPositions.size());
+
+    // after the restore above, the levels it broke are old news
+    closeSpectateEncoder(&spectator);
+    const char* spectate = getenv("BOUNCY_SPECTATE");
+    if(spectate && *spectate) {
+        SpectateScene s = { st->randomSeed, (uint16_t)scene.levels, (uint8_t)scene.sections,
+            (uint8_t)scene.lights, (uint8_t)scene.detail };
+        if(!openSpectateEncoder(&spectator, spectate, s)) cerr << "Could not open the spectator socket " << spectate << "\n";
     }
 
-    glShaderSource(frag, 1, &fragCSrc, NULL);
-    glCompileShader(frag);
-
-    glGetShaderiv(frag, GL_COMPILE_STATUS, &rc);
-    if(rc != GL_TRUE) {
-        int len;
-        glGetShaderiv(frag, GL_INFO_LOG_LENGTH, &len);
-        char* msg = new char[len];
-        glGetShaderInfoLog(frag, len, NULL, msg);
-        cerr << "Fragment shader compile error:\n" << msg << "\n";
-        delete[] msg;
-        return 1;
+    // a failed compile leaves the permutations that did compile, Cleanup releases them
+    quality = qualityFromEnv();
+    if(!loadShaderSources(&shaders)) return 1;
+    nearestLights = false;
+    for(int m=0; m<MATERIAL_COUNT; m++) {
+        ShaderFeatures f = materialFeatures(quality, (Material)m, scene.lights);
+        materialPrograms[m] = shaderProgram(&shaders, f);
+        impostorPrograms[m] = shaderProgram(&shaders, impostorFeatures(f));
+        if(!materialPrograms[m] || !impostorPrograms[m]) return 1;
+        nearestLights |= f.lights < scene.lights;
     }
 
-    program = glCreateProgram();
-    glAttachShader(program, vert);
-    glAttachShader(program, frag);
-    glLinkProgram(program);
-
-    glGetProgramiv(program, GL_LINK_STATUS, &rc);
-    if(rc != GL_TRUE) {
-        int len;
-        glGetShaderiv(program, GL_INFO_LOG_LENGTH, &len);
-        char* msg = new char[len];
-        glGetShaderInfoLog(frag, len, NULL, msg);
-        cerr << "Shader link error:\n" << msg << "\n";
-        delete[] msg;
-        return 1;
+    if(softwareRenderer) {
+        raster = new RasterRenderer();
+        // the thread calling Draw renders as well
+        initRasterRenderer(raster, max(1u, thread::hardware_concurrency()) - 1);
+        softwareParticles.resize(MAX_PARTICLES);
+        if(!createSoftwarePresenter()) return 1;
     }
 
-    glDetachShader(program, vert);
-    glDetachShader(program, frag);
-    glDeleteShader(vert);
-    glDeleteShader(frag);
+    // three frames in flight is enough to never wait on the gpu in practice
+    maxObjects = 3 + extraBalls.size() + platformSections.size();
+    createStreamBuffer(&objectStream, "object stream", maxObjects * sizeof(ObjectRecord), 3);
+    createStreamBuffer(&particleStream, "particle stream", MAX_PARTICLES * sizeof(ParticleInstance), 3);
 
     return 0;
 }
@@ -617,50 +807,150 @@ int Initialize(bool reinit, void* state_) {
 void Update(KeyState keys, uint64_t dt_ms) {
     float dt = dt_ms / 1000.f;
 
-    if(keys.dirs.left) st->cylinderRotation -= .05f;
-    if(keys.dirs.right) st->cylinderRotation += .05f;
-
-    float ballMass = 2.f;
+    GameEffects effects = { true };
+    SimInput input = { keys.dirs.left, keys.dirs.right };
+    simStep(sim, input, dt, effects);
 
-    st->ballVelocity += (st->ballForce / ballMass) * dt;
-    st->ballPosition += st->ballVelocity * dt;
-
-    st->ballForce += ballMass * glm::vec3(0.f, -9.8f, 0.f) * dt; // gravity
-
-    if(st->ballPosition.y < .3f) {
-        // let it bounce
-        st->ballForce = glm::vec3(0.f, 10.f, 0.f);
-        st->ballVelocity = glm::vec3(0.f);
-        st->ballPosition.y = .3f;
+    // the extra balls only bounce off the levels, they don't break them
+    for(size_t i=0; i<extraBalls.size(); i++) {
+        ExtraBall& b = extraBalls[i];
+        simStepBall(sim, &b.position, &b.velocity, &b.force, dt, effects);
+        extraBallDrawables[i].transform = glm::translate(glm::mat4(1.f), b.position);
     }
 
-    if(st->ballPosition.y <= st->cameraHeight - 1.f) {
-        // let camera follow the falling ball
-        st->cameraHeight = st->ballPosition.y + 1.f;
-    }
+    updateParticles(&particleSystem, dt, 0.f);
+    particles.visible = particleSystem.count > 0;
 
     cylinder.transform = cylinderTransformFromState();
     ball.transform = ballTransformFromState();
     updatePlatformTransformsFromState();
 
     view = cameraTransformFromState();
+
+    sendSpectateFrame(&spectator, *st, dt_ms > 0xffff ? 0xffff : (uint16_t)dt_ms);
 }
 
 void Draw() {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
+    // what the launcher left bound is unknown, and the calls are counted from here
+    beginGLFrame();
+    clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    projection = projectionFromViewport();
+    // moves everything by jitter times w, so by jitter after the divide
+    projection[2][0] += jitter.x * projection[2][3];
+    projection[2][1] += jitter.y * projection[2][3];
+    jitter = glm::vec2(0.f);
     glm::mat4 vp = projection * view;
 
-    glUseProgram(program);
-    drawDrawable(&cylinder, view, projection);
-    drawDrawable(&ball, view, projection);
-    for(auto& ps : platformSections) {
-        drawDrawable(&ps, view, projection);
+    uploadMeshes();
+
+    // the lights are fixed in the world, so they only need to follow the camera once per frame
+    for(size_t i=0; i<lightPositions.size(); i++) {
+        lightPositionsCameraspace[i] = glm::vec3(view * glm::vec4(lightPositions[i], 1.f));
     }
+    // the camera sits at the origin, the closest lights go first
+    if(nearestLights) {
+        sort(lightPositionsCameraspace.begin(), lightPositionsCameraspace.end(),
+            [](const glm::vec3& a, const glm::vec3& b) { return glm::dot(a, a) < glm::dot(b, b); });
+    }
+
+    if(softwareRenderer) {
+        drawSoftware(vp);
+        endGLFrame();
+        return;
+    }
+
+    bool drawParticles = particles.visible && particleMesh.ready;
+    if(drawParticles) uploadParticles();
+
+    // write every object's data straight into this frame's region of the stream buffer
+    ObjectRecord* records = (ObjectRecord*)beginStreamFrame(&objectStream);
+    size_t numObjects = 0;
+    forEachDrawable([&](const Drawable* d) {
+        if(numObjects < maxObjects) writeObjectRecord(&records[numObjects++], d, view, vp);
+    });
+    endStreamFrame(&objectStream, numObjects * sizeof(ObjectRecord));
+
+    activeTexture(GL_TEXTURE0);
+    bindTexture(GL_TEXTURE_BUFFER, objectStream.texture);
+    setDefaultInstanceAttributes();
+
+    // the launcher decides on multisampling, the impostors' edges turn into samples with it
+    GLint sampleBuffers = 0;
+    getIntegerv(GL_SAMPLE_BUFFERS, &sampleBuffers);
+    bool multisampled = sampleBuffers > 0;
+
+    int index = streamFrameTexel(&objectStream) / (sizeof(ObjectRecord) / 16);
+    size_t drawn = 0;
+    // the drawables come grouped by material and mesh kind, so programs only switch between
+    // groups. coming back to a program, the uniforms it still has are dropped (glstate.h)
+    const ShaderProgram* bound = NULL;
+    forEachDrawable([&](const Drawable* d) {
+        if(drawn++ >= numObjects) return;
+        const ShaderProgram* p = (d->mesh->impostor ? impostorPrograms : materialPrograms)[d->material];
+        if(p != bound) {
+            useProgram(p->program);
+            uniform1i(p->objectData, 0);
+            uniform3fv(p->lightPositions, p->features.lights, &lightPositionsCameraspace[0][0]);
+            uniform1i(p->multisampled, multisampled);
+            // alpha to one keeps the coverage out of the target's alpha
+            if(multisampled) {
+                setCapability(GL_SAMPLE_ALPHA_TO_COVERAGE, p->features.impostor);
+                setCapability(GL_SAMPLE_ALPHA_TO_ONE, p->features.impostor);
+            }
+            bound = p;
+        }
+        drawDrawable(d, p, index++);
+    });
+    if(multisampled) {
+        setCapability(GL_SAMPLE_ALPHA_TO_COVERAGE, false);
+        setCapability(GL_SAMPLE_ALPHA_TO_ONE, false);
+    }
+
+    fenceStreamFrame(&objectStream);
+    if(drawParticles) fenceStreamFrame(&particleStream);
+    endGLFrame();
+}
+
+void FrameGLCalls(GLCallCounts* counts) {
+    *counts = glState.lastFrame;
+}
+
+// called between Update and Draw, with the viewport the Draw will have
+void FrameCamera(float jitterX, float jitterY, float* viewProjection, float* inverseViewProjection) {
+    jitter = glm::vec2(jitterX, jitterY);
+    glm::mat4 vp = projectionFromViewport() * view;
+    glm::mat4 inverse = glm::inverse(vp);
+    memcpy(viewProjection, &vp[0][0], sizeof(vp));
+    memcpy(inverseViewProjection, &inverse[0][0], sizeof(inverse));
 }
 
 void Cleanup() {
+    // lets any mesh still being generated finish before its job goes away
+    delete pool;
+    pool = NULL;
+    for(MeshJob* job : meshJobs) delete job;
+    meshJobs.clear();
+
     deleteMesh(&cylinderMesh);
     deleteMesh(&sphereMesh);
-    glDeleteProgram(program);
+    deleteMesh(&platformMesh);
+    deleteMesh(&particleMesh);
+    deleteShaderCache(&shaders);
+    if(raster) {
+        deleteRasterRenderer(raster);
+        delete raster;
+        raster = NULL;
+        releaseGLObject(GL_OBJECT_PROGRAM, &softwareProgram);
+        releaseGLObject(GL_OBJECT_VERTEX_ARRAY, &softwareVao);
+        releaseGLObject(GL_OBJECT_TEXTURE, &softwareColor);
+        releaseGLObject(GL_OBJECT_TEXTURE, &softwareDepth);
+    }
+    closeSpectateEncoder(&spectator);
+    deleteStreamBuffer(&objectStream);
+    deleteStreamBuffer(&particleStream);
+
+    // reports and deletes anything the above missed, and empties the containers, so
+    // Initialize can run again on this library without anything piling up
+    endRegistryGeneration();
 }
@@ -0,0 +1,392 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+// cpu side mesh generation, no GL in here so tools can use it as well
+
+#define PI 3.141592f
+
+enum PositionFormat {
+    POSITION_FLOAT,   // 3 floats, 12 bytes
+    POSITION_HALF,    // 3 half floats + padding, 8 bytes
+    POSITION_SNORM16, // 3 normalized shorts relative to the bounding box + padding, 8 bytes
+};
+
+enum NormalFormat {
+    NORMAL_FLOAT,         // 3 floats, 12 bytes
+    NORMAL_INT_2_10_10_10, // GL_INT_2_10_10_10_REV, 4 bytes
+};
+
+struct VertexLayout {
+    PositionFormat position;
+    NormalFormat normal;
+};
+
+// 12 bytes per vertex instead of 24
+const VertexLayout compactVertexLayout = { POSITION_SNORM16, NORMAL_INT_2_10_10_10 };
+const VertexLayout floatVertexLayout = { POSITION_FLOAT, NORMAL_FLOAT };
+
+inline int positionSize(PositionFormat f) {
+    return f == POSITION_FLOAT ? 3*sizeof(float) : 4*sizeof(uint16_t);
+}
+
+inline int normalSize(NormalFormat f) {
+    return f == NORMAL_FLOAT ? 3*sizeof(float) : sizeof(uint32_t);
+}
+
+inline int vertexStride(VertexLayout l) {
+    return positionSize(l.position) + normalSize(l.normal);
+}
+
+// packs vertices straight into the layout's format as the generators emit them
+// the actual position is positionBias + positionScale * (stored position), which only
+// matters for POSITION_SNORM16 where the stored value is in [-1, 1] over the bounding box
+struct VertexWriter {
+    VertexLayout layout;
+    std::vector<uint8_t>* data;
+    int numVertices;
+
+    glm::vec3 positionBias;
+    glm::vec3 positionScale;
+
+    VertexWriter(VertexLayout layout, std::vector<uint8_t>* data)
+        : layout(layout), data(data), numVertices(0), positionBias(0.f), positionScale(1.f) {}
+
+    // has to be called with every vertex position before the first add()
+    void setBounds(const std::vector<glm::vec3>& vertices) {
+        if(layout.position != POSITION_SNORM16 || vertices.empty()) return;
+
+        glm::vec3 lo = vertices[0], hi = vertices[0];
+        for(auto& v : vertices) {
+            lo = glm::min(lo, v);
+            hi = glm::max(hi, v);
+        }
+        positionBias = (lo + hi) * .5f;
+        positionScale = (hi - lo) * .5f;
+    }
+
+    void add(glm::vec3 p, glm::vec3 n) {
+        size_t offset = data->size();
+        data->resize(offset + vertexStride(layout));
+        uint8_t* dst = &(*data)[offset];
+
+        switch(layout.position) {
+        case POSITION_FLOAT:
+            memcpy(dst, &p[0], 3*sizeof(float));
+            break;
+        case POSITION_HALF: {
+            uint16_t h[4] = { glm::packHalf1x16(p.x), glm::packHalf1x16(p.y), glm::packHalf1x16(p.z), 0 };
+            memcpy(dst, h, sizeof(h));
+            break;
+        }
+        case POSITION_SNORM16: {
+            uint16_t s[4] = { 0, 0, 0, 0 };
+            for(int i=0; i<3; i++) {
+                // flat axes (scale 0) just store 0
+                float f = positionScale[i] > 0.f ? (p[i] - positionBias[i]) / positionScale[i] : 0.f;
+                s[i] = glm::packSnorm1x16(f);
+            }
+            memcpy(dst, s, sizeof(s));
+            break;
+        }
+        }
+        dst += positionSize(layout.position);
+
+        switch(layout.normal) {
+        case NORMAL_FLOAT:
+            memcpy(dst, &n[0], 3*sizeof(float));
+            break;
+        case NORMAL_INT_2_10_10_10: {
+            // the generators don't bother with unit normals, but 10 bits only go to 1
+            uint32_t packed = glm::packSnorm3x10_1x2(glm::vec4(glm::normalize(n), 0.f));
+            memcpy(dst, &packed, sizeof(packed));
+            break;
+        }
+        }
+
+        numVertices++;
+    }
+};
+
+// vertex data generated ahead of time by bake.cpp, already packed in the layout's format
+// the data is a static array so it sits in read only memory and goes to the gpu as is
+struct BakedMesh {
+    const void* data;
+    size_t size;
+    int numVertices;
+    VertexLayout layout;
+    glm::vec3 positionBias, positionScale;
+};
+
+#define ADD_FACE(i, j, k, ni, nj, nk) { \
+    out.add(vertices[(i)], normals[(ni)]); \
+    out.add(vertices[(j)], normals[(nj)]); \
+    out.add(vertices[(k)], normals[(nk)]); \
+}
+
+// k is how many vertices in a circle, h the height
+inline void generateCylinder(VertexWriter& out, int k, float h) {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+
+    float delta = 2*PI / k;
+
+    // vertex 0 is bottom face center
+    // vertex 1 .. k is bottom face edges
+    // vertex k+1 is top face center
+    // vertex k+2 .. 2k+1 is top face edges
+
+    // normal 0 is bottom face
+    // normals 1 .. k are outwards from the edges
+    // normal k+1 is top face
+    
+    vertices.push_back({ 0.0f, 0.0f, 0.0f }); // center
+    normals.push_back({ 0.f, -1.f, 0.f });
+    float rads = 0.0;
+    for(int i=0; i<k; i++) {
+        float x = std::cos(rads);
+        float z = std::sin(rads);
+        vertices.push_back({x, 0.0f, z});
+        normals.push_back({ x, 0.f, z });
+
+        rads += delta;
+    }
+
+    normals.push_back({ 0.f, 1.f, 0.f });
+
+    // the second circle
+    vertices.push_back({ 0.0f, h, 0.0f }); // center
+    rads = 0.0;
+    for(int i=0; i<k; i++) {
+        float x = std::cos(rads);
+        float z = std::sin(rads);
+        vertices.push_back({x, h, z});
+
+        rads += delta;
+    }
+
+    out.setBounds(vertices);
+
+    // index 0 is center
+    // index 1 - (k-1) is all the vertices minus the last one
+
+    // the bottom face all has bottom face normals, obviously
+
+    for(int i=1; i<k; i++) {
+        // for each face in the center, what you do is take point i+1, center, point i
+        // to get a counter-clockwise winding order
+        // (for the bottom face, the top face is reversed)
+        ADD_FACE(i+1, 0, i, 0, 0, 0);
+    }
+    // for the final face, we need to do vertex 1, center, vertex k
+    ADD_FACE(1, 0, k, 0, 0, 0);
+
+    // for the second circle (the top circle), everything is offset by k+1
+    int offset = k+1;
+    for(int i=1; i<k; i++) {
+        ADD_FACE(offset+i, offset+0, offset+i+1, k+1, k+1, k+1);
+    }
+    // for the final face, we need to do vertex k, center, vertex 1
+    ADD_FACE(offset+k, offset+0, offset+1, k+1, k+1, k+1);
+
+    // for the sides, we need to add bottom i, top i+1, bottom i+1
+    // then top i+1, bottom i, top i
+
+    // for the side normals, vertex i has the normal i as well
+
+    for(int i=1; i<k; i++) {
+        ADD_FACE(i, offset+i, i+1, i, i, i+1);
+        ADD_FACE(offset+i+1, i+1, offset+i, i+1, i+1, i);
+    }
+
+    // for the last side, instead of i and i+1, use k and 1
+    ADD_FACE(k, offset+k, 1, k, k, 1);
+    ADD_FACE(offset+1, 1, offset+k, 1, 1, k);
+}
+
+// k is how many vertices in a circle, r the radius of the sphere
+inline void generateUVSphere(VertexWriter& out, int k, float r) {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+
+    #define ADD_FACE2(i, j, k) ADD_FACE(i, j, k, i, j, k)
+    
+    // the sphere has k "levels"
+    // the sphere's "levels" are denoted by an angle phi, between pi/2 and -pi/2
+
+    float delta_phi = PI / k;
+    float phi = PI / 2;
+    for(int i=0; i<k; i++) {
+        float y = r*std::sin(phi);
+        float currR = r*std::cos(phi);
+
+        // each level then contains a circle
+        float theta = 0.0f;
+        float delta_th = 2 * PI / k;
+        for(int i=0; i<k; i++) {
+            float x = currR*std::cos(theta);
+            float z = currR*std::sin(theta);
+            vertices.push_back({x, y, z});
+            // for normals, each vertex has its own normal and its value is equal to itself
+            normals.push_back({x, y, z});
+
+            theta += delta_th;
+        }
+
+        phi -= delta_phi;
+    }
+
+    // center of the circle closing the final layer, has index k*k
+    // (added before any faces so it is included in the bounds)
+    vertices.push_back({ 0.0f, -r, 0.0f });
+    normals.push_back({ 0.0f, -1.0f, 0.0f });
+    int final_center = k*k;
+
+    out.setBounds(vertices);
+
+    // to get vertex (i, j) we need to do i*k+j (+1 for 1 based index)
+    #define IDX0(i, j) ((i)*k+(j))
+
+    // for each level i >= 1, face j >= 1
+    // we connect (i, j) - (i-1, j) - (i, j-1)
+    // and (i-1, j-1) - (i, j-1) - (i-1, j)
+    for(int i=1; i<k; i++) {
+        for(int j=1; j<k; j++) {
+            ADD_FACE2(IDX0(i, j), IDX0(i-1, j), IDX0(i, j-1));
+            ADD_FACE2(IDX0(i-1, j-1), IDX0(i, j-1), IDX0(i-1, j));
+        }
+
+        // add the final face, use j-1 = k-1, j=0
+        ADD_FACE2(IDX0(i, 0), IDX0(i-1, 0), IDX0(i, k-1));
+        ADD_FACE2(IDX0(i-1, k-1), IDX0(i, k-1), IDX0(i-1, 0));
+    }
+
+    // add a 2d circle for closing the final layer (use i=k-1)
+    for(int j=1; j<k; j++) {
+        // for each face in the center, what you do is take point i, center, point i+1
+        // to get a counter clockwise winding order
+
+        ADD_FACE2(IDX0(k-1, j-1), final_center, IDX0(k-1, j));
+    }
+    ADD_FACE2(IDX0(k-1, k-1), final_center, IDX0(k-1, 0));
+
+    #undef ADD_FACE2
+    #undef IDX0
+}
+
+// one of the sections that make up a ring, k is how many vertices in an arc
+inline void generatePlatformSection(VertexWriter& out, int sections, int k) {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+
+    float h = .1f;
+    // inner & outer radii
+    float r1 = 1.f;
+    float r2 = 2.f;
+
+    float delta = (2*PI/sections) / (k-1);
+    // the angle of each line within the arc is actually 1/(k-1) times the total length since 
+    // one of the points is supposed to interact with the next one
+
+    // vertices consist of 4 "rings"
+    // vertex 0 .. k-1 => bottom inner
+    // vertex k .. 2k-1 => bottom outer
+    // vertex 2k .. 3k-1 => top inner
+    // vertex 3k .. 4k-1 => top outer
+
+    // the normals are as follows:
+    // normal 0 => bottom face
+    // normal 1 => top face
+    // normal 2 .. k+1 => inner face
+    // normal k+2 .. 2k+1 => outer face
+    // normal 2k+2 => side a (theta = 0)
+    // normal 2k+3 => side b (theta != 0)
+
+    normals.push_back({ 0.f, -1.f, 0.f });
+    normals.push_back({ 0.f, 1.f, 0.f });
+    
+    float rads = 0.f;
+    for(int i=0; i<k; i++) {
+        float x = r1*std::cos(rads);
+        float z = r1*std::sin(rads);
+        vertices.push_back({x, 0.f, z});
+        normals.push_back({-x, 0.f, -z});
+
+        rads += delta;
+    }
+
+    rads = 0.f;
+    for(int i=0; i<k; i++) {
+        float x = r2*std::cos(rads);
+        float z = r2*std::sin(rads);
+        vertices.push_back({x, 0.f, z});
+        normals.push_back({x, 0.f, z});
+
+        rads += delta;
+    }
+
+    rads = 0.f;
+    normals.push_back({ -1, 0, 0 });
+    for(int i=0; i<k; i++) {
+        float x = r1*std::cos(rads);
+        float z = r1*std::sin(rads);
+        vertices.push_back({x, h, z});
+
+        rads += delta;
+    }
+
+    rads = 0.f;
+    for(int i=0; i<k; i++) {
+        float x = r2*std::cos(rads);
+        float z = r2*std::sin(rads);
+        vertices.push_back({x, h, z});
+
+        rads += delta;
+    }
+    normals.push_back({ -std::cos(rads), 0, -std::sin(rads) });
+
+    out.setBounds(vertices);
+
+    // bottom face
+    for(int i=0; i<k-1; i++) {
+        ADD_FACE(i, k+i, i+1, 0, 0, 0);
+        ADD_FACE(i+1, k+i, k+i+1, 0, 0, 0);
+    }
+
+    // top face
+    for(int i=0; i<k-1; i++) {
+        ADD_FACE(2*k+i+1, 3*k+i, 2*k+i, 1, 1, 1);
+        ADD_FACE(3*k+i+1, 3*k+i, 2*k+i+1, 1, 1, 1);
+    }
+
+    // side faces similar
+    // bottom i, top i, bottom i+1
+    // bottom i+1, top i, top i+1
+    for(int i=0; i<k-1; i++) {
+        // inner ring
+        // the winding is reverse, since the "inside" face is front-facing
+        ADD_FACE(i+1, 2*k+i, i, i+3, i+2, i+2);
+        ADD_FACE(2*k+i+1, 2*k+i, i+1, i+3, i+2, i+3);
+        // outer ring
+        ADD_FACE(k+i, 3*k+i, k+i+1, k+i+2, k+i+2, k+i+3);
+        ADD_FACE(k+i+1, 3*k+i, 3*k+i+1, k+i+3, k+i+2, k+i+3);
+    }
+
+    // side with i=0
+    // top outer - bottom outer - bottom inner
+    // top inner - top outer - bottom inner
+    ADD_FACE(3*k, k, 0, 2*k+2, 2*k+2, 2*k+2);
+    ADD_FACE(2*k, 3*k, 0, 2*k+2, 2*k+2, 2*k+2);
+
+    // similarly with i=k-1
+    // but the winding is reversed again
+    ADD_FACE(k-1, k+k-1, 3*k+k-1, 2*k+3, 2*k+3, 2*k+3);
+    ADD_FACE(k-1, 3*k+k-1, 2*k+k-1, 2*k+3, 2*k+3, 2*k+3);
+}
+
+#undef ADD_FACE
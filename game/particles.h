@@ -0,0 +1,183 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <glm/glm.hpp>
+
+// particles for the bounce and break effects
+// stored as a structure of arrays so the update kernel can work on 4 particles at a time
+// (gcc / clang vector extensions, which become sse on x86 and neon on arm). the arrays
+// are padded to a multiple of 4 and live particles are kept packed at the front, so the
+// kernel never needs a scalar tail. cpu only, drawing is up to the caller
+
+typedef float particle_v4 __attribute__((vector_size(16)));
+typedef int32_t particle_v4i __attribute__((vector_size(16)));
+
+struct ParticleSystem {
+    int count;
+    int capacity;
+
+    std::vector<float> px, py, pz;
+    std::vector<float> vx, vy, vz;
+    // seconds left, the particle is removed once this runs out
+    std::vector<float> life;
+    std::vector<float> size;
+    // rgba8, only needed for drawing
+    std::vector<uint32_t> color;
+
+    uint32_t rng;
+};
+
+// what the vertex shader gets per particle
+struct ParticleInstance {
+    glm::vec3 position;
+    float size;
+    uint32_t color;
+};
+
+inline void initParticles(ParticleSystem* ps, int capacity, uint32_t seed) {
+    capacity = (capacity + 3) & ~3;
+    ps->count = 0;
+    ps->capacity = capacity;
+    for(auto v : { &ps->px, &ps->py, &ps->pz, &ps->vx, &ps->vy, &ps->vz, &ps->life, &ps->size }) {
+        v->assign(capacity, 0.f);
+    }
+    ps->color.assign(capacity, 0);
+    ps->rng = seed ? seed : 1;
+}
+
+// uniform in [-1, 1]
+inline float particleRandom(ParticleSystem* ps) {
+    // xorshift32
+    ps->rng ^= ps->rng << 13;
+    ps->rng ^= ps->rng >> 17;
+    ps->rng ^= ps->rng << 5;
+    return (ps->rng >> 8) * (2.f / 16777216.f) - 1.f;
+}
+
+inline uint32_t packParticleColor(glm::vec3 c) {
+    auto channel = [](float v) { return (uint32_t)(glm::clamp(v, 0.f, 1.f) * 255.f + .5f); };
+    return channel(c.x) | channel(c.y) << 8 | channel(c.z) << 16 | 0xff000000u;
+}
+
+struct ParticleEmitter {
+    glm::vec3 position;
+    // particles start anywhere within this box around the position
+    glm::vec3 extent;
+    glm::vec3 velocity;
+    // random extra velocity in every direction
+    float spread;
+    glm::vec3 color;
+    float size;
+    float life;
+};
+
+// returns how many particles were actually emitted, when full the rest are dropped
+inline int emitParticles(ParticleSystem* ps, const ParticleEmitter& e, int n) {
+    n = std::min(n, ps->capacity - ps->count);
+    uint32_t color = packParticleColor(e.color);
+    for(int k=0; k<n; k++) {
+        int i = ps->count++;
+        ps->px[i] = e.position.x + e.extent.x * particleRandom(ps);
+        ps->py[i] = e.position.y + e.extent.y * particleRandom(ps);
+        ps->pz[i] = e.position.z + e.extent.z * particleRandom(ps);
+        ps->vx[i] = e.velocity.x + e.spread * particleRandom(ps);
+        ps->vy[i] = e.velocity.y + e.spread * particleRandom(ps);
+        ps->vz[i] = e.velocity.z + e.spread * particleRandom(ps);
+        // so a burst doesn't disappear all at once
+        ps->life[i] = e.life * (.75f + .25f * particleRandom(ps));
+        ps->size[i] = e.size * (.75f + .25f * particleRandom(ps));
+        ps->color[i] = color;
+    }
+    return n;
+}
+
+inline particle_v4 loadParticles(const float* p) {
+    particle_v4 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline void storeParticles(float* p, particle_v4 v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+// mask ? a : b, lane by lane (mask lanes are all ones or all zeros)
+inline particle_v4 selectParticles(particle_v4i mask, particle_v4 a, particle_v4 b) {
+    return (particle_v4)((mask & (particle_v4i)a) | (~mask & (particle_v4i)b));
+}
+
+// removes dead particles by moving the last live one into their slot
+inline void compactParticles(ParticleSystem* ps) {
+    int i = 0;
+    while(i < ps->count) {
+        if(ps->life[i] > 0.f) {
+            i++;
+            continue;
+        }
+
+        int last = --ps->count;
+        ps->px[i] = ps->px[last]; ps->py[i] = ps->py[last]; ps->pz[i] = ps->pz[last];
+        ps->vx[i] = ps->vx[last]; ps->vy[i] = ps->vy[last]; ps->vz[i] = ps->vz[last];
+        ps->life[i] = ps->life[last];
+        ps->size[i] = ps->size[last];
+        ps->color[i] = ps->color[last];
+    }
+}
+
+// gravity, bouncing off the floor and aging
+inline void updateParticles(ParticleSystem* ps, float dt, float floorY) {
+    const particle_v4 zero = { 0.f, 0.f, 0.f, 0.f };
+    const particle_v4 vdt = zero + dt;
+    const particle_v4 gravity = zero + -9.8f * dt;
+    const particle_v4 floor = zero + floorY;
+    // how much of the velocity is kept on a bounce
+    const particle_v4 restitution = zero + -.4f;
+    const particle_v4 friction = zero + .6f;
+    const particle_v4 one = zero + 1.f;
+
+    int n = (ps->count + 3) & ~3;
+    float* px = &ps->px[0]; float* py = &ps->py[0]; float* pz = &ps->pz[0];
+    float* vx = &ps->vx[0]; float* vy = &ps->vy[0]; float* vz = &ps->vz[0];
+    float* life = &ps->life[0];
+    const float* size = &ps->size[0];
+
+    for(int i=0; i<n; i+=4) {
+        particle_v4 x = loadParticles(px + i), y = loadParticles(py + i), z = loadParticles(pz + i);
+        particle_v4 dx = loadParticles(vx + i), dy = loadParticles(vy + i), dz = loadParticles(vz + i);
+
+        dy += gravity;
+        x += dx * vdt;
+        y += dy * vdt;
+        z += dz * vdt;
+
+        particle_v4 bottom = floor + loadParticles(size + i);
+        particle_v4i hit = y < bottom;
+        y = selectParticles(hit, bottom, y);
+        dy = selectParticles(hit, dy * restitution, dy);
+        particle_v4 slow = selectParticles(hit, friction, one);
+        dx *= slow;
+        dz *= slow;
+
+        storeParticles(px + i, x); storeParticles(py + i, y); storeParticles(pz + i, z);
+        storeParticles(vx + i, dx); storeParticles(vy + i, dy); storeParticles(vz + i, dz);
+        storeParticles(life + i, loadParticles(life + i) - vdt);
+    }
+
+    compactParticles(ps);
+}
+
+// fills out with the live particles, returns how many were written
+inline int writeParticleInstances(const ParticleSystem* ps, ParticleInstance* out, int max) {
+    int n = std::min(ps->count, max);
+    for(int i=0; i<n; i++) {
+        // shrink away during the last quarter of a second instead of popping out
+        float fade = std::min(ps->life[i] * 4.f, 1.f);
+        out[i].position = glm::vec3(ps->px[i], ps->py[i], ps->pz[i]);
+        out[i].size = ps->size[i] * fade;
+        out[i].color = ps->color[i];
+    }
+    return n;
+}
@@ -0,0 +1,771 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <string.h>
+#include <glm/glm.hpp>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "mesh.h"
+#include "particles.h"
+
+// software renderer
+// draws the game's meshes with the same per object data the vertex shader gets (see
+// vertex.gl) and the same lighting (lighting.gl, in any of the permutations shaders.h
+// makes), on the cpu. used when there is no usable GL, and as a reference for the GL path:
+// the image only depends on this code, not on the driver
+//
+// triangles go through the vertex stage in batches, on every render thread. a batch is
+// then binned into RASTER_TILE_SIZE tiles, and the render threads take whole tiles: first
+// every triangle in the tile is depth tested and leaves its index where it's closest,
+// then each triangle shades only the pixels it won, so every pixel is lit once no matter
+// how much overdraw there is. spans of RASTER_LANES pixels are tested and shaded at once
+// (8 with AVX2, 4 with SSE2). pixel centers, the top left fill rule and a LESS depth test,
+// like GL without multisampling. rows go bottom up like a GL framebuffer
+// triangles that cross the near plane are dropped instead of clipped, the camera never
+// gets close enough to the tower for that to matter
+// no GL in here, bench/ uses it as well
+
+#define RASTER_TILE_SIZE 64
+// triangles per batch, and bin entries (a triangle in a tile) per pass over the tiles
+#define RASTER_BATCH_TRIANGLES 16384
+#define RASTER_BATCH_BIN_ENTRIES (4 * RASTER_BATCH_TRIANGLES)
+#define RASTER_MAX_LIGHTS 128
+#define RASTER_NO_TRIANGLE 0xffffffffu
+
+// vectors of floats, one per pixel of a span, and masks from comparing them
+
+struct RasterF1 { float v; };
+struct RasterM1 { bool v; };
+
+inline RasterF1 operator+(RasterF1 a, RasterF1 b) { return { a.v + b.v }; }
+inline RasterF1 operator-(RasterF1 a, RasterF1 b) { return { a.v - b.v }; }
+inline RasterF1 operator*(RasterF1 a, RasterF1 b) { return { a.v * b.v }; }
+inline RasterF1 operator/(RasterF1 a, RasterF1 b) { return { a.v / b.v }; }
+inline RasterM1 operator<(RasterF1 a, RasterF1 b) { return { a.v < b.v }; }
+inline RasterM1 operator>(RasterF1 a, RasterF1 b) { return { a.v > b.v }; }
+inline RasterM1 operator>=(RasterF1 a, RasterF1 b) { return { a.v >= b.v }; }
+inline RasterM1 operator&(RasterM1 a, RasterM1 b) { return { a.v && b.v }; }
+inline RasterM1 operator|(RasterM1 a, RasterM1 b) { return { a.v || b.v }; }
+inline RasterF1 rasterMin(RasterF1 a, RasterF1 b) { return { a.v < b.v ? a.v : b.v }; }
+inline RasterF1 rasterMax(RasterF1 a, RasterF1 b) { return { a.v > b.v ? a.v : b.v }; }
+inline RasterF1 rasterSqrt(RasterF1 a) { return { sqrtf(a.v) }; }
+inline RasterF1 rasterSelect(RasterM1 m, RasterF1 a, RasterF1 b) { return { m.v ? a.v : b.v }; }
+inline int rasterBits(RasterM1 m) { return m.v; }
+
+#if defined(__AVX2__)
+struct RasterF8 { __m256 v; };
+struct RasterM8 { __m256 v; };
+
+inline RasterF8 operator+(RasterF8 a, RasterF8 b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline RasterF8 operator-(RasterF8 a, RasterF8 b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline RasterF8 operator*(RasterF8 a, RasterF8 b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline RasterF8 operator/(RasterF8 a, RasterF8 b) { return { _mm256_div_ps(a.v, b.v) }; }
+inline RasterM8 operator<(RasterF8 a, RasterF8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline RasterM8 operator>(RasterF8 a, RasterF8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline RasterM8 operator>=(RasterF8 a, RasterF8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+inline RasterM8 operator&(RasterM8 a, RasterM8 b) { return { _mm256_and_ps(a.v, b.v) }; }
+inline RasterM8 operator|(RasterM8 a, RasterM8 b) { return { _mm256_or_ps(a.v, b.v) }; }
+inline RasterF8 rasterMin(RasterF8 a, RasterF8 b) { return { _mm256_min_ps(a.v, b.v) }; }
+inline RasterF8 rasterMax(RasterF8 a, RasterF8 b) { return { _mm256_max_ps(a.v, b.v) }; }
+inline RasterF8 rasterSqrt(RasterF8 a) { return { _mm256_sqrt_ps(a.v) }; }
+inline RasterF8 rasterSelect(RasterM8 m, RasterF8 a, RasterF8 b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+inline int rasterBits(RasterM8 m) { return _mm256_movemask_ps(m.v); }
+#elif defined(__SSE2__)
+struct RasterF4 { __m128 v; };
+struct RasterM4 { __m128 v; };
+
+inline RasterF4 operator+(RasterF4 a, RasterF4 b) { return { _mm_add_ps(a.v, b.v) }; }
+inline RasterF4 operator-(RasterF4 a, RasterF4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+inline RasterF4 operator*(RasterF4 a, RasterF4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+inline RasterF4 operator/(RasterF4 a, RasterF4 b) { return { _mm_div_ps(a.v, b.v) }; }
+inline RasterM4 operator<(RasterF4 a, RasterF4 b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+inline RasterM4 operator>(RasterF4 a, RasterF4 b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+inline RasterM4 operator>=(RasterF4 a, RasterF4 b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+inline RasterM4 operator&(RasterM4 a, RasterM4 b) { return { _mm_and_ps(a.v, b.v) }; }
+inline RasterM4 operator|(RasterM4 a, RasterM4 b) { return { _mm_or_ps(a.v, b.v) }; }
+inline RasterF4 rasterMin(RasterF4 a, RasterF4 b) { return { _mm_min_ps(a.v, b.v) }; }
+inline RasterF4 rasterMax(RasterF4 a, RasterF4 b) { return { _mm_max_ps(a.v, b.v) }; }
+inline RasterF4 rasterSqrt(RasterF4 a) { return { _mm_sqrt_ps(a.v) }; }
+inline RasterF4 rasterSelect(RasterM4 m, RasterF4 a, RasterF4 b) {
+    return { _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)) };
+}
+inline int rasterBits(RasterM4 m) { return _mm_movemask_ps(m.v); }
+#endif
+
+// everything the raster loops need to know about a vector type
+template<typename F> struct RasterLanes;
+
+template<> struct RasterLanes<RasterF1> {
+    typedef RasterM1 Mask;
+    static const int count = 1;
+    static RasterF1 set(float f) { return { f }; }
+    // x, x+1, x+2 ...
+    static RasterF1 ramp(float x) { return { x }; }
+    static RasterF1 load(const float* p) { return { *p }; }
+    static void store(float* p, RasterF1 f) { *p = f.v; }
+    // the lanes whose id is index, and writing index where the mask is set
+    static int idBits(const uint32_t* ids, uint32_t index) { return *ids == index; }
+    static void storeIds(uint32_t* ids, RasterM1 m, uint32_t index) { if(m.v) *ids = index; }
+};
+
+#if defined(__AVX2__)
+template<> struct RasterLanes<RasterF8> {
+    typedef RasterM8 Mask;
+    static const int count = 8;
+    static RasterF8 set(float f) { return { _mm256_set1_ps(f) }; }
+    static RasterF8 ramp(float x) { return { _mm256_add_ps(_mm256_set1_ps(x), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)) }; }
+    static RasterF8 load(const float* p) { return { _mm256_loadu_ps(p) }; }
+    static void store(float* p, RasterF8 f) { _mm256_storeu_ps(p, f.v); }
+    static int idBits(const uint32_t* ids, uint32_t index) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)ids);
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, _mm256_set1_epi32(index))));
+    }
+    static void storeIds(uint32_t* ids, RasterM8 m, uint32_t index) {
+        __m256 old = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)ids));
+        __m256 v = _mm256_blendv_ps(old, _mm256_castsi256_ps(_mm256_set1_epi32(index)), m.v);
+        _mm256_storeu_si256((__m256i*)ids, _mm256_castps_si256(v));
+    }
+};
+typedef RasterF8 RasterWide;
+#elif defined(__SSE2__)
+template<> struct RasterLanes<RasterF4> {
+    typedef RasterM4 Mask;
+    static const int count = 4;
+    static RasterF4 set(float f) { return { _mm_set1_ps(f) }; }
+    static RasterF4 ramp(float x) { return { _mm_add_ps(_mm_set1_ps(x), _mm_setr_ps(0, 1, 2, 3)) }; }
+    static RasterF4 load(const float* p) { return { _mm_loadu_ps(p) }; }
+    static void store(float* p, RasterF4 f) { _mm_storeu_ps(p, f.v); }
+    static int idBits(const uint32_t* ids, uint32_t index) {
+        __m128i v = _mm_loadu_si128((const __m128i*)ids);
+        return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, _mm_set1_epi32(index))));
+    }
+    static void storeIds(uint32_t* ids, RasterM4 m, uint32_t index) {
+        __m128i mask = _mm_castps_si128(m.v);
+        __m128i old = _mm_loadu_si128((const __m128i*)ids);
+        __m128i v = _mm_or_si128(_mm_and_si128(mask, _mm_set1_epi32(index)), _mm_andnot_si128(mask, old));
+        _mm_storeu_si128((__m128i*)ids, v);
+    }
+};
+typedef RasterF4 RasterWide;
+#else
+typedef RasterF1 RasterWide;
+#endif
+
+#define RASTER_LANES (RasterLanes<RasterWide>::count)
+
+// the lighting, what a permutation of lighting.gl was compiled with
+struct RasterShading {
+    int lights;
+    bool specular;
+    bool vertexLighting;
+};
+
+// one draw call's worth, what the vertex shader would get
+struct RasterDraw {
+    glm::mat4 mvp, mv;
+    glm::mat3 normalMatrix;
+    glm::vec3 color;
+    // stored position -> model space, see VertexWriter
+    glm::vec3 positionBias, positionScale;
+    const uint8_t* vertices;
+    int numVertices;
+    VertexLayout layout;
+    // drawn once per instance if there are any
+    const ParticleInstance* instances;
+    int numInstances;
+    RasterShading shading;
+};
+
+// a triangle after the vertex stage, everything as planes over the screen
+struct RasterTriangle {
+    bool valid;
+    bool vertexLighting;
+    bool specular;
+    uint8_t lights;
+    // pixels it can touch, [min, max)
+    int minX, minY, maxX, maxY;
+    // edge i is opposite vertex i, positive inside: a x + b y + c
+    float edge[3][3];
+    bool topLeft[3];
+    // the planes below are relative to the first vertex, far from it a plane through
+    // absolute coordinates loses too much to tell a sphere's front from its back
+    float originX, originY;
+    // window depth, and 1/w for perspective correct attributes. d/dx, d/dy, at the origin
+    float depth[3];
+    float invW[3];
+    // attribute / w: camera space position and normal, or the lit color for vertex lighting
+    float attrib[6][3];
+    glm::vec3 color;
+};
+
+struct RasterTarget {
+    // what's drawn, the buffers are padded to whole tiles
+    int width, height;
+    int stride, rows;
+    int tilesX, tilesY;
+    // rgba8, bottom row first
+    std::vector<uint32_t> color;
+    std::vector<float> depth;
+    // which triangle of the batch is closest, per pixel
+    std::vector<uint32_t> ids;
+};
+
+// threads that only ever run the renderer's work: a frame can't wait behind a mesh being
+// generated on the game's pool, and running a job doesn't allocate
+struct RasterWorkers {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    uint64_t generation;
+    bool stopping;
+    int busy;
+
+    // the job, fn(ctx, begin, end) over [0, n) in chunks of grain
+    void (*fn)(void*, size_t, size_t);
+    void* ctx;
+    size_t n, grain;
+    std::atomic<size_t> next;
+};
+
+struct RasterRenderer {
+    RasterTarget target;
+    RasterWorkers workers;
+    // the widest vectors there are, or one pixel at a time (the reference for the others)
+    bool scalar;
+
+    uint32_t clearColor;
+    bool cleared;
+    int numLights;
+    glm::vec3 lights[RASTER_MAX_LIGHTS];
+
+    std::vector<RasterTriangle> triangles;
+    size_t numTriangles;
+    // per tile, where its entries start in binEntries
+    std::vector<uint32_t> binCounts, binStarts;
+    std::vector<uint32_t> binEntries;
+
+    uint64_t drawnTriangles, flushes;
+};
+
+// the render threads
+
+inline void runRasterChunks(RasterWorkers* w) {
+    size_t b;
+    while((b = w->next.fetch_add(w->grain, std::memory_order_relaxed)) < w->n) {
+        w->fn(w->ctx, b, std::min(b + w->grain, w->n));
+    }
+}
+
+inline void rasterWorkerLoop(RasterWorkers* w) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(w->mutex);
+    while(true) {
+        w->wake.wait(lock, [&] { return w->stopping || w->generation != seen; });
+        if(w->stopping) return;
+        seen = w->generation;
+        lock.unlock();
+        runRasterChunks(w);
+        lock.lock();
+        if(--w->busy == 0) w->done.notify_one();
+    }
+}
+
+// helpers besides the calling thread, 0 runs everything on the caller
+inline void startRasterWorkers(RasterWorkers* w, int helpers) {
+    w->generation = 0;
+    w->stopping = false;
+    w->busy = 0;
+    for(int i=0; i<helpers; i++) w->threads.emplace_back(rasterWorkerLoop, w);
+}
+
+inline void stopRasterWorkers(RasterWorkers* w) {
+    {
+        std::lock_guard<std::mutex> lock(w->mutex);
+        w->stopping = true;
+    }
+    w->wake.notify_all();
+    for(auto& t : w->threads) t.join();
+    w->threads.clear();
+}
+
+// calls f(begin, end) over [0, n) on every render thread, returns once all of it is done
+template<typename Fn>
+void runRasterJob(RasterWorkers* w, size_t n, size_t grain, Fn& f) {
+    w->fn = [](void* ctx, size_t b, size_t e) { (*(Fn*)ctx)(b, e); };
+    w->ctx = &f;
+    w->n = n;
+    w->grain = grain ? grain : 1;
+    w->next.store(0, std::memory_order_relaxed);
+    if(w->threads.empty() || n <= w->grain) {
+        runRasterChunks(w);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(w->mutex);
+        w->busy = (int)w->threads.size();
+        w->generation++;
+    }
+    w->wake.notify_all();
+    runRasterChunks(w);
+    std::unique_lock<std::mutex> lock(w->mutex);
+    w->done.wait(lock, [&] { return w->busy == 0; });
+}
+
+// the lighting, lighting.gl on a span of pixels (or a single vertex)
+
+template<typename F>
+void rasterShade(const RasterRenderer* r, const RasterTriangle& t, const glm::vec3& objectColor,
+                 F px, F py, F pz, F nx, F ny, F nz, F* out) {
+    typedef RasterLanes<F> L;
+    F zero = L::set(0.f), one = L::set(1.f);
+    // LightColor is white, LightPower 50, MaterialSpecularColor .3
+    F diffuse[3], color[3];
+    for(int i=0; i<3; i++) {
+        diffuse[i] = L::set(objectColor[i]);
+        color[i] = L::set(.6f) * diffuse[i];
+        diffuse[i] = diffuse[i] * L::set(50.f);
+    }
+
+    F inv = one / rasterSqrt(nx*nx + ny*ny + nz*nz);
+    nx = nx * inv; ny = ny * inv; nz = nz * inv;
+    F ex = zero, ey = zero, ez = zero;
+    if(t.specular) {
+        F e = one / rasterSqrt(px*px + py*py + pz*pz);
+        ex = zero - px * e; ey = zero - py * e; ez = zero - pz * e;
+    }
+
+    for(int i=0; i<t.lights; i++) {
+        const glm::vec3& light = r->lights[i];
+        F lx = L::set(light.x) - px, ly = L::set(light.y) - py, lz = L::set(light.z) - pz;
+        F dist2 = lx*lx + ly*ly + lz*lz;
+        F dist = rasterSqrt(dist2);
+        lx = lx / dist; ly = ly / dist; lz = lz / dist;
+        F cosTheta = nx*lx + ny*ly + nz*lz;
+        cosTheta = rasterMin(rasterMax(cosTheta, zero), one);
+
+        F d = cosTheta / dist2;
+        for(int c=0; c<3; c++) color[c] = color[c] + diffuse[c] * d;
+
+        if(t.specular) {
+            // reflect(-l, n) = 2 dot(n, l) n - l
+            F nl = nx*lx + ny*ly + nz*lz;
+            F two = nl + nl;
+            F rx = two*nx - lx, ry = two*ny - ly, rz = two*nz - lz;
+            F cosAlpha = rasterMin(rasterMax(ex*rx + ey*ry + ez*rz, zero), one);
+            F a2 = cosAlpha * cosAlpha;
+            F s = L::set(.3f) * L::set(.5f) * (a2 * a2 * cosAlpha) / dist2;
+            for(int c=0; c<3; c++) color[c] = color[c] + s;
+        }
+    }
+    for(int c=0; c<3; c++) out[c] = color[c];
+}
+
+// the vertex stage
+
+inline glm::vec3 rasterVertexPosition(const RasterDraw& d, int v) {
+    const uint8_t* p = d.vertices + (size_t)v * vertexStride(d.layout);
+    glm::vec3 pos;
+    switch(d.layout.position) {
+    case POSITION_FLOAT:
+        memcpy(&pos[0], p, 3*sizeof(float));
+        break;
+    case POSITION_HALF: {
+        uint16_t h[3];
+        memcpy(h, p, sizeof(h));
+        for(int i=0; i<3; i++) pos[i] = glm::unpackHalf1x16(h[i]);
+        break;
+    }
+    case POSITION_SNORM16: {
+        int16_t s[3];
+        memcpy(s, p, sizeof(s));
+        for(int i=0; i<3; i++) pos[i] = std::max(s[i] / 32767.f, -1.f);
+        break;
+    }
+    }
+    return d.positionBias + d.positionScale * pos;
+}
+
+inline glm::vec3 rasterVertexNormal(const RasterDraw& d, int v) {
+    const uint8_t* p = d.vertices + (size_t)v * vertexStride(d.layout) + positionSize(d.layout.position);
+    glm::vec3 n;
+    if(d.layout.normal == NORMAL_FLOAT) {
+        memcpy(&n[0], p, 3*sizeof(float));
+    } else {
+        uint32_t packed;
+        memcpy(&packed, p, sizeof(packed));
+        for(int i=0; i<3; i++) {
+            // sign extend the 10 bits
+            int32_t c = (int32_t)(packed << (22 - 10*i)) >> 22;
+            n[i] = std::max(c / 511.f, -1.f);
+        }
+    }
+    return n;
+}
+
+// triangle t of the draw, instances one after the other like glDrawArraysInstanced
+inline void setupRasterTriangle(const RasterRenderer* r, const RasterDraw& d, size_t t, RasterTriangle* out) {
+    out->valid = false;
+    int perInstance = d.numVertices / 3;
+    int first = (int)(t % perInstance) * 3;
+
+    glm::vec4 offsetScale(0.f, 0.f, 0.f, 1.f);
+    glm::vec3 color = d.color;
+    if(d.instances) {
+        const ParticleInstance& inst = d.instances[t / perInstance];
+        offsetScale = glm::vec4(inst.position, inst.size);
+        for(int i=0; i<3; i++) color[i] *= ((inst.color >> (8*i)) & 0xff) / 255.f;
+    }
+
+    glm::vec4 position[3], clip[3];
+    float sx[3], sy[3];
+    const RasterTarget& target = r->target;
+    for(int i=0; i<3; i++) {
+        glm::vec3 model = rasterVertexPosition(d, first + i);
+        position[i] = glm::vec4(model * offsetScale.w + glm::vec3(offsetScale), 1.f);
+        clip[i] = d.mvp * position[i];
+        // in front of the near plane, see the top of the file
+        if(clip[i].z < -clip[i].w || clip[i].w <= 0.f) return;
+        sx[i] = (clip[i].x / clip[i].w * .5f + .5f) * target.width;
+        sy[i] = (clip[i].y / clip[i].w * .5f + .5f) * target.height;
+    }
+
+    // twice the signed area, the edges are flipped for clockwise triangles so inside is
+    // always positive (nothing is culled, like the GL path)
+    float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+    if(!(area != 0.f)) return;
+    float sign = area > 0.f ? 1.f : -1.f;
+    float invArea = 1.f / (area * sign);
+
+    float minX = std::min(sx[0], std::min(sx[1], sx[2])), maxX = std::max(sx[0], std::max(sx[1], sx[2]));
+    float minY = std::min(sy[0], std::min(sy[1], sy[2])), maxY = std::max(sy[0], std::max(sy[1], sy[2]));
+    // the pixels whose centers can be inside
+    out->minX = std::max(0, (int)std::ceil(minX - .5f));
+    out->minY = std::max(0, (int)std::ceil(minY - .5f));
+    out->maxX = std::min(target.width, (int)std::floor(maxX - .5f) + 1);
+    out->maxY = std::min(target.height, (int)std::floor(maxY - .5f) + 1);
+    if(out->minX >= out->maxX || out->minY >= out->maxY) return;
+
+    for(int i=0; i<3; i++) {
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        float a = (sy[j] - sy[k]) * sign;
+        float b = (sx[k] - sx[j]) * sign;
+        float c = (sx[j] * sy[k] - sy[j] * sx[k]) * sign;
+        out->edge[i][0] = a;
+        out->edge[i][1] = b;
+        out->edge[i][2] = c;
+        // y goes up, so a top edge has the inside below it
+        out->topLeft[i] = a > 0.f || (a == 0.f && b < 0.f);
+    }
+
+    // a plane over the screen through value v at each vertex
+    out->originX = sx[0];
+    out->originY = sy[0];
+    auto plane = [&](const float* v, float* p) {
+        for(int c=0; c<2; c++) {
+            p[c] = 0.f;
+            for(int i=0; i<3; i++) p[c] += out->edge[i][c] * v[i];
+            p[c] *= invArea;
+        }
+        p[2] = v[0];
+    };
+
+    float z[3], invW[3];
+    for(int i=0; i<3; i++) {
+        z[i] = clip[i].z / clip[i].w * .5f + .5f;
+        invW[i] = 1.f / clip[i].w;
+    }
+    plane(z, out->depth);
+    plane(invW, out->invW);
+
+    // only what's left on screen needs the rest of the vertex shader
+    glm::vec3 camera[3], normal[3];
+    for(int i=0; i<3; i++) {
+        camera[i] = glm::vec3(d.mv * position[i]);
+        normal[i] = d.normalMatrix * rasterVertexNormal(d, first + i);
+    }
+
+    out->vertexLighting = d.shading.vertexLighting;
+    out->specular = d.shading.specular;
+    out->lights = (uint8_t)std::min(d.shading.lights, r->numLights);
+    out->color = color;
+
+    float v[3];
+    if(d.shading.vertexLighting) {
+        for(int i=0; i<3; i++) {
+            RasterF1 lit[3];
+            rasterShade<RasterF1>(r, *out, color, { camera[i].x }, { camera[i].y }, { camera[i].z },
+                { normal[i].x }, { normal[i].y }, { normal[i].z }, lit);
+            camera[i] = glm::vec3(lit[0].v, lit[1].v, lit[2].v);
+        }
+    }
+    for(int a=0; a<3; a++) {
+        for(int i=0; i<3; i++) v[i] = camera[i][a] * invW[i];
+        plane(v, out->attrib[a]);
+        if(d.shading.vertexLighting) continue;
+        for(int i=0; i<3; i++) v[i] = normal[i][a] * invW[i];
+        plane(v, out->attrib[3 + a]);
+    }
+    out->valid = true;
+}
+
+// the tiles
+
+inline void clearRasterTile(RasterRenderer* r, int x0, int y0) {
+    RasterTarget& t = r->target;
+    for(int y=y0; y<y0 + RASTER_TILE_SIZE; y++) {
+        size_t row = (size_t)y * t.stride + x0;
+        std::fill(&t.color[row], &t.color[row] + RASTER_TILE_SIZE, r->clearColor);
+        std::fill(&t.depth[row], &t.depth[row] + RASTER_TILE_SIZE, 1.f);
+    }
+}
+
+inline uint32_t packRasterColor(float r, float g, float b) {
+    auto unorm = [](float f) { return (uint32_t)(std::min(std::max(f, 0.f), 1.f) * 255.f + .5f); };
+    return unorm(r) | unorm(g) << 8 | unorm(b) << 16 | 0xff000000u;
+}
+
+// the part of row fy the triangle can cover within [lo, hi), solved from the edges with a
+// pixel to spare on both sides (the edge test has the last word). long thin triangles
+// only cover a sliver of their box
+inline bool rasterRowSpan(const RasterTriangle& t, float fy, int lo, int hi, int* x0, int* x1) {
+    float left = (float)lo, right = (float)hi;
+    for(int i=0; i<3; i++) {
+        float a = t.edge[i][0], r = t.edge[i][1] * fy + t.edge[i][2];
+        if(a == 0.f) {
+            if(r < 0.f) return false;
+            continue;
+        }
+        float x = -r / a;
+        if(a > 0.f) left = std::max(left, x - 1.5f);
+        else right = std::min(right, x + 1.5f);
+    }
+    if(!(left < right)) return false;
+    *x0 = (int)left;
+    *x1 = std::min(hi, (int)right + 1);
+    return *x0 < *x1;
+}
+
+template<typename F>
+void rasterTile(RasterRenderer* r, int tile) {
+    typedef RasterLanes<F> L;
+    typedef typename L::Mask M;
+    RasterTarget& target = r->target;
+    int x0 = (tile % target.tilesX) * RASTER_TILE_SIZE;
+    int y0 = (tile / target.tilesX) * RASTER_TILE_SIZE;
+    if(!r->cleared) clearRasterTile(r, x0, y0);
+
+    const uint32_t* entries = &r->binEntries[r->binStarts[tile]];
+    uint32_t numEntries = r->binCounts[tile];
+    if(!numEntries) return;
+
+    for(int y=y0; y<y0 + RASTER_TILE_SIZE; y++) {
+        std::fill(&target.ids[(size_t)y * target.stride + x0], &target.ids[(size_t)y * target.stride + x0] + RASTER_TILE_SIZE,
+            RASTER_NO_TRIANGLE);
+    }
+
+    // depth, and which triangle is closest
+    for(uint32_t e=0; e<numEntries; e++) {
+        uint32_t index = entries[e];
+        const RasterTriangle& t = r->triangles[index];
+        int tx0 = std::max(t.minX, x0), tx1 = std::min(t.maxX, x0 + RASTER_TILE_SIZE);
+        int ty0 = std::max(t.minY, y0), ty1 = std::min(t.maxY, y0 + RASTER_TILE_SIZE);
+        F left = L::set((float)t.minX), right = L::set((float)t.maxX);
+        for(int y=ty0; y<ty1; y++) {
+            float fy = y + .5f;
+            int sx0, sx1;
+            if(!rasterRowSpan(t, fy, tx0, tx1, &sx0, &sx1)) continue;
+            F row[3];
+            for(int i=0; i<3; i++) row[i] = L::set(t.edge[i][1] * fy + t.edge[i][2]);
+            F zRow = L::set(t.depth[1] * (fy - t.originY) + t.depth[2]);
+            size_t offset = (size_t)y * target.stride;
+            for(int x=sx0 & ~(L::count - 1); x<sx1; x+=L::count) {
+                F fx = L::ramp(x + .5f);
+                // a span can start left of the box, and right on the box the rounded edges
+                // may still say inside. every vector width has to cover the same pixels
+                M inside = (fx > left) & (right > fx);
+                for(int i=0; i<3; i++) {
+                    F ei = L::set(t.edge[i][0]) * fx + row[i];
+                    inside = inside & (t.topLeft[i] ? ei >= L::set(0.f) : ei > L::set(0.f));
+                }
+                if(!rasterBits(inside)) continue;
+
+                F z = L::set(t.depth[0]) * (fx - L::set(t.originX)) + zRow;
+                float* depth = &target.depth[offset + x];
+                F old = L::load(depth);
+                M closer = inside & (z < old);
+                int bits = rasterBits(closer);
+                if(!bits) continue;
+                L::store(depth, rasterSelect(closer, z, old));
+                L::storeIds(&target.ids[offset + x], closer, index);
+            }
+        }
+    }
+
+    // every triangle lights the pixels it won
+    float out[3][L::count];
+    for(uint32_t e=0; e<numEntries; e++) {
+        uint32_t index = entries[e];
+        const RasterTriangle& t = r->triangles[index];
+        int tx0 = std::max(t.minX, x0), tx1 = std::min(t.maxX, x0 + RASTER_TILE_SIZE);
+        int ty0 = std::max(t.minY, y0), ty1 = std::min(t.maxY, y0 + RASTER_TILE_SIZE);
+        for(int y=ty0; y<ty1; y++) {
+            float fy = y + .5f;
+            int sx0, sx1;
+            if(!rasterRowSpan(t, fy, tx0, tx1, &sx0, &sx1)) continue;
+            size_t offset = (size_t)y * target.stride;
+            for(int x=sx0 & ~(L::count - 1); x<sx1; x+=L::count) {
+                int bits = L::idBits(&target.ids[offset + x], index);
+                if(!bits) continue;
+
+                F dx = L::ramp(x + .5f) - L::set(t.originX), dy = L::set(fy - t.originY);
+                F w = L::set(1.f) / (L::set(t.invW[0]) * dx + L::set(t.invW[1]) * dy + L::set(t.invW[2]));
+                F a[6];
+                int numAttribs = t.vertexLighting ? 3 : 6;
+                for(int i=0; i<numAttribs; i++) {
+                    a[i] = (L::set(t.attrib[i][0]) * dx + L::set(t.attrib[i][1]) * dy + L::set(t.attrib[i][2])) * w;
+                }
+                F color[3];
+                if(t.vertexLighting) {
+                    for(int c=0; c<3; c++) color[c] = a[c];
+                } else {
+                    rasterShade<F>(r, t, t.color, a[0], a[1], a[2], a[3], a[4], a[5], color);
+                }
+                for(int c=0; c<3; c++) L::store(out[c], color[c]);
+                uint32_t* pixels = &target.color[offset + x];
+                for(int lane=0; lane<L::count; lane++) {
+                    if((bits >> lane) & 1) pixels[lane] = packRasterColor(out[0][lane], out[1][lane], out[2][lane]);
+                }
+            }
+        }
+    }
+}
+
+// bins the batch and runs the tiles, as many passes as the bin entries need
+inline void flushRasterBatch(RasterRenderer* r) {
+    RasterTarget& target = r->target;
+    int numTiles = target.tilesX * target.tilesY;
+    size_t start = 0;
+    do {
+        std::fill(r->binCounts.begin(), r->binCounts.end(), 0);
+        size_t end = start, entries = 0;
+        for(; end < r->numTriangles; end++) {
+            const RasterTriangle& t = r->triangles[end];
+            if(!t.valid) continue;
+            int tx0 = t.minX / RASTER_TILE_SIZE, tx1 = (t.maxX - 1) / RASTER_TILE_SIZE;
+            int ty0 = t.minY / RASTER_TILE_SIZE, ty1 = (t.maxY - 1) / RASTER_TILE_SIZE;
+            size_t n = (size_t)(tx1 - tx0 + 1) * (ty1 - ty0 + 1);
+            if(entries + n > r->binEntries.size() && entries > 0) break;
+            entries += n;
+            for(int ty=ty0; ty<=ty1; ty++) {
+                for(int tx=tx0; tx<=tx1; tx++) r->binCounts[ty * target.tilesX + tx]++;
+            }
+        }
+
+        uint32_t sum = 0;
+        for(int i=0; i<numTiles; i++) {
+            r->binStarts[i] = sum;
+            sum += r->binCounts[i];
+            r->binCounts[i] = 0;
+        }
+        for(size_t i=start; i<end; i++) {
+            const RasterTriangle& t = r->triangles[i];
+            if(!t.valid) continue;
+            for(int ty=t.minY / RASTER_TILE_SIZE; ty<=(t.maxY - 1) / RASTER_TILE_SIZE; ty++) {
+                for(int tx=t.minX / RASTER_TILE_SIZE; tx<=(t.maxX - 1) / RASTER_TILE_SIZE; tx++) {
+                    int tile = ty * target.tilesX + tx;
+                    r->binEntries[r->binStarts[tile] + r->binCounts[tile]++] = (uint32_t)i;
+                }
+            }
+        }
+
+        auto run = [r](size_t b, size_t e) {
+            for(size_t tile=b; tile<e; tile++) {
+                if(r->scalar) rasterTile<RasterF1>(r, (int)tile);
+                else rasterTile<RasterWide>(r, (int)tile);
+            }
+        };
+        runRasterJob(&r->workers, numTiles, 1, run);
+        r->cleared = true;
+        r->flushes++;
+        start = end;
+    } while(start < r->numTriangles);
+    r->numTriangles = 0;
+}
+
+// the renderer
+
+inline void initRasterRenderer(RasterRenderer* r, int helperThreads) {
+    r->triangles.resize(RASTER_BATCH_TRIANGLES);
+    r->binEntries.resize(RASTER_BATCH_BIN_ENTRIES);
+    r->numTriangles = 0;
+    r->target = RasterTarget();
+    startRasterWorkers(&r->workers, helperThreads);
+}
+
+inline void deleteRasterRenderer(RasterRenderer* r) {
+    stopRasterWorkers(&r->workers);
+    r->triangles = std::vector<RasterTriangle>();
+    r->binEntries = std::vector<uint32_t>();
+    r->binCounts = std::vector<uint32_t>();
+    r->binStarts = std::vector<uint32_t>();
+    r->target = RasterTarget();
+}
+
+// the buffers only change (and allocate) when the size does
+inline void beginRasterFrame(RasterRenderer* r, int width, int height, glm::vec3 clearColor,
+                             const glm::vec3* lights, int numLights) {
+    RasterTarget& t = r->target;
+    if(width != t.width || height != t.height) {
+        t.width = width;
+        t.height = height;
+        t.tilesX = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+        t.tilesY = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+        t.stride = t.tilesX * RASTER_TILE_SIZE;
+        t.rows = t.tilesY * RASTER_TILE_SIZE;
+        t.color.assign((size_t)t.stride * t.rows, 0);
+        t.depth.assign((size_t)t.stride * t.rows, 1.f);
+        t.ids.assign((size_t)t.stride * t.rows, RASTER_NO_TRIANGLE);
+        r->binCounts.assign(t.tilesX * t.tilesY, 0);
+        r->binStarts.assign(t.tilesX * t.tilesY, 0);
+    }
+    r->clearColor = packRasterColor(clearColor.x, clearColor.y, clearColor.z);
+    r->cleared = false;
+    r->numLights = std::min(numLights, RASTER_MAX_LIGHTS);
+    std::copy(lights, lights + r->numLights, r->lights);
+    r->numTriangles = 0;
+    r->drawnTriangles = 0;
+    r->flushes = 0;
+}
+
+inline void rasterDraw(RasterRenderer* r, const RasterDraw& d) {
+    size_t total = (size_t)(d.numVertices / 3) * (d.instances ? d.numInstances : 1);
+    size_t done = 0;
+    while(done < total) {
+        size_t n = std::min(total - done, r->triangles.size() - r->numTriangles);
+        RasterTriangle* out = &r->triangles[r->numTriangles];
+        auto setup = [r, &d, out, done](size_t b, size_t e) {
+            for(size_t i=b; i<e; i++) setupRasterTriangle(r, d, done + i, &out[i]);
+        };
+        runRasterJob(&r->workers, n, 256, setup);
+        r->numTriangles += n;
+        r->drawnTriangles += n;
+        done += n;
+        if(r->numTriangles == r->triangles.size()) flushRasterBatch(r);
+    }
+}
+
+// the image is in r->target once this returns
+inline void endRasterFrame(RasterRenderer* r) {
+    if(r->numTriangles > 0 || !r->cleared) flushRasterBatch(r);
+}
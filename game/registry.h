@@ -0,0 +1,149 @@
+#pragma once
+
+// every GL object the game library creates and every long lived container Initialize fills,
+// tagged with what owns it and the generation (the Initialize call) that made it
+// the GL context outlives every library, and the launcher calls Initialize again on the
+// same library when a newer one fails to start, so whatever Cleanup misses piles up with
+// each reload. Cleanup ends the generation: GL objects still registered by then are
+// reported as leaks and deleted, and the containers are emptied and give their memory back.
+// a container that isn't empty when Initialize registers it again is reported the same way
+// needs the GL headers included before it, like streambuffer.h
+
+#include <vector>
+#include <functional>
+#include <stdio.h>
+#include <stdint.h>
+#include "glstate.h"
+
+enum GLObjectType {
+    GL_OBJECT_BUFFER,
+    GL_OBJECT_VERTEX_ARRAY,
+    GL_OBJECT_TEXTURE,
+    GL_OBJECT_SHADER,
+    GL_OBJECT_PROGRAM,
+};
+
+static const char* glObjectTypeNames[] = { "buffer", "vertex array", "texture", "shader", "program" };
+
+struct GLObjectEntry {
+    GLObjectType type;
+    GLuint name;
+    const char* owner;
+    uint32_t generation;
+};
+
+struct ContainerEntry {
+    const char* owner;
+    uint32_t generation;
+    // bytes it holds on to, and a way to give them back
+    std::function<size_t()> size;
+    std::function<void()> release;
+};
+
+struct Registry {
+    // 0 until the first Initialize
+    uint32_t generation;
+    std::vector<GLObjectEntry> objects;
+    std::vector<ContainerEntry> containers;
+};
+
+// one per library instance
+static Registry registry;
+
+// the GL state shadow (glstate.h) forgets about it too
+inline void deleteGLObject(GLObjectType type, GLuint name) {
+    switch(type) {
+    case GL_OBJECT_BUFFER: glDeleteBuffers(1, &name); forgetGLBuffer(name); break;
+    case GL_OBJECT_VERTEX_ARRAY: glDeleteVertexArrays(1, &name); forgetGLVertexArray(name); break;
+    case GL_OBJECT_TEXTURE: glDeleteTextures(1, &name); forgetGLTexture(name); break;
+    case GL_OBJECT_SHADER: glDeleteShader(name); break;
+    case GL_OBJECT_PROGRAM: glDeleteProgram(name); forgetGLProgram(name); break;
+    }
+}
+
+inline GLuint registerGLObject(GLObjectType type, GLuint name, const char* owner) {
+    if(name) registry.objects.push_back({ type, name, owner, registry.generation });
+    return name;
+}
+
+inline GLuint genBuffer(const char* owner) {
+    GLuint b = 0;
+    glGenBuffers(1, &b);
+    return registerGLObject(GL_OBJECT_BUFFER, b, owner);
+}
+
+inline GLuint genVertexArray(const char* owner) {
+    GLuint v = 0;
+    glGenVertexArrays(1, &v);
+    return registerGLObject(GL_OBJECT_VERTEX_ARRAY, v, owner);
+}
+
+inline GLuint genTexture(const char* owner) {
+    GLuint t = 0;
+    glGenTextures(1, &t);
+    return registerGLObject(GL_OBJECT_TEXTURE, t, owner);
+}
+
+inline GLuint createShader(GLenum type, const char* owner) {
+    return registerGLObject(GL_OBJECT_SHADER, glCreateShader(type), owner);
+}
+
+inline GLuint createProgram(const char* owner) {
+    return registerGLObject(GL_OBJECT_PROGRAM, glCreateProgram(), owner);
+}
+
+// deletes the object and zeroes the name, 0 is ignored like glDelete* does
+inline void releaseGLObject(GLObjectType type, GLuint* name) {
+    if(!*name) return;
+    auto& objects = registry.objects;
+    size_t i = 0;
+    while(i < objects.size() && !(objects[i].type == type && objects[i].name == *name)) i++;
+    if(i < objects.size()) objects.erase(objects.begin() + i);
+    else fprintf(stderr, "Releasing %s %u, which was never registered\n", glObjectTypeNames[type], *name);
+    deleteGLObject(type, *name);
+    *name = 0;
+}
+
+// anything that owns memory, release has to leave it empty
+inline void registerContainer(const char* owner, std::function<size_t()> size, std::function<void()> release) {
+    size_t left = size();
+    if(left) {
+        fprintf(stderr, "Leaked %zu bytes in %s before generation %u\n", left, owner, registry.generation);
+        release();
+    }
+    registry.containers.push_back({ owner, registry.generation, size, release });
+}
+
+template<typename T>
+void registerContainer(const char* owner, std::vector<T>* v) {
+    registerContainer(owner,
+        [v] { return v->capacity() * sizeof(T); },
+        [v] { std::vector<T>().swap(*v); });
+}
+
+// whatever is still registered, nobody is going to delete it anymore
+inline void releaseLeakedGLObjects() {
+    for(auto& o : registry.objects) {
+        fprintf(stderr, "Leaked %s %u (%s) from generation %u\n",
+            glObjectTypeNames[o.type], o.name, o.owner, o.generation);
+        deleteGLObject(o.type, o.name);
+    }
+    registry.objects.clear();
+}
+
+// call first thing in Initialize
+inline void beginRegistryGeneration() {
+    registry.generation++;
+    // only finds anything when Initialize runs twice without a Cleanup in between
+    releaseLeakedGLObjects();
+    registry.containers.clear();
+    // the meshes create their buffers from Draw, this keeps that from allocating
+    registry.objects.reserve(64);
+}
+
+// call last thing in Cleanup, after every owner released what it knows about
+inline void endRegistryGeneration() {
+    releaseLeakedGLObjects();
+    for(auto& c : registry.containers) c.release();
+    registry.containers.clear();
+}
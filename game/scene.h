@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "levels.h"
+
+// what the scene is built from. the defaults are the game as it is meant to be played,
+// the headless driver overrides them through the environment to build stress scenes
+struct SceneConfig {
+    int levels;
+    // sections per level
+    int sections;
+    // including the player's, the others bounce around but aren't part of the saved state
+    int balls;
+    int lights;
+    // multiplies the tessellation of the generated meshes
+    int detail;
+};
+
+const SceneConfig defaultScene = { 5, 32, 1, 10, 1 };
+
+inline int sceneValue(const char* name, int fallback, int lo, int hi) {
+    const char* v = getenv(name);
+    if(!v || !*v) return fallback;
+    int i = atoi(v);
+    return i < lo ? lo : (i > hi ? hi : i);
+}
+
+inline SceneConfig sceneConfigFromEnv() {
+    SceneConfig c = defaultScene;
+    c.levels = sceneValue("BOUNCY_LEVELS", c.levels, 1, 4096);
+    c.sections = sceneValue("BOUNCY_SECTIONS", c.sections, 4, MAX_LEVEL_SECTIONS);
+    c.balls = sceneValue("BOUNCY_BALLS", c.balls, 1, 65536);
+    // the lights are a uniform array, this keeps it well within what any driver allows
+    c.lights = sceneValue("BOUNCY_LIGHTS", c.lights, 1, 128);
+    c.detail = sceneValue("BOUNCY_DETAIL", c.detail, 1, 16);
+    return c;
+}
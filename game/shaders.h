@@ -0,0 +1,217 @@
+#pragma once
+
+// shader permutations
+// vertex.gl and fragment.gl (with lighting.gl inserted into both) are compiled into
+// variants by putting #defines right after their #version line: how many lights, whether
+// there is a specular term, whether the lighting runs per vertex or per pixel and whether
+// the mesh is a sphere impostor (a quad the fragment shader ray casts a sphere in). whatever
+// a variant leaves out isn't in its code at all, nothing gets branched around at runtime.
+// programs are cached per permutation, the quality tier (BOUNCY_QUALITY) picks the
+// permutation every material is drawn with
+// needs the GL headers and registry.h included before it
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <string.h>
+#include <stdlib.h>
+
+enum QualityTier {
+    QUALITY_LOW,
+    QUALITY_MEDIUM,
+    QUALITY_HIGH,
+    QUALITY_TIER_COUNT
+};
+
+static const char* qualityTierNames[] = { "low", "medium", "high" };
+
+// what a drawable is shaded like
+enum Material {
+    MATERIAL_WORLD,     // the tower, the platforms and the balls
+    MATERIAL_PARTICLES, // small and short lived, nobody looks at them closely
+    MATERIAL_COUNT
+};
+
+struct ShaderFeatures {
+    // the uniform array's size. in a tier it's a cap, 0 for all of the scene's lights
+    int lights;
+    bool specular;
+    bool vertexLighting;
+    // not part of the tiers, the mesh decides (see Mesh::impostor in main.cpp)
+    bool impostor;
+};
+
+// per tier, per material
+static const ShaderFeatures qualityTiers[QUALITY_TIER_COUNT][MATERIAL_COUNT] = {
+    // the 4 lights closest to the camera, diffuse only, shaded at the vertices
+    { { 4, false, true, false }, { 4, false, true, false } },
+    // the particles go down to the low tier's shading
+    { { 0, true, false, false }, { 4, false, true, false } },
+    // what the game always looked like
+    { { 0, true, false, false }, { 0, true, false, false } },
+};
+
+struct ShaderProgram {
+    ShaderFeatures features;
+    GLuint program;
+    // uniform locations, looked up once after the program is linked
+    GLint objectData, objectIndex;
+    GLint lightPositions;
+    GLint multisampled;
+};
+
+struct ShaderCache {
+    // as read from disk, every permutation is compiled from these
+    std::string vertexSource, fragmentSource, lightingSource;
+    std::vector<ShaderProgram> programs;
+};
+
+inline QualityTier qualityFromEnv() {
+    const char* q = getenv("BOUNCY_QUALITY");
+    if(!q || !*q) return QUALITY_HIGH;
+    for(int i=0; i<QUALITY_TIER_COUNT; i++) {
+        if(strcmp(q, qualityTierNames[i]) == 0) return (QualityTier)i;
+    }
+    std::cerr << "Unknown quality " << q << ", expected low, medium or high\n";
+    return QUALITY_HIGH;
+}
+
+// the tier's features for a material, with the light count resolved against the scene's
+inline ShaderFeatures materialFeatures(QualityTier tier, Material material, int sceneLights) {
+    ShaderFeatures f = qualityTiers[tier][material];
+    if(f.lights <= 0 || f.lights > sceneLights) f.lights = sceneLights;
+    return f;
+}
+
+// the same for sphere impostors. they are always lit per pixel, a quad's corners aren't
+// on the sphere
+inline ShaderFeatures impostorFeatures(ShaderFeatures f) {
+    f.vertexLighting = false;
+    f.impostor = true;
+    return f;
+}
+
+// everything inserted right after the #version line
+inline std::string injectDefines(const std::string& src, const std::string& defines) {
+    size_t eol = src.find('\n');
+    if(src.compare(0, 8, "#version") != 0 || eol == std::string::npos) return defines + src;
+    return src.substr(0, eol + 1) + defines + src.substr(eol + 1);
+}
+
+inline std::string shaderDefines(const ShaderFeatures& f) {
+    return "#define NUM_LIGHTS " + std::to_string(f.lights) + "\n" +
+        "#define SPECULAR " + (f.specular ? "1" : "0") + "\n" +
+        "#define VERTEX_LIGHTING " + (f.vertexLighting ? "1" : "0") + "\n" +
+        "#define SPHERE_IMPOSTOR " + (f.impostor ? "1" : "0") + "\n";
+}
+
+inline bool readShaderSource(const char* path, std::string* out) {
+    std::ifstream file(path);
+    if(!file.is_open()) {
+        std::cerr << "Could not open shader file " << path << "\n";
+        return false;
+    }
+    std::stringstream sstr;
+    sstr << file.rdbuf();
+    *out = sstr.str();
+    return true;
+}
+
+// relative to the working directory, like the launcher always had them
+inline bool loadShaderSources(ShaderCache* c) {
+    // room for every permutation the tiers can ask for, so the cache never moves
+    c->programs.reserve(QUALITY_TIER_COUNT * MATERIAL_COUNT * 2);
+    return readShaderSource("vertex.gl", &c->vertexSource) &&
+        readShaderSource("fragment.gl", &c->fragmentSource) &&
+        readShaderSource("lighting.gl", &c->lightingSource);
+}
+
+// 0 if it doesn't compile
+inline GLuint compileShaderSource(GLenum type, const std::string& src, const char* owner) {
+    GLuint shader = createShader(type, owner);
+    const char* csrc = src.c_str();
+    glShaderSource(shader, 1, &csrc, NULL);
+    glCompileShader(shader);
+
+    int rc;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &rc);
+    if(rc != GL_TRUE) {
+        int len;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len);
+        char* msg = new char[len];
+        glGetShaderInfoLog(shader, len, NULL, msg);
+        std::cerr << (type == GL_VERTEX_SHADER ? "Vertex" : "Fragment") << " shader compile error:\n" << msg << "\n";
+        delete[] msg;
+        releaseGLObject(GL_OBJECT_SHADER, &shader);
+    }
+    return shader;
+}
+
+inline bool sameShaderFeatures(const ShaderFeatures& a, const ShaderFeatures& b) {
+    return a.lights == b.lights && a.specular == b.specular && a.vertexLighting == b.vertexLighting &&
+        a.impostor == b.impostor;
+}
+
+// 0 if either shader doesn't compile or the program doesn't link
+inline GLuint linkShaderProgram(const std::string& vertex, const std::string& fragment, const char* owner) {
+    GLuint vert = compileShaderSource(GL_VERTEX_SHADER, vertex, "vertex shader");
+    GLuint frag = compileShaderSource(GL_FRAGMENT_SHADER, fragment, "fragment shader");
+    if(!vert || !frag) {
+        releaseGLObject(GL_OBJECT_SHADER, &vert);
+        releaseGLObject(GL_OBJECT_SHADER, &frag);
+        return 0;
+    }
+
+    GLuint program = createProgram(owner);
+    glAttachShader(program, vert);
+    glAttachShader(program, frag);
+    glLinkProgram(program);
+    glDetachShader(program, vert);
+    glDetachShader(program, frag);
+    releaseGLObject(GL_OBJECT_SHADER, &vert);
+    releaseGLObject(GL_OBJECT_SHADER, &frag);
+
+    int rc;
+    glGetProgramiv(program, GL_LINK_STATUS, &rc);
+    if(rc != GL_TRUE) {
+        int len;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
+        char* msg = new char[len];
+        glGetProgramInfoLog(program, len, NULL, msg);
+        std::cerr << "Shader link error:\n" << msg << "\n";
+        delete[] msg;
+        releaseGLObject(GL_OBJECT_PROGRAM, &program);
+    }
+    return program;
+}
+
+// the cached program for the permutation, compiled and linked the first time it is asked
+// for, NULL if that fails. the pointer stays valid until the cache is deleted
+// ask for everything up front (Initialize does), a compile in the middle of Draw stalls
+inline const ShaderProgram* shaderProgram(ShaderCache* c, const ShaderFeatures& f) {
+    for(const ShaderProgram& p : c->programs) {
+        if(sameShaderFeatures(p.features, f)) return &p;
+    }
+
+    std::string header = shaderDefines(f) + c->lightingSource;
+    GLuint program = linkShaderProgram(injectDefines(c->vertexSource, header),
+        injectDefines(c->fragmentSource, header), "shader permutation");
+    if(!program) return NULL;
+
+    ShaderProgram p;
+    p.features = f;
+    p.program = program;
+    p.objectData = glGetUniformLocation(program, "ObjectData");
+    p.objectIndex = glGetUniformLocation(program, "ObjectIndex");
+    p.lightPositions = glGetUniformLocation(program, "LightPositions_cameraspace");
+    p.multisampled = glGetUniformLocation(program, "Multisampled");
+    c->programs.push_back(p);
+    return &c->programs.back();
+}
+
+inline void deleteShaderCache(ShaderCache* c) {
+    for(ShaderProgram& p : c->programs) releaseGLObject(GL_OBJECT_PROGRAM, &p.program);
+    c->programs.clear();
+}
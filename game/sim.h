@@ -0,0 +1,284 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#include "state.h"
+#include "levels.h"
+#include "collision.h"
+#include "scene.h"
+#include "threadpool.h"
+
+// the game's simulation with nothing global and no GL, so it can run any number of games
+// side by side. the game library runs one of these on the state in the launcher's block,
+// SimBatch runs thousands of them on the pool for playtesting and difficulty tuning
+
+struct SimInput {
+    bool left, right;
+};
+
+// everything a step reads or writes. the state and levels are pointers so the game can
+// keep its state in the launcher's block and a batch can keep all of its levels in one array
+struct Sim {
+    GameState* state;
+    LevelLayout* levels;
+    int numLevels;
+    PlatformGeometry platform;
+};
+
+// the step reports what happened through these, the game turns them into particles and
+// hides the broken platforms. a batch has no use for them
+struct NoSimEffects {
+    void bounce(glm::vec3) {}
+    void levelBroken(int, uint64_t) {}
+};
+
+// the state of a fresh game on a tower of the given height
+inline void resetSimState(GameState* s, int numLevels, const PlatformGeometry& g, int seed) {
+    *s = GameState();
+
+    // just above the top level
+    s->ballPosition = glm::vec3(0.f, numLevels * g.levelHeight + 1.f, 1.f);
+    s->ballVelocity = glm::vec3(0.f);
+    s->ballForce = glm::vec3(0.f, 10.f, 0.f);
+
+    s->cameraHeight = s->ballPosition.y;
+    s->randomSeed = seed;
+}
+
+// moves a ball through one step of dt seconds
+template<typename Fx>
+void simStepBall(const Sim& sim, glm::vec3* position, glm::vec3* velocity, glm::vec3* force, float dt, Fx& fx) {
+    float ballMass = 2.f;
+
+    *velocity += (*force / ballMass) * dt;
+    glm::vec3 motion = *velocity * dt;
+
+    *force += ballMass * glm::vec3(0.f, -9.8f, 0.f) * dt; // gravity
+
+    // sweep the ball along the whole step and stop it where it first touches something,
+    // instead of only looking at where it ends up, so a long step can't skip a platform
+    SweepHit hit;
+    bool collided = sweepBallAgainstLevels(*position, motion, BALL_RADIUS, sim.state->cylinderRotation,
+            sim.levels, sim.numLevels, sim.platform, &hit);
+
+    // the floor
+    float floorY = BALL_RADIUS;
+    if(motion.y < 0.f && position->y + motion.y < floorY) {
+        float t = std::max(0.f, (position->y - floorY) / -motion.y);
+        if(!collided || t < hit.t) {
+            hit.t = t;
+            hit.normal = glm::vec3(0.f, 1.f, 0.f);
+            collided = true;
+        }
+    }
+
+    *position += motion * (collided ? hit.t : 1.f);
+
+    if(collided) {
+        if(hit.normal.y > 0.f) {
+            // landed on top of something, let it bounce
+            *force = glm::vec3(0.f, 10.f, 0.f);
+            *velocity = glm::vec3(0.f);
+            fx.bounce(*position - hit.normal * BALL_RADIUS);
+        } else if(hit.normal.y < 0.f && velocity->y > 0.f) {
+            // bumped into the underside
+            velocity->y = 0.f;
+        }
+    }
+}
+
+// once the ball has fallen all the way through a level, the level breaks apart
+template<typename Fx>
+void simBreakPassedLevels(Sim& sim, Fx& fx) {
+    const PlatformGeometry& g = sim.platform;
+    for(int l=0; l<sim.numLevels; l++) {
+        if(sim.levels[l].solid == 0 || sim.state->ballPosition.y + BALL_RADIUS > l * g.levelHeight) continue;
+        fx.levelBroken(l, sim.levels[l].solid);
+        sim.levels[l].solid = 0;
+    }
+}
+
+template<typename Fx>
+void simStep(Sim& sim, SimInput input, float dt, Fx& fx) {
+    GameState* s = sim.state;
+
+    if(input.left) s->cylinderRotation -= .05f;
+    if(input.right) s->cylinderRotation += .05f;
+
+    simStepBall(sim, &s->ballPosition, &s->ballVelocity, &s->ballForce, dt, fx);
+    simBreakPassedLevels(sim, fx);
+
+    if(s->ballPosition.y <= s->cameraHeight - 1.f) {
+        // let camera follow the falling ball
+        s->cameraHeight = s->ballPosition.y + 1.f;
+    }
+}
+
+// batches
+
+// how a batch instance decides what to press
+enum SimPolicy {
+    POLICY_IDLE,   // never turns, only gets through where it happens to fall
+    POLICY_RANDOM, // holds a random direction (or nothing) for a random number of steps
+    POLICY_SEEK,   // turns the widest hole below it under the ball
+};
+
+// per instance bookkeeping next to the sim, kept small so a chunk of them stays in cache
+struct SimAgent {
+    SimPolicy policy;
+    uint32_t rng;
+    SimInput held;
+    int holdSteps;
+
+    uint32_t steps;
+    uint32_t bounces;
+    // steps taken when the ball reached the floor, 0 while it hasn't
+    uint32_t finishedAt;
+};
+
+// counts the bounces, everything else about the step is in the state
+struct SimAgentEffects {
+    SimAgent* agent;
+    void bounce(glm::vec3) { agent->bounces++; }
+    void levelBroken(int, uint64_t) {}
+};
+
+inline uint32_t simRandom(uint32_t* rng) {
+    // xorshift32
+    uint32_t x = *rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *rng = x;
+}
+
+// the ball's angle in the levels' frame, sections are laid out as in sweepBallAgainstLevels
+inline float simBallAngle(const Sim& sim) {
+    const glm::vec3& p = sim.state->ballPosition;
+    float c = std::cos(sim.state->cylinderRotation), s = std::sin(sim.state->cylinderRotation);
+    return std::atan2(s * p.x + c * p.z, c * p.x - s * p.z);
+}
+
+inline SimInput simPolicyInput(const Sim& sim, SimAgent* a) {
+    SimInput in = { false, false };
+    switch(a->policy) {
+    case POLICY_IDLE:
+        break;
+
+    case POLICY_RANDOM:
+        if(a->holdSteps <= 0) {
+            uint32_t r = simRandom(&a->rng);
+            a->held.left = r % 3 == 1;
+            a->held.right = r % 3 == 2;
+            a->holdSteps = 10 + (r >> 8) % 50;
+        }
+        a->holdSteps--;
+        in = a->held;
+        break;
+
+    case POLICY_SEEK: {
+        // the highest level that is still in the way
+        const PlatformGeometry& g = sim.platform;
+        int l = std::min(sim.numLevels - 1, (int)std::floor(sim.state->ballPosition.y / g.levelHeight));
+        while(l >= 0 && sim.levels[l].solid == 0) l--;
+        if(l < 0) break;
+
+        // aim for the middle of the widest hole, a narrow one may not let the ball through
+        uint64_t solid = sim.levels[l].solid;
+        int start = 0;
+        while(start < g.sections && !((solid >> start) & 1)) start++;
+        float delta = 2*PI / g.sections;
+        float angle = simBallAngle(sim);
+        float best = 0.f;
+        int widest = 0;
+        for(int i=0; i<g.sections; ) {
+            int first = (start + i) % g.sections;
+            if((solid >> first) & 1) {
+                i++;
+                continue;
+            }
+            int width = 0;
+            while(i < g.sections && !((solid >> ((start + i) % g.sections)) & 1)) {
+                width++;
+                i++;
+            }
+            // section i spans [-i delta, -(i-1) delta], so the hole runs from first's
+            // right edge down by width sections
+            float d = std::remainder(-(first + width / 2.f - 1.f) * delta - angle, 2*PI);
+            if(width > widest || (width == widest && std::fabs(d) < std::fabs(best))) {
+                widest = width;
+                best = d;
+            }
+        }
+        // turning right grows the ball's angle in the levels' frame
+        if(best > .05f) in.right = true;
+        else if(best < -.05f) in.left = true;
+        break;
+    }
+    }
+    return in;
+}
+
+struct SimBatch {
+    SceneConfig scene;
+    PlatformGeometry platform;
+    std::vector<Sim> sims;
+    std::vector<SimAgent> agents;
+    std::vector<GameState> states;
+    // scene.levels per instance, back to back
+    std::vector<LevelLayout> levels;
+};
+
+// n games, instance i is seeded with firstSeed + i and plays with policies[i % numPolicies]
+// accept is the filter the levels are generated with, pass the game's (playableLevelFilter)
+// to play the towers the game would build
+inline void initSimBatch(SimBatch* b, int n, const SceneConfig& scene, int firstSeed,
+                         const SimPolicy* policies, int numPolicies, const LevelFilter& accept = nullptr) {
+    b->scene = scene;
+    b->platform = platformGeometry;
+    b->platform.sections = scene.sections;
+
+    b->sims.resize(n);
+    b->agents.resize(n);
+    b->states.resize(n);
+    b->levels.resize((size_t)n * scene.levels);
+
+    for(int i=0; i<n; i++) {
+        int seed = firstSeed + i;
+        LevelLayout* levels = &b->levels[(size_t)i * scene.levels];
+        for(int l=0; l<scene.levels; l++) levels[l] = generateAcceptedLevel(seed, l, scene.sections, accept);
+        resetSimState(&b->states[i], scene.levels, b->platform, seed);
+
+        b->sims[i] = { &b->states[i], levels, scene.levels, b->platform };
+
+        SimAgent& a = b->agents[i];
+        a = SimAgent();
+        a.policy = policies[i % numPolicies];
+        a.rng = levelHash((uint32_t)seed) | 1;
+    }
+}
+
+// runs every unfinished instance for up to `steps` steps of dt seconds. a chunk of `grain`
+// instances is stepped one instance at a time, so each one stays in cache for all of its
+// steps, and parallelFor lets idle threads steal chunks from busy ones
+inline void stepSimBatch(SimBatch* b, ThreadPool* pool, int steps, float dt, size_t grain = 64) {
+    auto run = [b, steps, dt](size_t begin, size_t end) {
+        for(size_t i=begin; i<end; i++) {
+            Sim& sim = b->sims[i];
+            SimAgent* a = &b->agents[i];
+            SimAgentEffects fx = { a };
+            for(int s=0; s<steps && a->finishedAt == 0; s++) {
+                simStep(sim, simPolicyInput(sim, a), dt, fx);
+                a->steps++;
+                if(sim.state->ballPosition.y <= BALL_RADIUS + 1e-3f) a->finishedAt = a->steps;
+            }
+        }
+    };
+
+    if(pool) pool->parallelFor(b->sims.size(), grain, run);
+    else run(0, b->sims.size());
+}
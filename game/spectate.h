@@ -0,0 +1,343 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "state.h"
+
+// spectator / telemetry stream
+// after every Update the game sends one datagram over a unix socket (BOUNCY_SPECTATE=<path>)
+// with what changed in the state: the camera height, the cylinder's rotation, the ball's
+// position and velocity, and the levels that broke. values are quantized to fixed point
+// and sent as zigzag varint deltas against the previous packet, a frame of play is
+// usually around 15 bytes. every SPECTATE_KEYFRAME_INTERVAL packets, and after a packet
+// couldn't be sent, a keyframe carries everything (plus what the viewer needs to build
+// the same tower), so a viewer can join at any time and never drifts.
+// nothing here allocates, and the socket never blocks: with no viewer listening, or one
+// that fell behind, the packet is dropped
+// no GL in here, spectator/ and bench/ use it too
+
+#define SPECTATE_VERSION 1
+#define SPECTATE_MAX_PACKET 256
+// levels broken between two packets, more than that aren't reported (the viewer breaks
+// them anyway, they are below the ball)
+#define SPECTATE_MAX_EVENTS 32
+#define SPECTATE_KEYFRAME_INTERVAL 120
+
+// fixed point steps per unit
+#define SPECTATE_POSITION_SCALE 4096.f
+#define SPECTATE_VELOCITY_SCALE 1024.f
+
+#define SPECTATE_KEYFRAME 1
+
+// in the order they are written, bit i of a delta's mask says field i changed
+enum SpectateField {
+    SPECTATE_CAMERA_HEIGHT,
+    SPECTATE_ROTATION, // a full turn is 65536, so deltas wrap around
+    SPECTATE_POSITION_X,
+    SPECTATE_POSITION_Y,
+    SPECTATE_POSITION_Z,
+    SPECTATE_VELOCITY_X,
+    SPECTATE_VELOCITY_Y,
+    SPECTATE_VELOCITY_Z,
+    SPECTATE_FIELD_COUNT
+};
+
+// what the viewer builds the tower from, sent with every keyframe
+struct SpectateScene {
+    int32_t seed;
+    uint16_t levels;
+    uint8_t sections;
+    uint8_t lights;
+    uint8_t detail;
+};
+
+// one decoded packet
+struct SpectateFrame {
+    uint16_t sequence;
+    // the Update's delta t
+    uint16_t dtMs;
+    bool keyframe;
+    // only on keyframes
+    SpectateScene scene;
+    // the quantized state once the packet is applied
+    int32_t values[SPECTATE_FIELD_COUNT];
+    int numEvents;
+    uint16_t brokenLevels[SPECTATE_MAX_EVENTS];
+};
+
+struct SpectateEncoder {
+    bool open;
+    int fd;
+    sockaddr_un address;
+    SpectateScene scene;
+    // what the viewer has, the next delta is against these
+    int32_t sent[SPECTATE_FIELD_COUNT];
+    uint16_t sequence;
+    // a keyframe goes out once this reaches SPECTATE_KEYFRAME_INTERVAL
+    int sinceKeyframe;
+    int numEvents;
+    uint16_t events[SPECTATE_MAX_EVENTS];
+    uint8_t packet[SPECTATE_MAX_PACKET];
+
+    uint64_t packets, bytes, dropped;
+};
+
+struct SpectateDecoder {
+    // false until the first keyframe, and again after a lost packet
+    bool synced;
+    uint16_t sequence;
+    SpectateScene scene;
+    int32_t values[SPECTATE_FIELD_COUNT];
+
+    uint64_t packets, bytes, gaps;
+};
+
+inline int32_t quantizeSpectate(float v, float scale) {
+    return (int32_t)lrintf(v * scale);
+}
+
+inline void quantizeSpectateState(const GameState& s, int32_t* q) {
+    float turn = 2.f * (float)M_PI;
+    float r = s.cylinderRotation - turn * floorf(s.cylinderRotation / turn);
+
+    q[SPECTATE_CAMERA_HEIGHT] = quantizeSpectate(s.cameraHeight, SPECTATE_POSITION_SCALE);
+    q[SPECTATE_ROTATION] = (uint16_t)lrintf(r / turn * 65536.f);
+    for(int i=0; i<3; i++) {
+        q[SPECTATE_POSITION_X + i] = quantizeSpectate(s.ballPosition[i], SPECTATE_POSITION_SCALE);
+        q[SPECTATE_VELOCITY_X + i] = quantizeSpectate(s.ballVelocity[i], SPECTATE_VELOCITY_SCALE);
+    }
+}
+
+// writes the streamed fields, leaves the rest of the state alone. the rotation comes
+// back between 0 and a full turn
+inline void dequantizeSpectateState(const int32_t* q, GameState* s) {
+    s->cameraHeight = q[SPECTATE_CAMERA_HEIGHT] / SPECTATE_POSITION_SCALE;
+    s->cylinderRotation = q[SPECTATE_ROTATION] / 65536.f * 2.f * (float)M_PI;
+    for(int i=0; i<3; i++) {
+        s->ballPosition[i] = q[SPECTATE_POSITION_X + i] / SPECTATE_POSITION_SCALE;
+        s->ballVelocity[i] = q[SPECTATE_VELOCITY_X + i] / SPECTATE_VELOCITY_SCALE;
+    }
+}
+
+// varints
+
+inline uint8_t* putSpectateVarint(uint8_t* p, uint32_t v) {
+    while(v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+inline uint8_t* putSpectateSigned(uint8_t* p, int32_t v) {
+    return putSpectateVarint(p, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+// NULL once it runs past end
+inline const uint8_t* getSpectateVarint(const uint8_t* p, const uint8_t* end, uint32_t* v) {
+    *v = 0;
+    for(int shift=0; shift<35; shift+=7) {
+        if(p >= end) return NULL;
+        uint8_t b = *p++;
+        *v |= (uint32_t)(b & 0x7f) << shift;
+        if(!(b & 0x80)) return p;
+    }
+    return NULL;
+}
+
+inline const uint8_t* getSpectateSigned(const uint8_t* p, const uint8_t* end, int32_t* v) {
+    uint32_t u;
+    p = getSpectateVarint(p, end, &u);
+    *v = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+    return p;
+}
+
+// the difference between two quantized values as it goes over the wire
+inline int32_t spectateDelta(int field, int32_t from, int32_t to) {
+    if(field == SPECTATE_ROTATION) return (int16_t)(uint16_t)(to - from);
+    return to - from;
+}
+
+inline int32_t applySpectateDelta(int field, int32_t value, int32_t delta) {
+    if(field == SPECTATE_ROTATION) return (uint16_t)(value + delta);
+    return value + delta;
+}
+
+// encoding
+
+// the next packet is a keyframe
+inline void resetSpectateEncoder(SpectateEncoder* e, const SpectateScene& scene) {
+    e->scene = scene;
+    e->sinceKeyframe = SPECTATE_KEYFRAME_INTERVAL;
+    e->numEvents = 0;
+}
+
+inline void spectateLevelBroken(SpectateEncoder* e, int level) {
+    if(e->open && e->numEvents < SPECTATE_MAX_EVENTS) e->events[e->numEvents++] = (uint16_t)level;
+}
+
+// writes the packet for this state into e->packet, returns its size
+inline size_t encodeSpectateFrame(SpectateEncoder* e, const GameState& s, uint16_t dtMs) {
+    int32_t q[SPECTATE_FIELD_COUNT];
+    quantizeSpectateState(s, q);
+    bool keyframe = e->sinceKeyframe >= SPECTATE_KEYFRAME_INTERVAL;
+
+    uint8_t* p = e->packet;
+    *p++ = SPECTATE_VERSION;
+    *p++ = keyframe ? SPECTATE_KEYFRAME : 0;
+    memcpy(p, &e->sequence, 2);
+    memcpy(p + 2, &dtMs, 2);
+    p += 4;
+
+    if(keyframe) {
+        memcpy(p, &e->scene.seed, 4);
+        memcpy(p + 4, &e->scene.levels, 2);
+        p += 6;
+        *p++ = e->scene.sections;
+        *p++ = e->scene.lights;
+        *p++ = e->scene.detail;
+        for(int i=0; i<SPECTATE_FIELD_COUNT; i++) p = putSpectateSigned(p, q[i]);
+        e->sinceKeyframe = 0;
+    } else {
+        uint8_t* mask = p++;
+        *mask = 0;
+        for(int i=0; i<SPECTATE_FIELD_COUNT; i++) {
+            int32_t d = spectateDelta(i, e->sent[i], q[i]);
+            if(!d) continue;
+            *mask |= 1 << i;
+            p = putSpectateSigned(p, d);
+        }
+    }
+
+    p = putSpectateVarint(p, e->numEvents);
+    for(int i=0; i<e->numEvents; i++) p = putSpectateVarint(p, e->events[i]);
+    e->numEvents = 0;
+
+    memcpy(e->sent, q, sizeof(q));
+    e->sequence++;
+    e->sinceKeyframe++;
+    return p - e->packet;
+}
+
+// false if the packet is malformed, or a delta whose predecessor never arrived. the
+// decoder waits for the next keyframe then
+inline bool decodeSpectateFrame(SpectateDecoder* d, const uint8_t* data, size_t size, SpectateFrame* f) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    if(size < 6 || p[0] != SPECTATE_VERSION) return false;
+    f->keyframe = p[1] & SPECTATE_KEYFRAME;
+    memcpy(&f->sequence, p + 2, 2);
+    memcpy(&f->dtMs, p + 4, 2);
+    p += 6;
+
+    d->packets++;
+    d->bytes += size;
+    if(d->synced && f->sequence != (uint16_t)(d->sequence + 1)) {
+        d->gaps++;
+        d->synced = false;
+    }
+    if(!f->keyframe && !d->synced) return false;
+
+    int32_t values[SPECTATE_FIELD_COUNT];
+    if(f->keyframe) {
+        if(end - p < 9) return false;
+        memcpy(&f->scene.seed, p, 4);
+        memcpy(&f->scene.levels, p + 4, 2);
+        f->scene.sections = p[6];
+        f->scene.lights = p[7];
+        f->scene.detail = p[8];
+        p += 9;
+        for(int i=0; p && i<SPECTATE_FIELD_COUNT; i++) p = getSpectateSigned(p, end, &values[i]);
+    } else {
+        if(p >= end) return false;
+        uint8_t mask = *p++;
+        f->scene = d->scene;
+        for(int i=0; p && i<SPECTATE_FIELD_COUNT; i++) {
+            int32_t delta = 0;
+            if((mask >> i) & 1) p = getSpectateSigned(p, end, &delta);
+            values[i] = applySpectateDelta(i, d->values[i], delta);
+        }
+    }
+
+    uint32_t numEvents = 0;
+    if(p) p = getSpectateVarint(p, end, &numEvents);
+    if(!p || numEvents > SPECTATE_MAX_EVENTS) return false;
+    f->numEvents = numEvents;
+    for(int i=0; p && i<f->numEvents; i++) {
+        uint32_t level = 0;
+        p = getSpectateVarint(p, end, &level);
+        f->brokenLevels[i] = (uint16_t)level;
+    }
+    if(!p) return false;
+
+    d->synced = true;
+    d->sequence = f->sequence;
+    d->scene = f->scene;
+    memcpy(d->values, values, sizeof(values));
+    memcpy(f->values, values, sizeof(values));
+    return true;
+}
+
+// the socket
+
+inline bool spectateAddress(const char* path, sockaddr_un* a) {
+    memset(a, 0, sizeof(*a));
+    a->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(a->sun_path)) return false;
+    strcpy(a->sun_path, path);
+    return true;
+}
+
+// the game's end, sends to whoever is bound to path
+inline bool openSpectateEncoder(SpectateEncoder* e, const char* path, const SpectateScene& scene) {
+    *e = SpectateEncoder();
+    if(!spectateAddress(path, &e->address)) return false;
+    e->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if(e->fd < 0) return false;
+    fcntl(e->fd, F_SETFL, fcntl(e->fd, F_GETFL) | O_NONBLOCK);
+    e->open = true;
+    resetSpectateEncoder(e, scene);
+    return true;
+}
+
+inline void closeSpectateEncoder(SpectateEncoder* e) {
+    if(e->open) close(e->fd);
+    e->open = false;
+}
+
+// a packet that can't go out (nobody listening, or the viewer's queue is full) is
+// dropped, and the next one is a keyframe
+inline void sendSpectateFrame(SpectateEncoder* e, const GameState& s, uint16_t dtMs) {
+    if(!e->open) return;
+    size_t size = encodeSpectateFrame(e, s, dtMs);
+    ssize_t n = sendto(e->fd, e->packet, size, 0, (const sockaddr*)&e->address, sizeof(e->address));
+    if(n == (ssize_t)size) {
+        e->packets++;
+        e->bytes += size;
+    } else {
+        e->dropped++;
+        e->sinceKeyframe = SPECTATE_KEYFRAME_INTERVAL;
+    }
+}
+
+// the viewer's end, -1 if it can't be bound. replaces a socket a previous viewer left behind
+inline int bindSpectateSocket(const char* path) {
+    sockaddr_un a;
+    if(!spectateAddress(path, &a)) return -1;
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if(fd < 0) return -1;
+    unlink(path);
+    if(bind(fd, (const sockaddr*)&a, sizeof(a)) != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
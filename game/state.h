@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <glm/glm.hpp>
+
+// the persisted game state lives in a block owned by the launcher, which survives
+// reloading the game library. the block starts with a header describing the layout of
+// the GameState stored after it, so a rebuilt library with a different GameState can
+// map the old fields onto its own by name instead of misreading the bytes
+
+// to add a field, add it to this list. a renamed field comes back with its default
+// value, a field whose type changed can't be migrated and the game starts over
+#define GAME_STATE_FIELDS(X) \
+    X(float, cameraHeight) \
+    X(float, cylinderRotation) \
+    X(glm::vec3, ballPosition) \
+    X(glm::vec3, ballVelocity) \
+    X(glm::vec3, ballForce) \
+    X(int, randomSeed)
+
+struct GameState {
+#define X(type, name) type name;
+    GAME_STATE_FIELDS(X)
+#undef X
+};
+
+#define STATE_MAGIC 0x59434e42 // "BNCY" in memory
+// bump when StateHeader / StateField themselves change
+#define STATE_HEADER_VERSION 1
+#define STATE_MAX_FIELDS 64
+
+struct StateField {
+    char name[32];
+    char type[32];
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct StateHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t stateSize;
+    uint32_t numFields;
+    StateField fields[STATE_MAX_FIELDS];
+};
+
+// the state itself starts at a fixed offset after the header
+#define STATE_OFFSET ((sizeof(StateHeader) + 15) & ~(size_t)15)
+
+inline GameState* stateFromBlock(void* block) {
+    return (GameState*)((uint8_t*)block + STATE_OFFSET);
+}
+
+// describe the current GameState layout in the header
+inline void writeStateHeader(StateHeader* h) {
+    memset(h, 0, sizeof(StateHeader));
+    h->magic = STATE_MAGIC;
+    h->version = STATE_HEADER_VERSION;
+    h->stateSize = sizeof(GameState);
+
+#define X(type_, name_) { \
+        StateField* f = &h->fields[h->numFields++]; \
+        strncpy(f->name, #name_, sizeof(f->name) - 1); \
+        strncpy(f->type, #type_, sizeof(f->type) - 1); \
+        f->offset = offsetof(GameState, name_); \
+        f->size = sizeof(type_); \
+    }
+    GAME_STATE_FIELDS(X)
+#undef X
+}
+
+inline const StateField* findStateField(const StateHeader* h, const char* name) {
+    for(uint32_t i=0; i<h->numFields && i<STATE_MAX_FIELDS; i++) {
+        if(strncmp(h->fields[i].name, name, sizeof(h->fields[i].name)) == 0) return &h->fields[i];
+    }
+    return NULL;
+}
+
+// rewrites the state stored in the block (described by its header) into the current
+// layout. fields that don't exist in the old layout keep the values from `defaults`
+// returns false if the block can't be migrated: no header at all, an unknown header
+// version, or a field whose type changed
+inline bool migrateState(void* block, const GameState& defaults) {
+    StateHeader* h = (StateHeader*)block;
+    if(h->magic != STATE_MAGIC) {
+        std::cerr << "Persisted state has no layout header, starting over\n";
+        return false;
+    }
+    if(h->version != STATE_HEADER_VERSION || h->numFields > STATE_MAX_FIELDS) {
+        std::cerr << "Persisted state header version " << h->version << " is not supported, starting over\n";
+        return false;
+    }
+
+    const uint8_t* old = (const uint8_t*)stateFromBlock(block);
+    GameState migrated = defaults;
+    bool ok = true;
+
+#define X(type_, name_) { \
+        const StateField* f = findStateField(h, #name_); \
+        if(!f) { \
+            std::cerr << "State field " #name_ " is new, using its default\n"; \
+        } else if(f->size != sizeof(type_) || strncmp(f->type, #type_, sizeof(f->type)) != 0 || \
+                  f->offset + f->size > h->stateSize) { \
+            std::cerr << "State field " #name_ " changed from " << f->type << " to " #type_ "\n"; \
+            ok = false; \
+        } else { \
+            memcpy(&migrated.name_, old + f->offset, sizeof(type_)); \
+        } \
+    }
+    GAME_STATE_FIELDS(X)
+#undef X
+
+    if(!ok) {
+        std::cerr << "Persisted state can not be migrated, starting over\n";
+        return false;
+    }
+
+    // the old and new layouts may overlap, which is why this went through a copy
+    memcpy(stateFromBlock(block), &migrated, sizeof(GameState));
+    writeStateHeader(h);
+    return true;
+}
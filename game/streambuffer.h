@@ -0,0 +1,135 @@
+#pragma once
+
+// ring buffer for data that is rewritten every frame
+// the buffer is split into one region per frame in flight, each guarded by a fence, so
+// the cpu never writes into memory the gpu may still be reading. where GL 4.4 /
+// ARB_buffer_storage is available the whole thing is mapped once, persistently, and
+// written in place; elsewhere (osx tops out at 4.1) writes go to a staging copy which is
+// uploaded into an orphaned buffer at the end of the frame
+// shaders read it through a buffer texture (RGBA32F texels)
+
+#include <vector>
+#include <string.h>
+#include "registry.h"
+
+#define STREAM_MAX_REGIONS 4
+
+struct StreamBuffer {
+    GLuint buffer;
+    GLuint texture;
+
+    size_t regionSize;
+    int numRegions;
+    int region;
+
+    bool persistent;
+    uint8_t* mapped;
+    std::vector<uint8_t> staging;
+
+    GLsync fences[STREAM_MAX_REGIONS];
+};
+
+inline bool hasBufferStorage() {
+#ifdef GL_MAP_PERSISTENT_BIT
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if(major > 4 || (major == 4 && minor >= 4)) return true;
+
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for(GLint i=0; i<numExtensions; i++) {
+        const char* ext = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if(ext && strcmp(ext, "GL_ARB_buffer_storage") == 0) return true;
+    }
+#endif
+    return false;
+}
+
+// regionSize has to be a multiple of 16 (one texel)
+// owner tags its GL objects, see registry.h
+inline void createStreamBuffer(StreamBuffer* s, const char* owner, size_t regionSize, int numRegions) {
+    *s = {};
+    s->regionSize = regionSize;
+    s->persistent = hasBufferStorage();
+    s->numRegions = s->persistent ? numRegions : 1;
+
+    s->buffer = genBuffer(owner);
+    bindBuffer(GL_TEXTURE_BUFFER, s->buffer);
+    size_t size = regionSize * s->numRegions;
+
+#ifdef GL_MAP_PERSISTENT_BIT
+    if(s->persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_TEXTURE_BUFFER, size, NULL, flags);
+        s->mapped = (uint8_t*)glMapBufferRange(GL_TEXTURE_BUFFER, 0, size, flags);
+    }
+#endif
+    if(!s->mapped) {
+        s->persistent = false;
+        s->numRegions = 1;
+        size = regionSize;
+        // buffer storage is immutable, if mapping failed we need a fresh buffer object
+        releaseGLObject(GL_OBJECT_BUFFER, &s->buffer);
+        s->buffer = genBuffer(owner);
+        bindBuffer(GL_TEXTURE_BUFFER, s->buffer);
+        bufferData(GL_TEXTURE_BUFFER, size, NULL, GL_STREAM_DRAW);
+        s->staging.resize(size);
+    }
+
+    s->texture = genTexture(owner);
+    bindTexture(GL_TEXTURE_BUFFER, s->texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, s->buffer);
+    bindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+inline void deleteStreamBuffer(StreamBuffer* s) {
+    for(int i=0; i<STREAM_MAX_REGIONS; i++) {
+        if(s->fences[i]) deleteSync(s->fences[i]);
+    }
+    if(s->mapped) {
+        bindBuffer(GL_TEXTURE_BUFFER, s->buffer);
+        glUnmapBuffer(GL_TEXTURE_BUFFER);
+        bindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+    releaseGLObject(GL_OBJECT_TEXTURE, &s->texture);
+    releaseGLObject(GL_OBJECT_BUFFER, &s->buffer);
+    *s = {};
+}
+
+// where this frame's data goes, waits for the gpu if it is still using the region
+inline uint8_t* beginStreamFrame(StreamBuffer* s) {
+    if(!s->persistent) return &s->staging[0];
+
+    GLsync fence = s->fences[s->region];
+    if(fence) {
+        // only ever blocks if the gpu is numRegions frames behind
+        while(clientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+        deleteSync(fence);
+        s->fences[s->region] = 0;
+    }
+    return s->mapped + s->region * s->regionSize;
+}
+
+// index of this frame's first texel in the buffer texture
+inline int streamFrameTexel(const StreamBuffer* s) {
+    return s->region * s->regionSize / 16;
+}
+
+// call after writing and before drawing
+inline void endStreamFrame(StreamBuffer* s, size_t bytesWritten) {
+    if(s->persistent || bytesWritten == 0) return;
+
+    // orphan the old storage so we don't wait for draws still reading it
+    bindBuffer(GL_TEXTURE_BUFFER, s->buffer);
+    bufferData(GL_TEXTURE_BUFFER, s->regionSize, NULL, GL_STREAM_DRAW);
+    bufferSubData(GL_TEXTURE_BUFFER, 0, bytesWritten, &s->staging[0]);
+    bindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// call after the last draw reading this frame's region
+inline void fenceStreamFrame(StreamBuffer* s) {
+    if(!s->persistent) return;
+    s->fences[s->region] = fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    s->region = (s->region + 1) % s->numRegions;
+}
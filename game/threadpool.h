@@ -0,0 +1,221 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// a small work-stealing thread pool
+// submit() queues fire-and-forget tasks, each worker drains its own deque and steals
+// from the others when it runs dry. parallelFor() splits a range into one contiguous
+// slice per participant (the caller included) and lets idle participants steal the
+// back half of whatever slice has the most work left
+class ThreadPool {
+public:
+    // 0 threads means "one per core"
+    explicit ThreadPool(int numThreads = 0) {
+        if(numThreads <= 0) numThreads = std::thread::hardware_concurrency();
+        if(numThreads <= 0) numThreads = 1;
+
+        queues = std::vector<TaskQueue>(numThreads);
+        for(int i=0; i<numThreads; i++) {
+            workers.emplace_back([this, i]{ workerLoop(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for(auto& w : workers) w.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return (int)workers.size(); }
+
+    void submit(std::function<void()> task) {
+        size_t q = nextQueue++ % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[q].mutex);
+            queues[q].tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            pending++;
+        }
+        wakeup.notify_one();
+    }
+
+    // runs one queued task on the calling thread, false if there was none. for threads
+    // waiting on the pool's work, so they help instead of sleeping
+    bool runPendingTask() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            if(pending == 0) return false;
+            pending--;
+        }
+        // same as a worker: the pending count we took means a task is in some queue
+        std::function<void()> task;
+        while(!popTask(0, task)) std::this_thread::yield();
+        task();
+        return true;
+    }
+
+    // calls fn(begin, end) over [0, n) in chunks of at most grain items and blocks until
+    // everything is done. the calling thread does work as well, and while it waits for
+    // the helpers it runs queued tasks itself (its own helpers among them), so this is
+    // safe to call from inside a pool task even when every worker is doing the same
+    void parallelFor(size_t n, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+        if(n == 0) return;
+        if(grain == 0) grain = 1;
+
+        size_t participants = workers.size() + 1;
+        if(participants > (n + grain - 1) / grain) participants = (n + grain - 1) / grain;
+        if(participants <= 1) {
+            for(size_t b=0; b<n; b+=grain) fn(b, b+grain < n ? b+grain : n);
+            return;
+        }
+
+        std::vector<Range> ranges(participants);
+        for(size_t p=0; p<participants; p++) {
+            ranges[p].begin = n * p / participants;
+            ranges[p].end = n * (p+1) / participants;
+        }
+
+        // a participant leaves once there's nothing left to take, it never waits for the
+        // chunks others are still on. only the caller waits, for its helpers below
+        auto run = [&](size_t self) {
+            size_t b, e;
+            while(takeChunk(ranges, self, grain, b, e) || stealChunk(ranges, self, grain, b, e)) fn(b, e);
+        };
+
+        std::atomic<size_t> helpersLeft(participants - 1);
+        for(size_t p=1; p<participants; p++) {
+            submit([&, p]{
+                run(p);
+                // the last thing a helper touches on the caller's stack
+                helpersLeft.fetch_sub(1, std::memory_order_release);
+            });
+        }
+        run(0);
+
+        // every chunk is done once every helper has left, and the ranges live on this stack
+        // frame so we can't leave before that anyway. a helper still queued may have nobody
+        // else to run it (a nested call on a one worker pool, or every worker in one), so
+        // run queued tasks rather than sleep
+        while(helpersLeft.load(std::memory_order_acquire) > 0) {
+            if(!runPendingTask()) std::this_thread::yield();
+        }
+    }
+
+private:
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    struct Range {
+        std::mutex mutex;
+        size_t begin, end;
+    };
+
+    static bool takeChunk(std::vector<Range>& ranges, size_t self, size_t grain, size_t& b, size_t& e) {
+        Range& r = ranges[self];
+        std::lock_guard<std::mutex> lock(r.mutex);
+        if(r.begin >= r.end) return false;
+        b = r.begin;
+        e = r.end - r.begin > grain ? r.begin + grain : r.end;
+        r.begin = e;
+        return true;
+    }
+
+    // move the back half of the fullest other range into our own, then take from it
+    static bool stealChunk(std::vector<Range>& ranges, size_t self, size_t grain, size_t& b, size_t& e) {
+        size_t victim = self;
+        size_t most = 0;
+        for(size_t i=0; i<ranges.size(); i++) {
+            if(i == self) continue;
+            std::lock_guard<std::mutex> lock(ranges[i].mutex);
+            size_t left = ranges[i].end - ranges[i].begin;
+            if(ranges[i].begin < ranges[i].end && left > most) {
+                most = left;
+                victim = i;
+            }
+        }
+        if(victim == self) return false;
+
+        size_t sb, se;
+        {
+            std::lock_guard<std::mutex> lock(ranges[victim].mutex);
+            Range& v = ranges[victim];
+            if(v.begin >= v.end) return false;
+            size_t half = (v.end - v.begin) / 2;
+            // not worth splitting, just take one chunk off the back
+            if(half < grain) half = v.end - v.begin < grain ? v.end - v.begin : grain;
+            sb = v.end - half;
+            se = v.end;
+            v.end = sb;
+        }
+        {
+            std::lock_guard<std::mutex> lock(ranges[self].mutex);
+            ranges[self].begin = sb;
+            ranges[self].end = se;
+        }
+        return takeChunk(ranges, self, grain, b, e);
+    }
+
+    bool popTask(size_t self, std::function<void()>& task) {
+        // own queue from the back, everyone else's from the front
+        {
+            std::lock_guard<std::mutex> lock(queues[self].mutex);
+            if(!queues[self].tasks.empty()) {
+                task = std::move(queues[self].tasks.back());
+                queues[self].tasks.pop_back();
+                return true;
+            }
+        }
+        for(size_t i=1; i<queues.size(); i++) {
+            TaskQueue& q = queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if(!q.tasks.empty()) {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(size_t self) {
+        std::function<void()> task;
+        while(true) {
+            {
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                wakeup.wait(lock, [this]{ return stopping || pending > 0; });
+                if(pending == 0 && stopping) return;
+                pending--;
+            }
+            // a pending count guarantees there is a task somewhere, but another worker
+            // may be holding its queue lock right now
+            while(!popTask(self, task)) std::this_thread::yield();
+            task();
+            task = nullptr;
+        }
+    }
+
+    std::vector<TaskQueue> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextQueue{0};
+
+    std::mutex sleepMutex;
+    std::condition_variable wakeup;
+    size_t pending = 0;
+    bool stopping = false;
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#include "levels.h"
+#include "collision.h"
+#include "sim.h"
+
+// checks that a level can actually be played: that the ball fits through one of its holes,
+// and how long it takes to turn a hole under the ball at a given rotation speed
+//
+// the search is over the tower's angle (in VALIDATE_ANGLES buckets) and the ball's height
+// and velocity, which only ever follow two paths: falling in from the level above, and
+// bouncing off this one. both are measured once with the sim's own physics (simStepBall),
+// as is which angles the ball lands on a section at (the sweep, once per section). the
+// rotation only matters on the steps where the ball lands, and in s steps any angle within
+// s * rotationPerStep of the start can be reached. so the states reachable by the time the
+// ball lands are an arc around the entry angle. where that arc is all solid the whole arc
+// bounces, and it keeps growing by a bounce's worth of turning each time. the search for
+// every entry angle comes down to the distance from it to the nearest open angle, and a
+// level costs a few hundred operations
+
+#define VALIDATE_ANGLES 256
+
+// a lot more than anyone would put up with, the point is whether it can be done at all
+#define VALIDATE_MAX_BOUNCES 8
+
+// the step the game's levels are validated at. the tower turns a fixed amount per step but
+// the ball falls by the second, so a longer step leaves fewer turns per fall and the
+// slowest frame rate is the worst case, not the 60 fps the launcher usually runs at. 30 is
+// the lowest anyone should set the launcher's target fps to
+#define VALIDATE_GAME_DT (1.f / 30.f)
+
+struct LevelValidator {
+    PlatformGeometry platform;
+    float rotationPerStep;
+    // steps from dropping through the level above to landing on this one, and between two
+    // landings when bouncing
+    int entrySteps;
+    int bounceSteps;
+    // which angles the ball lands on section i at, as bits
+    std::vector<uint64_t> footprints;
+};
+
+struct LevelScore {
+    // the ball fits through the level at some angle
+    bool passable;
+    // of the angles the ball can come in at, how many get through within VALIDATE_MAX_BOUNCES
+    float reachable;
+    // bounces needed, averaged over the entry angles, VALIDATE_MAX_BOUNCES + 1 for the ones
+    // that don't make it. 0 means it can always be turned into a hole on the way down
+    float difficulty;
+    // how much of the ring lets the ball through
+    float open;
+};
+
+#define VALIDATE_WORDS (VALIDATE_ANGLES / 64)
+
+// steps until the ball lands on level 1 of a sim set up by the caller, -1 if it never does
+// the steps only start counting once the bottom of the ball is below leaveY
+inline int validateLandingSteps(Sim& sim, float dt, float leaveY) {
+    struct Landing {
+        bool landed;
+        void bounce(glm::vec3) { landed = true; }
+        void levelBroken(int, uint64_t) {}
+    } fx = { false };
+
+    GameState* s = sim.state;
+    int steps = 0;
+    for(int i=0; i<100000; i++) {
+        simStepBall(sim, &s->ballPosition, &s->ballVelocity, &s->ballForce, dt, fx);
+        if(s->ballPosition.y - BALL_RADIUS < leaveY) steps++;
+        if(fx.landed) return steps;
+    }
+    return -1;
+}
+
+// rotationPerStep is how far the tower turns per step with a direction held, the game's is
+// .05 (see simStep), lower it to ask for a more relaxed pace. dt is the step in seconds
+inline void initLevelValidator(LevelValidator* v, const PlatformGeometry& g, float dt, float rotationPerStep = .05f) {
+    v->platform = g;
+    v->rotationPerStep = rotationPerStep;
+
+    // the ball where the game puts it, levels 1 and 2 stand in for any pair of levels
+    GameState s;
+    resetSimState(&s, 3, g, 0);
+    LevelLayout levels[3] = {};
+    levels[1].solid = ~0ull;
+    Sim sim = { &s, levels, 3, g };
+    float top1 = g.levelHeight + g.thickness;
+    float top2 = 2*g.levelHeight + g.thickness;
+
+    // the ball falls through level 2 the moment it would have landed on it
+    s.ballPosition.y = top2 + BALL_RADIUS;
+    s.ballVelocity = glm::vec3(0.f);
+    s.ballForce = glm::vec3(0.f, 10.f, 0.f);
+    v->entrySteps = validateLandingSteps(sim, dt, top2);
+
+    // and from resting on level 1 back onto it
+    s.ballPosition.y = top1 + BALL_RADIUS;
+    s.ballVelocity = glm::vec3(0.f);
+    s.ballForce = glm::vec3(0.f, 10.f, 0.f);
+    v->bounceSteps = validateLandingSteps(sim, dt, INFINITY);
+
+    // a straight drop through the level at every angle, one section at a time
+    v->footprints.assign(g.sections * VALIDATE_WORDS, 0);
+    glm::vec3 p0(s.ballPosition.x, g.thickness + BALL_RADIUS + .5f, s.ballPosition.z);
+    glm::vec3 d(0.f, -(g.thickness + 2*BALL_RADIUS + 1.f), 0.f);
+    for(int i=0; i<g.sections; i++) {
+        LevelLayout one = {};
+        one.solid = 1ull << i;
+        for(int a=0; a<VALIDATE_ANGLES; a++) {
+            SweepHit hit;
+            float rotation = a * 2*PI / VALIDATE_ANGLES;
+            if(sweepBallAgainstLevels(p0, d, BALL_RADIUS, rotation, &one, 1, g, &hit)) {
+                v->footprints[i*VALIDATE_WORDS + a/64] |= 1ull << (a % 64);
+            }
+        }
+    }
+}
+
+inline LevelScore validateLevel(const LevelValidator& v, const LevelLayout& level) {
+    const PlatformGeometry& g = v.platform;
+    LevelScore score = { false, 0.f, VALIDATE_MAX_BOUNCES + 1.f, 0.f };
+
+    uint64_t blocked[VALIDATE_WORDS] = {};
+    for(int i=0; i<g.sections; i++) {
+        if(!((level.solid >> i) & 1)) continue;
+        for(int w=0; w<VALIDATE_WORDS; w++) blocked[w] |= v.footprints[i*VALIDATE_WORDS + w];
+    }
+    auto isOpen = [&](int a) { return !((blocked[a / 64] >> (a % 64)) & 1); };
+
+    // distance from every angle to the nearest open one, going around the ring twice in
+    // each direction so the wrap is covered
+    const int N = VALIDATE_ANGLES;
+    int dist[N];
+    int d = N;
+    for(int i=0; i<2*N; i++) {
+        d = isOpen(i % N) ? 0 : d + 1;
+        if(i >= N) dist[i % N] = d;
+    }
+    for(int i=2*N-1; i>=0; i--) {
+        d = isOpen(i % N) ? 0 : d + 1;
+        if(i < N && d < dist[i]) dist[i] = d;
+    }
+
+    int open = 0;
+    for(int a=0; a<N; a++) open += dist[a] == 0;
+    score.open = (float)open / N;
+    score.passable = open > 0;
+    if(!score.passable || v.entrySteps < 0 || v.bounceSteps < 0) return score;
+
+    // buckets the tower can turn in a given number of steps
+    float perStep = v.rotationPerStep / (2*PI / N);
+    auto reach = [&](int steps) { return (int)(steps * perStep); };
+
+    int reached = 0, bounces = 0;
+    for(int a=0; a<N; a++) {
+        int b = 0;
+        while(b <= VALIDATE_MAX_BOUNCES && dist[a] > reach(v.entrySteps + b * v.bounceSteps)) b++;
+        if(b <= VALIDATE_MAX_BOUNCES) reached++;
+        bounces += b;
+    }
+    score.reachable = (float)reached / N;
+    score.difficulty = (float)bounces / N;
+    return score;
+}
+
+// what the generator keeps: every way in gets through in the end
+inline bool levelPlayable(const LevelScore& s) {
+    return s.passable && s.reachable >= 1.f;
+}
+
+// the filter the game generates its levels with, v has to outlive it
+inline LevelFilter playableLevelFilter(const LevelValidator& v) {
+    return [&v](const LevelLayout& l) { return levelPlayable(validateLevel(v, l)); };
+}
+
+// scores n levels on the pool, chunks go to whichever thread is free
+inline void validateLevels(const LevelValidator& v, const LevelLayout* levels, size_t n,
+                           LevelScore* scores, ThreadPool* pool) {
+    auto run = [&](size_t begin, size_t end) {
+        for(size_t i=begin; i<end; i++) scores[i] = validateLevel(v, levels[i]);
+    };
+    if(pool) pool->parallelFor(n, 1024, run);
+    else run(0, n);
+}
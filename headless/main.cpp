@@ -0,0 +1,605 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <dlfcn.h>
+using namespace std;
+
+#define GL_GLEXT_PROTOTYPES 1
+#include <GL/glcorearb.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../launcher/alloc.h"
+#include "../launcher/postprocess.h"
+#include "../game/glstate.h"
+
+// runs the game without a window: creates an offscreen EGL context (works on mesa's
+// llvmpipe, so no gpu needed), renders a scripted session into an FBO and reports
+// frame times plus a hash of the final image
+//
+// usage: headless [-n frames] [-s script] [-w width] [-h height] [-m samples]
+//                 [-S seed] [-o out.ppm] [-j out.json] [-D budget_ms] [-A aa]
+//                 [-L levels] [-P sections] [-B balls] [-l lights] [-t detail] [-Q quality]
+//                 [-R renderer] <gamelib>
+// run it from the launcher directory, the game loads its shaders from the working dir
+//
+// a script is a list of "<frames> <dt_ms> [up|down|left|right|shift|a|q ...]" lines,
+// each line holds those keys for that many frames. without a script every frame is
+// 16ms with no input. the session loops if it is shorter than -n
+//
+// -L -P -B -l -t build a stress scene (see game/scene.h), -Q picks the shading quality
+// (low, medium, high, see game/shaders.h), -j writes the results as json so runs can be
+// compared across commits and scene sizes
+// -R software renders on the cpu (game/raster.h), so the image doesn't depend on the driver
+// -D draws through the launcher's dynamic resolution (launcher/resolution.h) with that
+// budget per frame, scaled up into the -w x -h target. -A does the same at a fixed scale
+// of 1 unless -D is given too, with the launcher's antialiasing (off, msaa2, msaa4, fxaa,
+// taa, see launcher/postprocess.h), and prints what each pass took. without -A the
+// offscreen path's antialiasing follows -m
+// BOUNCY_ALLOC_GUARD and BOUNCY_ALLOC_STATS work the same as in the launcher (alloc.h)
+// if the game exports FrameGLCalls (game/glstate.h), the GL calls its Draw made and the
+// redundant ones it dropped are reported per frame, by category
+
+struct KeyState {
+    // virtual game pad with 2 analogs, a d-pad and 16 "regular" buttons
+
+    float a1x, a1y;
+    float a2x, a2y;
+
+    union {
+        bool elements[4];
+        struct {
+            bool up, down, left, right;
+        };
+    } dirs;
+
+    bool buttons[16];
+};
+
+void* gamelib = NULL;
+int (*_Initialize)(bool, void*);
+void (*_Update)(KeyState, uint64_t);
+void (*_Draw)();
+void (*_Cleanup)();
+FrameCameraFunction _FrameCamera;
+FrameGLCallsFunction _FrameGLCalls;
+
+int LoadGamelib(const char* path) {
+    gamelib = dlopen(path, RTLD_NOW);
+    if(!gamelib) {
+        cerr << "Could not open the shared library " << path << ": " << dlerror() << "\n";
+        return 1;
+    }
+
+    _Initialize = (int (*)(bool, void*))dlsym(gamelib, "Initialize");
+    _Update = (void (*)(KeyState, uint64_t))dlsym(gamelib, "Update");
+    _Draw = (void (*)())dlsym(gamelib, "Draw");
+    _Cleanup = (void (*)())dlsym(gamelib, "Cleanup");
+    // optional
+    _FrameCamera = (FrameCameraFunction)dlsym(gamelib, "FrameCamera");
+    _FrameGLCalls = (FrameGLCallsFunction)dlsym(gamelib, "FrameGLCalls");
+
+    if(!_Initialize || !_Update || !_Draw || !_Cleanup) {
+        cerr << "Could not load functions from the shared library " << path << "\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+struct ScriptStep {
+    int frames;
+    uint64_t dt;
+    KeyState keys;
+};
+
+int LoadScript(const char* path, vector<ScriptStep>* steps) {
+    ifstream f(path);
+    if(!f.is_open()) {
+        cerr << "Could not open script " << path << "\n";
+        return 1;
+    }
+
+    string line;
+    int lineNo = 0;
+    while(getline(f, line)) {
+        lineNo++;
+        if(line.empty() || line[0] == '#') continue;
+
+        stringstream sstr(line);
+        ScriptStep s = {};
+        if(!(sstr >> s.frames >> s.dt) || s.frames <= 0) {
+            cerr << path << ":" << lineNo << ": expected <frames> <dt_ms> [keys]\n";
+            return 1;
+        }
+
+        string key;
+        while(sstr >> key) {
+            if(key == "up") s.keys.dirs.up = true;
+            else if(key == "down") s.keys.dirs.down = true;
+            else if(key == "left") s.keys.dirs.left = true;
+            else if(key == "right") s.keys.dirs.right = true;
+            else if(key == "shift") s.keys.buttons[0] = true;
+            else if(key == "a") s.keys.buttons[1] = true;
+            else if(key == "q") s.keys.buttons[2] = true;
+            else {
+                cerr << path << ":" << lineNo << ": unknown key " << key << "\n";
+                return 1;
+            }
+        }
+        steps->push_back(s);
+    }
+
+    if(steps->empty()) {
+        cerr << "Script " << path << " is empty\n";
+        return 1;
+    }
+    return 0;
+}
+
+EGLDisplay display;
+EGLContext context;
+EGLSurface surface = EGL_NO_SURFACE;
+
+int CreateContext() {
+    // prefer mesa's surfaceless platform, it does not need a display server at all
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    display = EGL_NO_DISPLAY;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    if(getPlatformDisplay) display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+#endif
+    if(display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if(!eglInitialize(display, &major, &minor)) {
+        cerr << "Could not initialize EGL (error 0x" << hex << eglGetError() << ")\n";
+        return 1;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+
+    EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config = NULL;
+    EGLint numConfigs = 0;
+    eglChooseConfig(display, configAttribs, &config, 1, &numConfigs);
+
+    EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    // without a pbuffer capable config fall back to a configless, surfaceless context
+    context = eglCreateContext(display, numConfigs ? config : (EGLConfig)0, EGL_NO_CONTEXT, contextAttribs);
+    if(context == EGL_NO_CONTEXT) {
+        cerr << "Could not create a GL 3.3 core context (error 0x" << hex << eglGetError() << ")\n";
+        return 1;
+    }
+
+    if(numConfigs) {
+        EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+    }
+    if(!eglMakeCurrent(display, surface, surface, context)) {
+        cerr << "Could not make the context current (error 0x" << hex << eglGetError() << ")\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+struct RenderTarget {
+    GLuint fbo, color, depth;
+    // single sampled copy of a multisampled target, what we read back from
+    GLuint resolveFbo, resolveColor;
+    int width, height, samples;
+};
+
+int CreateRenderTarget(RenderTarget* t, int width, int height, int samples) {
+    *t = { 0, 0, 0, 0, 0, width, height, samples };
+
+    glGenRenderbuffers(1, &t->color);
+    glBindRenderbuffer(GL_RENDERBUFFER, t->color);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &t->depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, t->depth);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, width, height);
+
+    glGenFramebuffers(1, &t->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, t->color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, t->depth);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        cerr << "Offscreen framebuffer is incomplete\n";
+        return 1;
+    }
+
+    if(samples > 0) {
+        glGenRenderbuffers(1, &t->resolveColor);
+        glBindRenderbuffer(GL_RENDERBUFFER, t->resolveColor);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glGenFramebuffers(1, &t->resolveFbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, t->resolveFbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, t->resolveColor);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            cerr << "Resolve framebuffer is incomplete\n";
+            return 1;
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+    glViewport(0, 0, width, height);
+    return 0;
+}
+
+void ReadBack(RenderTarget* t, vector<uint8_t>* pixels) {
+    GLuint src = t->fbo;
+    if(t->samples > 0) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, t->fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, t->resolveFbo);
+        glBlitFramebuffer(0, 0, t->width, t->height, 0, 0, t->width, t->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        src = t->resolveFbo;
+    }
+
+    pixels->resize(t->width * t->height * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, src);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, t->width, t->height, GL_RGBA, GL_UNSIGNED_BYTE, &(*pixels)[0]);
+    glBindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+}
+
+// 64 bit FNV-1a
+uint64_t HashPixels(const vector<uint8_t>& pixels) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for(uint8_t b : pixels) {
+        h ^= b;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+int WritePPM(const char* path, const vector<uint8_t>& pixels, int width, int height) {
+    ofstream f(path, ios::binary);
+    if(!f.is_open()) {
+        cerr << "Could not open " << path << " for writing\n";
+        return 1;
+    }
+
+    f << "P6\n" << width << " " << height << "\n255\n";
+    // gl rows go bottom to top
+    for(int y=height-1; y>=0; y--) {
+        for(int x=0; x<width; x++) {
+            f.write((const char*)&pixels[(y*width + x)*4], 3);
+        }
+    }
+    return 0;
+}
+
+struct Timing {
+    double mean, p50, p99, max;
+};
+
+// in milliseconds
+Timing Summarize(const vector<double>& seconds) {
+    vector<double> sorted = seconds;
+    sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+    double total = 0.0;
+    for(double t : sorted) total += t;
+    return { total / n * 1000.0, sorted[n / 2] * 1000.0,
+             sorted[min(n - 1, n * 99 / 100)] * 1000.0, sorted[n - 1] * 1000.0 };
+}
+
+void PrintTiming(const char* name, const Timing& t) {
+    printf("%-12s mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", name, t.mean, t.p50, t.p99, t.max);
+}
+
+string TimingJSON(const Timing& t) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "{ \"mean\": %.4f, \"p50\": %.4f, \"p99\": %.4f, \"max\": %.4f }",
+        t.mean, t.p50, t.p99, t.max);
+    return buf;
+}
+
+// per frame, by category
+string GLCallsJSON(const GLCallCounts& c, int frames) {
+    string out = "{ ";
+    char buf[128];
+    for(int i=0; i<GL_CALL_CATEGORY_COUNT; i++) {
+        snprintf(buf, sizeof(buf), "%s\"%s\": { \"made\": %.2f, \"dropped\": %.2f }", i ? ", " : "",
+            glCallCategoryNames[i], (double)c.made[i] / frames, (double)c.dropped[i] / frames);
+        out += buf;
+    }
+    return out + " }";
+}
+
+struct Scene {
+    const char* seed;
+    int levels, sections, balls, lights, detail;
+    const char* quality;
+    const char* renderer;
+};
+
+int WriteJSON(const char* path, const char* renderer, int frames, int width, int height, int samples,
+        const Scene& scene, double wall, const Timing& update, const Timing& draw, const Timing& frame,
+        const GLCallCounts* glCalls, uint64_t hash) {
+    ofstream f(path);
+    if(!f.is_open()) {
+        cerr << "Could not open " << path << " for writing\n";
+        return 1;
+    }
+
+    char hashStr[17];
+    snprintf(hashStr, sizeof(hashStr), "%016llx", (unsigned long long)hash);
+
+    // the renderer string comes from the driver, keep quotes and backslashes out of it
+    string r;
+    for(const char* c = renderer; *c; c++) r += (*c == '"' || *c == '\\') ? '_' : *c;
+
+    f << "{\n"
+      << "  \"renderer\": \"" << r << "\",\n"
+      << "  \"frames\": " << frames << ",\n"
+      << "  \"width\": " << width << ",\n"
+      << "  \"height\": " << height << ",\n"
+      << "  \"samples\": " << samples << ",\n"
+      << "  \"scene\": { \"seed\": \"" << scene.seed << "\", \"levels\": " << scene.levels
+      << ", \"sections\": " << scene.sections << ", \"balls\": " << scene.balls
+      << ", \"lights\": " << scene.lights << ", \"detail\": " << scene.detail
+      << ", \"quality\": \"" << scene.quality << "\", \"renderer\": \"" << scene.renderer << "\" },\n"
+      << "  \"wall_s\": " << wall << ",\n"
+      << "  \"fps\": " << frames / wall << ",\n"
+      << "  \"update_ms\": " << TimingJSON(update) << ",\n"
+      << "  \"draw_ms\": " << TimingJSON(draw) << ",\n"
+      << "  \"frame_ms\": " << TimingJSON(frame) << ",\n"
+      << "  \"allocs\": { \"steady_frames\": " << allocStats.steadyFrames
+      << ", \"frames_with_new\": " << allocStats.dirtyFrames << ", \"worst_frame\": " << allocStats.worstFrame << " },\n";
+    if(glCalls) f << "  \"gl_calls\": " << GLCallsJSON(*glCalls, frames) << ",\n";
+    f << "  \"framebuffer\": \"" << hashStr << "\"\n"
+      << "}\n";
+    return f.fail() ? 1 : 0;
+}
+
+double Seconds(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    initAllocTracking();
+
+    int numFrames = 600;
+    const char* scriptPath = NULL;
+    const char* outPath = NULL;
+    const char* jsonPath = NULL;
+    // the same as the game's defaults
+    Scene scene = { "1", 5, 32, 1, 10, 1, "high", "gl" };
+    int width = 800;
+    int height = 600;
+    int samples = 0;
+    double budgetMs = 0.0;
+    const char* aa = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:w:h:m:S:o:j:L:P:B:l:t:Q:R:D:A:")) != -1) {
+        switch(opt) {
+        case 'n': numFrames = atoi(optarg); break;
+        case 's': scriptPath = optarg; break;
+        case 'w': width = atoi(optarg); break;
+        case 'h': height = atoi(optarg); break;
+        case 'm': samples = atoi(optarg); break;
+        case 'S': scene.seed = optarg; break;
+        case 'o': outPath = optarg; break;
+        case 'j': jsonPath = optarg; break;
+        case 'L': scene.levels = atoi(optarg); break;
+        case 'P': scene.sections = atoi(optarg); break;
+        case 'B': scene.balls = atoi(optarg); break;
+        case 'l': scene.lights = atoi(optarg); break;
+        case 't': scene.detail = atoi(optarg); break;
+        case 'Q': scene.quality = optarg; break;
+        case 'R': scene.renderer = optarg; break;
+        case 'D': budgetMs = atof(optarg); break;
+        case 'A': aa = optarg; break;
+        default:
+            cerr << "usage: " << argv[0] << " [-n frames] [-s script] [-w width] [-h height]"
+                 << " [-m samples] [-S seed] [-o out.ppm] [-j out.json] [-D budget_ms] [-A aa]"
+                 << " [-L levels] [-P sections] [-B balls] [-l lights] [-t detail] [-Q quality] [-R renderer] <gamelib>\n";
+            return 1;
+        }
+    }
+    if(optind >= argc || numFrames <= 0 || width <= 0 || height <= 0) {
+        cerr << "usage: " << argv[0] << " [-n frames] [-s script] [-w width] [-h height]"
+             << " [-m samples] [-S seed] [-o out.ppm] [-j out.json] [-D budget_ms] [-A aa]"
+             << " [-L levels] [-P sections] [-B balls] [-l lights] [-t detail] [-Q quality] [-R renderer] <gamelib>\n";
+        return 1;
+    }
+    const char* libPath = argv[optind];
+
+    vector<ScriptStep> script;
+    int rc;
+    if(scriptPath) {
+        rc = LoadScript(scriptPath, &script);
+        if(rc) return rc;
+    } else {
+        script.push_back({ 1, 16, {} });
+    }
+
+    rc = CreateContext();
+    if(rc) return rc;
+    // through the launcher's offscreen framebuffer and post processing
+    bool offscreen = budgetMs > 0.0 || aa;
+    AAMode aaMode = samples >= 4 ? AA_MSAA4 : samples >= 2 ? AA_MSAA2 : AA_OFF;
+    if(aa) {
+        aaMode = parseAAMode(aa);
+        if(aaMode == AA_MODE_COUNT) {
+            cerr << "Unknown antialiasing " << aa << ", expected off, msaa2, msaa4, fxaa or taa\n";
+            return 1;
+        }
+    }
+
+    RenderTarget target;
+    DynamicResolution resolution = {};
+    PostProcess post = {};
+    rc = CreateRenderTarget(&target, width, height, offscreen ? 0 : samples);
+    if(rc) return rc;
+    if(offscreen) {
+        if(!initDynamicResolution(&resolution, width, height, 0, budgetMs)) return 1;
+        if(budgetMs <= 0.0) resolution.minScale = resolution.scale = resolution.maxScale = 1.f;
+        initPostProcess(&post, &resolution, aaMode);
+    }
+    double scaleTotal = 0.0;
+
+    rc = LoadGamelib(libPath);
+    if(rc) return rc;
+    allocGuardModule((void*)_Update);
+
+    // the game seeds its level generator from this on a fresh start
+    setenv("BOUNCY_SEED", scene.seed, 1);
+    // and builds its scene from these
+    setenv("BOUNCY_LEVELS", to_string(scene.levels).c_str(), 1);
+    setenv("BOUNCY_SECTIONS", to_string(scene.sections).c_str(), 1);
+    setenv("BOUNCY_BALLS", to_string(scene.balls).c_str(), 1);
+    setenv("BOUNCY_LIGHTS", to_string(scene.lights).c_str(), 1);
+    setenv("BOUNCY_DETAIL", to_string(scene.detail).c_str(), 1);
+    setenv("BOUNCY_QUALITY", scene.quality, 1);
+    setenv("BOUNCY_RENDERER", scene.renderer, 1);
+
+    void* gameState = (void*)(new uint8_t[1 << 27]);
+    memset(gameState, 0, 1 << 27);
+    {
+        AllocScope scope(ALLOC_RELOAD);
+        rc = _Initialize(false, gameState);
+        if(rc) return rc;
+    }
+
+    vector<double> updateTimes(numFrames), drawTimes(numFrames), cpuTimes(numFrames);
+    GLCallCounts glCalls = {};
+    size_t step = 0;
+    int stepFrame = 0;
+
+    double wallStart = Seconds(CLOCK_MONOTONIC);
+    for(int frame=0; frame<numFrames; frame++) {
+        const ScriptStep& s = script[step];
+
+        double cpuStart = Seconds(CLOCK_THREAD_CPUTIME_ID);
+        {
+            AllocScope scope(ALLOC_UPDATE);
+            _Update(s.keys, s.dt);
+        }
+        double drawStart = Seconds(CLOCK_THREAD_CPUTIME_ID);
+        {
+            AllocScope scope(ALLOC_DRAW);
+            if(offscreen) {
+                beginResolutionFrame(&resolution);
+                beginPostFrame(&post, &resolution, _FrameCamera);
+            }
+            _Draw();
+            if(offscreen) {
+                GLuint image = runPostProcess(&post, &resolution);
+                endResolutionFrame(&resolution, image, target.fbo);
+                endPostFrame(&post);
+                scaleTotal += resolution.scale;
+            }
+        }
+        {
+            AllocScope scope(ALLOC_PRESENT);
+            // keep the driver from queueing up unbounded work, the same way a swap would
+            glFlush();
+        }
+        double end = Seconds(CLOCK_THREAD_CPUTIME_ID);
+        endAllocFrame();
+        if(_FrameGLCalls) {
+            GLCallCounts c;
+            _FrameGLCalls(&c);
+            addGLCalls(&glCalls, c);
+        }
+        updateTimes[frame] = drawStart - cpuStart;
+        drawTimes[frame] = end - drawStart;
+        cpuTimes[frame] = end - cpuStart;
+
+        if(++stepFrame >= s.frames) {
+            stepFrame = 0;
+            step = (step + 1) % script.size();
+        }
+    }
+    glFinish();
+    double wall = Seconds(CLOCK_MONOTONIC) - wallStart;
+
+    vector<uint8_t> pixels;
+    ReadBack(&target, &pixels);
+    uint64_t hash = HashPixels(pixels);
+
+    if(outPath) {
+        rc = WritePPM(outPath, pixels, width, height);
+        if(rc) return rc;
+    }
+
+    Timing update = Summarize(updateTimes);
+    Timing draw = Summarize(drawTimes);
+    Timing cpu = Summarize(cpuTimes);
+    const char* renderer = (const char*)glGetString(GL_RENDERER);
+
+    printf("renderer     %s\n", renderer);
+    printf("frames       %d (%dx%d, %d samples)\n", numFrames, width, height, samples);
+    printf("scene        %d levels x %d sections, %d balls, %d lights, detail %d, %s quality, %s renderer\n",
+        scene.levels, scene.sections, scene.balls, scene.lights, scene.detail, scene.quality, scene.renderer);
+    printf("wall         %.3f s\n", wall);
+    printf("fps          %.1f\n", numFrames / wall);
+    PrintTiming("update", update);
+    PrintTiming("draw", draw);
+    PrintTiming("cpu/frame", cpu);
+    printf("allocs       new in update/draw in %llu of %llu frames after warm up, at most %llu in one\n",
+        (unsigned long long)allocStats.dirtyFrames, (unsigned long long)allocStats.steadyFrames,
+        (unsigned long long)allocStats.worstFrame);
+    if(_FrameGLCalls) {
+        printf("gl calls     ");
+        fflush(stdout);
+        printGLCalls(cout, glCalls, numFrames);
+    }
+    if(offscreen) {
+        printf("passes       ");
+        fflush(stdout);
+        printPostTimer(cout, &post);
+        printf("resolution   %dx%d at the end (scale %.2f, mean %.2f), %d changes, costs %.3f ms of %.3f ms\n",
+            resolution.width, resolution.height, resolution.scale, scaleTotal / numFrames,
+            resolution.changes, max(resolution.gpuMs, resolution.cpuMs), budgetMs);
+    }
+    printf("framebuffer  %016llx\n", (unsigned long long)hash);
+
+    if(jsonPath) {
+        rc = WriteJSON(jsonPath, renderer, numFrames, width, height, samples, scene, wall, update, draw, cpu,
+            _FrameGLCalls ? &glCalls : NULL, hash);
+        if(rc) return rc;
+    }
+
+    {
+        AllocScope scope(ALLOC_RELOAD);
+        _Cleanup();
+        dlclose(gamelib);
+    }
+    if(offscreen) {
+        deletePostProcess(&post);
+        deleteDynamicResolution(&resolution);
+    }
+    if(allocStats.report) printAllocStats(stderr);
+
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if(surface != EGL_NO_SURFACE) eglDestroySurface(display, surface);
+    eglDestroyContext(display, context);
+    eglTerminate(display);
+
+    return 0;
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <new>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+
+// allocation tracking
+// replaces the global operator new / delete, and on glibc malloc, calloc and realloc as
+// well. the game library's allocations end up in here too, so every allocation in the
+// process is counted against what the thread making it was busy with (see AllocScope).
+// the replacements are definitions, include this in exactly one file per program
+// BOUNCY_ALLOC_STATS=1 prints the counts on exit
+// BOUNCY_ALLOC_GUARD=<frames> aborts with a stack trace on any new inside Update or Draw
+// once that many frames went by since the game library was (re)loaded
+// only our own code is guarded: malloc isn't, and neither is a new the GL driver makes
+// (llvmpipe compiles shader variants in the middle of a draw call), that isn't ours to fix
+
+enum AllocSubsystem {
+    ALLOC_LAUNCHER, // the frame loop itself: events, reload checks, pacing
+    ALLOC_RELOAD,   // loading, initializing and cleaning up game libraries
+    ALLOC_UPDATE,
+    ALLOC_DRAW,
+    ALLOC_PRESENT,  // swapping buffers
+    ALLOC_THREADS,  // any other thread: the game's pool, the reloader, the profiler
+    ALLOC_SUBSYSTEM_COUNT
+};
+
+static const char* allocSubsystemNames[] = { "launcher", "reload", "update", "draw", "present", "threads" };
+
+enum AllocKind {
+    ALLOC_NEW,
+    ALLOC_MALLOC,
+    ALLOC_KIND_COUNT
+};
+
+// frames after a (re)load that may allocate when nothing else was asked for
+#define ALLOC_WARMUP_FRAMES 120
+
+struct AllocCounter {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> bytes;
+};
+
+struct AllocStats {
+    AllocCounter total[ALLOC_SUBSYSTEM_COUNT][ALLOC_KIND_COUNT];
+    // since the last endAllocFrame
+    AllocCounter frame[ALLOC_SUBSYSTEM_COUNT][ALLOC_KIND_COUNT];
+    // what the frame counters held when the last frame ended
+    uint64_t lastFrame[ALLOC_SUBSYSTEM_COUNT][ALLOC_KIND_COUNT];
+
+    bool report;
+    int warmupFrames;
+    bool guard;
+    std::atomic<bool> guardArmed;
+    // the modules whose allocations the guard is about, see allocGuardModule
+    const void* programBase;
+    std::atomic<const void*> libraryBase;
+
+    // frames since the library was (re)loaded
+    uint64_t frames;
+    // frames past the warm up, how many of them had new in Update or Draw, and the most
+    // a single one had
+    uint64_t steadyFrames;
+    uint64_t dirtyFrames;
+    uint64_t worstFrame;
+};
+
+// static storage, so it is all zero before the first allocation comes in
+static AllocStats allocStats;
+
+// threads start out as ALLOC_THREADS, the frame loop moves itself between the others
+static thread_local int allocSubsystem = ALLOC_THREADS;
+
+// everything allocated on this thread while it is alive goes to s
+struct AllocScope {
+    int saved;
+    explicit AllocScope(AllocSubsystem s) : saved(allocSubsystem) { allocSubsystem = s; }
+    ~AllocScope() { allocSubsystem = saved; }
+};
+
+// can't allocate itself, all of this runs with the allocator halfway through a call
+inline void allocGuardTripped(int subsystem, size_t size) {
+    allocStats.guardArmed.store(false, std::memory_order_relaxed);
+
+    char msg[160];
+    int n = snprintf(msg, sizeof(msg), "Allocation of %zu bytes in %s after %llu frames, stack:\n",
+        size, allocSubsystemNames[subsystem], (unsigned long long)allocStats.frames);
+    if(write(2, msg, n) < 0) {}
+
+    void* frames[64];
+    int depth = backtrace(frames, 64);
+    backtrace_symbols_fd(frames, depth, 2);
+    abort();
+}
+
+// whether the code asking for memory is ours: the first frame past the allocator hooks
+// and the c / c++ runtime has to be in the program or the game library
+inline bool allocFromOurCode() {
+    void* frames[32];
+    int depth = backtrace(frames, 32);
+    bool inHooks = true;
+    for(int i=0; i<depth; i++) {
+        Dl_info info;
+        if(!dladdr(frames[i], &info) || !info.dli_fname) return true;
+        if(inHooks && info.dli_fbase == allocStats.programBase) continue;
+        inHooks = false;
+
+        const char* name = strrchr(info.dli_fname, '/');
+        name = name ? name + 1 : info.dli_fname;
+        if(strncmp(name, "libstdc++", 9) == 0 || strncmp(name, "libc++", 6) == 0 ||
+           strncmp(name, "libc.", 5) == 0 || strncmp(name, "libgcc", 6) == 0 ||
+           strncmp(name, "libsystem", 9) == 0) {
+            continue;
+        }
+        return info.dli_fbase == allocStats.programBase ||
+               info.dli_fbase == allocStats.libraryBase.load(std::memory_order_relaxed);
+    }
+    return true;
+}
+
+inline void recordAllocation(AllocKind kind, size_t size) {
+    int s = allocSubsystem;
+    allocStats.total[s][kind].count.fetch_add(1, std::memory_order_relaxed);
+    allocStats.total[s][kind].bytes.fetch_add(size, std::memory_order_relaxed);
+    allocStats.frame[s][kind].count.fetch_add(1, std::memory_order_relaxed);
+    allocStats.frame[s][kind].bytes.fetch_add(size, std::memory_order_relaxed);
+
+    if(kind == ALLOC_NEW && (s == ALLOC_UPDATE || s == ALLOC_DRAW) &&
+       allocStats.guardArmed.load(std::memory_order_relaxed) && allocFromOurCode()) {
+        allocGuardTripped(s, size);
+    }
+}
+
+// call on the frame loop's thread before anything else
+inline void initAllocTracking() {
+    allocSubsystem = ALLOC_LAUNCHER;
+
+    const char* report = getenv("BOUNCY_ALLOC_STATS");
+    allocStats.report = report && *report && *report != '0';
+
+    const char* guard = getenv("BOUNCY_ALLOC_GUARD");
+    allocStats.guard = guard && *guard;
+    allocStats.warmupFrames = allocStats.guard ? atoi(guard) : ALLOC_WARMUP_FRAMES;
+    if(allocStats.warmupFrames < 0) allocStats.warmupFrames = 0;
+    Dl_info info;
+    if(dladdr((void*)&initAllocTracking, &info)) allocStats.programBase = info.dli_fbase;
+    if(allocStats.guard) {
+        // the first backtrace loads the unwinder, which allocates
+        void* warmup[4];
+        backtrace(warmup, 4);
+        fprintf(stderr, "Guarding against allocations in Update and Draw after %d frames\n", allocStats.warmupFrames);
+    }
+}
+
+// any function in the game library, so the guard knows its allocations from the driver's
+inline void allocGuardModule(const void* symbol) {
+    Dl_info info;
+    if(dladdr(symbol, &info)) allocStats.libraryBase.store(info.dli_fbase, std::memory_order_relaxed);
+}
+
+// a freshly loaded library gets to warm up again
+inline void resetAllocWarmup() {
+    allocStats.frames = 0;
+    allocStats.guardArmed.store(false, std::memory_order_relaxed);
+}
+
+// call once at the end of every frame
+inline void endAllocFrame() {
+    AllocStats& a = allocStats;
+    for(int s=0; s<ALLOC_SUBSYSTEM_COUNT; s++) {
+        for(int k=0; k<ALLOC_KIND_COUNT; k++) {
+            a.lastFrame[s][k] = a.frame[s][k].count.exchange(0, std::memory_order_relaxed);
+            a.frame[s][k].bytes.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    a.frames++;
+    if(a.frames > (uint64_t)a.warmupFrames) {
+        uint64_t hot = a.lastFrame[ALLOC_UPDATE][ALLOC_NEW] + a.lastFrame[ALLOC_DRAW][ALLOC_NEW];
+        a.steadyFrames++;
+        if(hot) a.dirtyFrames++;
+        if(hot > a.worstFrame) a.worstFrame = hot;
+    }
+    if(a.guard && a.frames >= (uint64_t)a.warmupFrames) a.guardArmed.store(true, std::memory_order_relaxed);
+}
+
+inline void printAllocStats(FILE* out) {
+    fprintf(out, "%-10s %12s %14s %12s %14s\n", "", "new", "new bytes", "malloc", "malloc bytes");
+    for(int s=0; s<ALLOC_SUBSYSTEM_COUNT; s++) {
+        const AllocCounter* c = allocStats.total[s];
+        fprintf(out, "%-10s %12llu %14llu %12llu %14llu\n", allocSubsystemNames[s],
+            (unsigned long long)c[ALLOC_NEW].count.load(), (unsigned long long)c[ALLOC_NEW].bytes.load(),
+            (unsigned long long)c[ALLOC_MALLOC].count.load(), (unsigned long long)c[ALLOC_MALLOC].bytes.load());
+    }
+    fprintf(out, "%llu frames after warm up, %llu with new in update or draw (at most %llu in one)\n",
+        (unsigned long long)allocStats.steadyFrames, (unsigned long long)allocStats.dirtyFrames,
+        (unsigned long long)allocStats.worstFrame);
+}
+
+// the replacements
+
+#if defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+
+void* malloc(size_t n) {
+    recordAllocation(ALLOC_MALLOC, n);
+    return __libc_malloc(n);
+}
+
+void* calloc(size_t n, size_t size) {
+    recordAllocation(ALLOC_MALLOC, n * size);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t n) {
+    recordAllocation(ALLOC_MALLOC, n);
+    return __libc_realloc(p, n);
+}
+}
+
+// new goes straight to glibc so it isn't counted twice
+#define ALLOC_RAW_MALLOC __libc_malloc
+#else
+#define ALLOC_RAW_MALLOC malloc
+#endif
+
+void* operator new(size_t n) {
+    recordAllocation(ALLOC_NEW, n);
+    void* p = ALLOC_RAW_MALLOC(n ? n : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t n) {
+    return operator new(n);
+}
+
+void* operator new(size_t n, const std::nothrow_t&) noexcept {
+    recordAllocation(ALLOC_NEW, n);
+    return ALLOC_RAW_MALLOC(n ? n : 1);
+}
+
+void* operator new[](size_t n, const std::nothrow_t& nt) noexcept {
+    return operator new(n, nt);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
@@ -1,6 +1,5 @@
 #include <iostream>
-#include <dlfcn.h>
-#include <sys/stat.h>
+#include <string>
 #include <SDL.h>
 #define GL_GLEXT_PROTOTYPES 1
 #include <SDL_opengl.h>
@@ -9,6 +8,13 @@ using namespace std;
 #include <stdio.h>
 #include <assert.h>
 
+#include "pacing.h"
+#include "resolution.h"
+#include "postprocess.h"
+#include "profiler.h"
+#include "alloc.h"
+#include "../game/glstate.h"
+
 struct KeyState {
     // virtual game pad with 2 analogs, a d-pad and 16 "regular" buttons
 
@@ -25,86 +31,153 @@ struct KeyState {
     bool buttons[16];
 };
 
-void* gamelib = NULL;
-int (*_Initialize)(bool, void*);
-void (*_Update)(KeyState, uint64_t);
-void (*_Draw)();
-void (*_Cleanup)();
+#include "reload.h"
 
-int ReloadGamelib(const char* path) {
-    if(gamelib) {
-        _Cleanup();
-        dlclose(gamelib);
-    }
+// the currently running game library
+GameLib game;
+// false while neither the old nor the new library could be initialized after a reload. the
+// game's state is cleaned up then, so Update and Draw are skipped until a reload succeeds
+bool gameInitialized;
+Reloader reloader;
+// NULL unless profiling was asked for
+Profiler* profiler;
+// the offscreen framebuffer the game draws into
+DynamicResolution resolution;
+// antialiasing and the passes between the game's Draw and the window
+PostProcess post;
 
-    gamelib = dlopen(path, 0);
-    if(!gamelib) {
-        cerr << "Could not open the shared library " << path << "\n";
-        return 1;
-    }
+// swaps a freshly loaded library in at a frame boundary
+// the old library stays loaded until the new one has initialized, if that fails the
+// old one is brought back and the session carries on as if nothing happened. if the old
+// one fails too the game is paused (gameInitialized) until a reload works
+void SwapGamelib(GameLib* next, bool reinit, void* gameState) {
+    AllocScope scope(ALLOC_RELOAD);
+    resetAllocWarmup();
+    if(gameInitialized) game.Cleanup();
+    gameInitialized = false;
 
-    _Initialize = (int (*)(bool, void*))dlsym(gamelib, "Initialize");
-    _Update = (void (*)(KeyState, uint64_t))dlsym(gamelib, "Update");
-    _Draw = (void (*)())dlsym(gamelib, "Draw");
-    _Cleanup = (void (*)())dlsym(gamelib, "Cleanup");
+    int rc = next->Initialize(reinit, gameState);
+    if(rc) {
+        cerr << "The new game library failed to initialize, keeping the old one\n";
+        next->Cleanup();
+        CollectProfile(profiler, true);
+        UnloadGamelib(next);
 
-    if(!_Initialize || !_Update || !_Draw || !_Cleanup) {
-        cerr << "Could not load functions from the shared library " << path << "\n";
-        return 1;
+        rc = game.Initialize(true, gameState);
+        if(rc) {
+            cerr << "The old game library failed to initialize again, pausing until a reload works\n";
+            game.Cleanup();
+            return;
+        }
+        gameInitialized = true;
+        return;
     }
 
-    return 0;
+    CollectProfile(profiler, true);
+    UnloadGamelib(&game);
+    game = *next;
+    gameInitialized = true;
+    allocGuardModule((void*)game.Update);
 }
 
 int main(int argc, char** argv) {
+    initAllocTracking();
     SDL_Init(SDL_INIT_VIDEO);
 
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 4);
+    // the window only gets the scaled up image, multisampling and depth are in the
+    // offscreen framebuffer (see resolution.h and postprocess.h)
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
-    SDL_GL_SetSwapInterval(1); // turn on vsync
+
+    // usage: launcher <gamelib> [vsync|adaptive|uncapped|<target fps>]
+    // BOUNCY_PROFILE=<file> writes a sampling profile there on exit, see profiler.h
+    // BOUNCY_ALLOC_STATS=1 and BOUNCY_ALLOC_GUARD=<frames> track allocations, see alloc.h
+    // BOUNCY_MIN_SCALE and BOUNCY_MAX_SCALE bound the resolution scale, see resolution.h
+    // BOUNCY_AA=off|msaa2|msaa4|fxaa|taa picks the antialiasing, see postprocess.h
+    PresentMode presentMode = PRESENT_VSYNC;
+    double targetFps = 60.0;
+    if(argc > 2 && !parsePresentMode(argv[2], &presentMode, &targetFps)) {
+        cerr << "Unknown present mode " << argv[2] << ", expected vsync, adaptive, uncapped or a frame rate\n";
+        return 1;
+    }
 
     SDL_Window* win = win = SDL_CreateWindow("sdl opengl thingy", 
         0, 0,
         800, 600, 
-        SDL_WINDOW_SHOWN | SDL_WINDOW_OPENGL );
+        SDL_WINDOW_SHOWN | SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI );
     assert(win);
 
     SDL_GLContext ctx = SDL_GL_CreateContext(win);
     SDL_GL_MakeCurrent(win, ctx);
 
-    int rc;
-    rc = ReloadGamelib(argv[1]);
-    if(rc) return rc;
+    // the swap interval only sticks once there is a context to apply it to
+    FramePacer pacer;
+    initFramePacer(&pacer, presentMode, targetFps);
+    updateRefreshRate(&pacer, win);
 
-    void* gameState = (void*)(new uint8_t[1 << 27]);
-    memset(gameState, 0, 1 << 27);
-    rc = _Initialize(false, gameState);
-    if(rc) return rc;
+    // in pixels, which on a high dpi display is more than the window's size
+    int drawableWidth, drawableHeight;
+    SDL_GL_GetDrawableSize(win, &drawableWidth, &drawableHeight);
+    if(!initDynamicResolution(&resolution, drawableWidth, drawableHeight, 4, .9 * framePeriodMs(&pacer))) return 1;
+    int lastWidth = resolution.width;
+
+    const char* aa = getenv("BOUNCY_AA");
+    AAMode aaMode = aa ? parseAAMode(aa) : AA_MSAA4;
+    if(aaMode == AA_MODE_COUNT) {
+        cerr << "Unknown antialiasing " << aa << ", expected off, msaa2, msaa4, fxaa or taa\n";
+        return 1;
+    }
+    initPostProcess(&post, &resolution, aaMode);
+    uint64_t lastPostReport = SDL_GetTicks64();
+    // the game's GL calls since the last report
+    GLCallCounts glCalls = {};
+    uint64_t glCallFrames = 0;
 
-    struct stat fileInfo;
-    stat(argv[1], &fileInfo);
-    // I think the m_timespec thing is osx-specific
-    time_t lastModified = fileInfo.st_mtimespec.tv_sec;
+    profiler = StartProfiler();
 
-    glViewport(0, 0, 800, 600);
+    int rc;
+    string error;
+    void* gameState;
+    {
+        AllocScope scope(ALLOC_RELOAD);
+        rc = LoadGamelib(argv[1], &game, &error);
+        if(rc) {
+            cerr << error << "\n";
+            return rc;
+        }
+        allocGuardModule((void*)game.Update);
+
+        gameState = (void*)(new uint8_t[1 << 27]);
+        memset(gameState, 0, 1 << 27);
+        rc = game.Initialize(false, gameState);
+        if(rc) return rc;
+        gameInitialized = true;
+    }
+
+    uint64_t lastModified = ModifiedTime(argv[1]);
+    // the compiler writes the library in pieces, only reload once it stopped changing
+    uint64_t changedAt = 0;
 
     KeyState keys = {};
     bool running = true;
     uint64_t ticks = SDL_GetTicks64();
 
     while(running) {
-        stat(argv[1], &fileInfo);
-        if(fileInfo.st_mtimespec.tv_sec > lastModified) {
-            rc = ReloadGamelib(argv[1]);
-            lastModified = fileInfo.st_mtimespec.tv_sec;
-            if(rc) return rc;
-            rc = _Initialize(true, gameState);
-            if(rc) return rc;
+        uint64_t modified = ModifiedTime(argv[1]);
+        if(modified != lastModified) {
+            lastModified = modified;
+            changedAt = SDL_GetTicks64();
+        } else if(changedAt && SDL_GetTicks64() - changedAt > 200) {
+            changedAt = 0;
+            StartReload(&reloader, argv[1], true);
+        }
+
+        GameLib next;
+        if(PollReload(&reloader, &next, &rc) && rc == 0) {
+            SwapGamelib(&next, reloader.reinit, gameState);
         }
 
         SDL_Event e;
@@ -114,6 +187,14 @@ int main(int argc, char** argv) {
         // display (due to triple buffering, I guess)
         while(SDL_PollEvent(&e)) {
             if(e.type == SDL_QUIT) running = false;
+            if(e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                SDL_GL_GetDrawableSize(win, &drawableWidth, &drawableHeight);
+                resizeDynamicResolution(&resolution, drawableWidth, drawableHeight);
+                updatePostTargets(&post, &resolution);
+            }
+            if(e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_MOVED) {
+                updateRefreshRate(&pacer, win);
+            }
 
             // TODO: Handle the case where the key was pressed and released more
             // than once within a single frame
@@ -143,17 +224,21 @@ int main(int argc, char** argv) {
 
                 case SDLK_l:
                     // force reload game
-                    rc = ReloadGamelib(argv[1]);
-                    if(rc) return rc;
-                    rc = _Initialize(true, gameState);
-                    if(rc) return rc;
+                    StartReload(&reloader, argv[1], true);
                     break;
                 case SDLK_r:
                     // force restart game
-                    rc = ReloadGamelib(argv[1]);
-                    if(rc) return rc;
-                    rc = _Initialize(false, gameState);
-                    if(rc) return rc;
+                    StartReload(&reloader, argv[1], false);
+                    break;
+                case SDLK_p:
+                    // cycle through the present modes
+                    setPresentMode(&pacer, (PresentMode)((pacer.requested + 1) % PRESENT_MODE_COUNT), 0.0);
+                    break;
+                case SDLK_m:
+                    // cycle through the antialiasing modes
+                    setAAMode(&post, &resolution, (AAMode)((post.mode + 1) % AA_MODE_COUNT));
+                    cout << "antialiasing: " << aaModeNames[post.mode] << "\n";
+                    lastPostReport = SDL_GetTicks64();
                     break;
                 }
             } else if(e.type == SDL_KEYUP) {
@@ -185,14 +270,65 @@ int main(int argc, char** argv) {
 
         // I'm not totally sure about it but the delta t calculation might not be the most accurate
         uint64_t newticks = SDL_GetTicks64();
-        _Update(keys, newticks - ticks);
+        if(gameInitialized) {
+            AllocScope scope(ALLOC_UPDATE);
+            game.Update(keys, newticks - ticks);
+        }
         ticks = newticks;
-        _Draw();
-        SDL_GL_SwapWindow(win);
+        {
+            AllocScope scope(ALLOC_DRAW);
+            // the gpu gets most of the frame, the rest is for the cpu side of it. uncapped
+            // has no frame rate to keep up, so no budget and full resolution
+            resolution.budgetMs = .9 * framePeriodMs(&pacer);
+            beginResolutionFrame(&resolution);
+            beginPostFrame(&post, &resolution, gameInitialized ? game.FrameCamera : NULL);
+            if(gameInitialized) game.Draw();
+        }
+        if(gameInitialized && game.FrameGLCalls) {
+            GLCallCounts c;
+            game.FrameGLCalls(&c);
+            addGLCalls(&glCalls, c);
+            glCallFrames++;
+        }
+        {
+            AllocScope scope(ALLOC_PRESENT);
+            GLuint image = runPostProcess(&post, &resolution);
+            endResolutionFrame(&resolution, image, 0);
+            endPostFrame(&post);
+            SDL_GL_SwapWindow(win);
+            paceFrame(&pacer);
+        }
+        if(resolution.width != lastWidth) {
+            lastWidth = resolution.width;
+            cout << "resolution: " << resolution.width << "x" << resolution.height << " of "
+                << resolution.windowWidth << "x" << resolution.windowHeight << "\n";
+        }
+        if(newticks - lastPostReport >= 5000) {
+            printPostTimer(cout, &post);
+            resetPostTimer(&post.timer);
+            if(glCallFrames) {
+                cout << "gl calls: ";
+                printGLCalls(cout, glCalls, glCallFrames);
+                glCalls = GLCallCounts();
+                glCallFrames = 0;
+            }
+            lastPostReport = newticks;
+        }
+        endAllocFrame();
     }
 
-    _Cleanup();
+    StopReloader(&reloader);
+    {
+        AllocScope scope(ALLOC_RELOAD);
+        if(gameInitialized) game.Cleanup();
+        // has to see the game's samples while it is still loaded
+        StopProfiler(profiler);
+        UnloadGamelib(&game);
+    }
+    if(allocStats.report) printAllocStats(stderr);
 
+    deletePostProcess(&post);
+    deleteDynamicResolution(&resolution);
     SDL_GL_DeleteContext(ctx);
     SDL_DestroyWindow(win);
     SDL_Quit();
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include <SDL.h>
+
+// how frames are handed to the display
+enum PresentMode {
+    // swap waits for the vertical blank
+    PRESENT_VSYNC,
+    // like vsync, but a late frame is swapped immediately (and tears) instead of
+    // waiting a whole extra refresh. falls back to vsync if the driver can't do it
+    PRESENT_ADAPTIVE,
+    // swap immediately, run as fast as possible
+    PRESENT_UNCAPPED,
+    // swap immediately, then sleep until the next frame deadline
+    PRESENT_TARGET_FPS,
+    PRESENT_MODE_COUNT
+};
+
+static const char* presentModeNames[] = { "vsync", "adaptive", "uncapped", "target-fps" };
+
+// running frame time statistics (welford's algorithm), reset every report
+struct FrameStats {
+    uint64_t count;
+    double mean, m2;
+    double min, max;
+};
+
+struct FramePacer {
+    // what was asked for and what we actually got (adaptive may fall back to vsync)
+    PresentMode requested;
+    PresentMode mode;
+    double targetFps;
+    // of the display the window is on, what vsync and adaptive swap at. 0 if unknown
+    int refreshRate;
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point deadline;
+    clock::time_point lastFrame;
+    clock::time_point lastReport;
+
+    FrameStats stats;
+};
+
+inline void resetFrameStats(FrameStats* s) {
+    *s = { 0, 0.0, 0.0, 1e9, 0.0 };
+}
+
+// needs a current GL context, the swap interval is a property of the context
+inline void setPresentMode(FramePacer* p, PresentMode mode, double targetFps) {
+    p->requested = p->mode = mode;
+    if(targetFps > 0.0) p->targetFps = targetFps;
+
+    int rc = 0;
+    switch(mode) {
+    case PRESENT_VSYNC:
+        rc = SDL_GL_SetSwapInterval(1);
+        break;
+    case PRESENT_ADAPTIVE:
+        if(SDL_GL_SetSwapInterval(-1) != 0) {
+            std::cerr << "Adaptive vsync is not supported, using regular vsync\n";
+            p->mode = PRESENT_VSYNC;
+            rc = SDL_GL_SetSwapInterval(1);
+        }
+        break;
+    case PRESENT_UNCAPPED:
+    case PRESENT_TARGET_FPS:
+        rc = SDL_GL_SetSwapInterval(0);
+        break;
+    default:
+        break;
+    }
+    if(rc != 0) std::cerr << "Could not set the swap interval: " << SDL_GetError() << "\n";
+
+    p->deadline = FramePacer::clock::now();
+    resetFrameStats(&p->stats);
+
+    std::cout << "present mode: " << presentModeNames[p->mode];
+    if(p->mode == PRESENT_TARGET_FPS) std::cout << " (" << p->targetFps << " fps)";
+    std::cout << "\n";
+}
+
+// call again when the window moves, it may have ended up on another display
+inline void updateRefreshRate(FramePacer* p, SDL_Window* win) {
+    SDL_DisplayMode m;
+    p->refreshRate = SDL_GetWindowDisplayMode(win, &m) == 0 ? m.refresh_rate : 0;
+}
+
+// how long a frame lasts at the rate the current mode runs at, 0 when uncapped
+inline double framePeriodMs(const FramePacer* p) {
+    switch(p->mode) {
+    case PRESENT_VSYNC:
+    case PRESENT_ADAPTIVE:
+        // SDL reports 0 when the driver doesn't say, most displays are 60 hz
+        return 1000.0 / (p->refreshRate > 0 ? p->refreshRate : 60);
+    case PRESENT_TARGET_FPS:
+        return 1000.0 / p->targetFps;
+    default:
+        return 0.0;
+    }
+}
+
+inline void initFramePacer(FramePacer* p, PresentMode mode, double targetFps) {
+    p->targetFps = 60.0;
+    p->refreshRate = 0;
+    p->lastFrame = p->lastReport = FramePacer::clock::now();
+    setPresentMode(p, mode, targetFps);
+}
+
+// parses "vsync", "adaptive", "uncapped" or a frame rate like "30"
+inline bool parsePresentMode(const char* s, PresentMode* mode, double* fps) {
+    for(int i=0; i<PRESENT_TARGET_FPS; i++) {
+        if(strcmp(s, presentModeNames[i]) == 0) {
+            *mode = (PresentMode)i;
+            return true;
+        }
+    }
+    char* end;
+    double f = strtod(s, &end);
+    if(end == s || *end != '\0' || f <= 0.0) return false;
+    *mode = PRESENT_TARGET_FPS;
+    *fps = f;
+    return true;
+}
+
+// call once per frame, right after the swap
+// in target fps mode this sleeps until the frame's deadline. the bulk of the wait is a
+// regular (high resolution) sleep and only the last bit is spent yielding, since
+// sleeps tend to overshoot by a fraction of a millisecond
+inline void paceFrame(FramePacer* p) {
+    typedef FramePacer::clock clock;
+
+    if(p->mode == PRESENT_TARGET_FPS) {
+        auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / p->targetFps));
+        const auto slack = std::chrono::microseconds(500);
+
+        p->deadline += period;
+        auto now = clock::now();
+        if(now > p->deadline + period) {
+            // we fell more than a frame behind, don't try to catch up with a burst of frames
+            p->deadline = now;
+        } else {
+            if(p->deadline - now > slack) std::this_thread::sleep_until(p->deadline - slack);
+            while(clock::now() < p->deadline) std::this_thread::yield();
+        }
+    }
+
+    auto now = clock::now();
+    double ms = std::chrono::duration<double, std::milli>(now - p->lastFrame).count();
+    p->lastFrame = now;
+
+    FrameStats* s = &p->stats;
+    s->count++;
+    double delta = ms - s->mean;
+    s->mean += delta / s->count;
+    s->m2 += delta * (ms - s->mean);
+    if(ms < s->min) s->min = ms;
+    if(ms > s->max) s->max = ms;
+
+    if(now - p->lastReport >= std::chrono::seconds(5)) {
+        double variance = s->count > 1 ? s->m2 / (s->count - 1) : 0.0;
+        std::cout << presentModeNames[p->mode] << ": " << s->count << " frames, "
+            << "mean " << s->mean << " ms, stddev " << sqrt(variance) << " ms, "
+            << "min " << s->min << " ms, max " << s->max << " ms\n";
+        resetFrameStats(s);
+        p->lastReport = now;
+    }
+}
@@ -0,0 +1,498 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <string.h>
+#include <stdlib.h>
+
+#include "resolution.h"
+
+// post processing between the game's Draw and the scaling into the window, and the
+// antialiasing that goes with it:
+//   off, msaa2, msaa4  the offscreen framebuffer's multisampling, no pass
+//   fxaa               single sampled, then an edge blur guided by the luma (fxaa 3.11's
+//                      "console" variant)
+//   taa                single sampled, the game's projection moves by a fraction of a pixel
+//                      every frame (halton 2, 3) and the frames are blended into a history.
+//                      the history is reprojected with the camera's previous view projection
+//                      and clamped to the current frame's neighbourhood, which keeps moving
+//                      things (the ball) from smearing
+// msaa multiplies the fill and depth work of the whole frame, the fragment shader's light
+// loop included, fxaa and taa cost one full screen pass at the render size instead
+// every pass is timed on the gpu (timestamp queries, read a few frames late) and the cpu
+// BOUNCY_AA=<mode> picks the mode at startup, default msaa4
+// needs the GL headers included before this
+
+enum AAMode {
+    AA_OFF,
+    AA_MSAA2,
+    AA_MSAA4,
+    AA_FXAA,
+    AA_TAA,
+    AA_MODE_COUNT
+};
+
+static const char* aaModeNames[] = { "off", "msaa2", "msaa4", "fxaa", "taa" };
+
+enum PostPass {
+    PASS_SCENE,   // the game's Draw
+    PASS_RESOLVE, // multisampled or not, into textures the passes can read
+    PASS_AA,      // fxaa or taa
+    PASS_UPSCALE, // into the window
+    PASS_COUNT
+};
+
+static const char* postPassNames[] = { "scene", "resolve", "aa", "upscale" };
+
+// frames of timestamps in flight
+#define POST_TIMER_FRAMES 4
+// the share of the history in a taa frame
+#define TAA_HISTORY_WEIGHT .9f
+#define TAA_JITTER_SAMPLES 8
+
+// a game may export this: jitter (in clip space) moves its next Draw's projection, and it
+// writes the unjittered view projection it will draw with, and its inverse (column major)
+typedef void (*FrameCameraFunction)(float jitterX, float jitterY, float* viewProjection, float* inverseViewProjection);
+
+struct PostTimer {
+    // one timestamp when the frame starts, then one at the end of every pass
+    GLuint queries[POST_TIMER_FRAMES][PASS_COUNT + 1];
+    uint64_t frame;
+    std::chrono::steady_clock::time_point last;
+    // totals since the last resetPostTimer, gpu ones only count frames whose results came in
+    double gpuMs[PASS_COUNT], cpuMs[PASS_COUNT];
+    uint64_t gpuFrames, cpuFrames;
+};
+
+struct PostProcess {
+    AAMode mode;
+
+    GLuint vao;
+    GLuint fxaaProgram, taaProgram;
+    struct {
+        GLint color, regionScale, uvMax, texelSize;
+    } fxaa;
+    struct {
+        GLint color, depth, history, regionScale, uvMax, texelSize;
+        GLint jitter, historyWeight, inverseViewProjection, prevViewProjection;
+    } taa;
+
+    // fxaa's output, or taa's history and the frame being written, at the resolution's
+    // allocated size
+    GLuint targets[2], fbos[2];
+    int allocWidth, allocHeight;
+    int current;
+
+    // taa
+    bool historyValid;
+    int historyWidth, historyHeight;
+    float jitter[2];
+    float viewProjection[16], inverseViewProjection[16], prevViewProjection[16];
+    bool haveCamera;
+    uint64_t frame;
+
+    PostTimer timer;
+};
+
+// shaders
+
+static const char* postVertexShader = R"(#version 330 core
+// a triangle covering the screen, uv covers the part of the textures in use
+uniform vec2 RegionScale;
+out vec2 uv;
+void main() {
+    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    uv = p * RegionScale;
+    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+static const char* fxaaFragmentShader = R"(#version 330 core
+uniform sampler2D Color;
+uniform vec2 RegionScale;
+// the last texel center in use, nothing past it was drawn this frame
+uniform vec2 UVMax;
+uniform vec2 TexelSize;
+in vec2 uv;
+out vec4 color;
+
+#define SPAN_MAX 8.0
+#define REDUCE_MUL (1.0 / 8.0)
+#define REDUCE_MIN (1.0 / 128.0)
+
+vec3 fetch(vec2 p) { return texture(Color, clamp(p, TexelSize * 0.5, UVMax)).rgb; }
+float luma(vec3 c) { return dot(c, vec3(0.299, 0.587, 0.114)); }
+
+void main() {
+    vec3 m = fetch(uv);
+    float lumaNW = luma(fetch(uv + vec2(-1.0, -1.0) * TexelSize));
+    float lumaNE = luma(fetch(uv + vec2(1.0, -1.0) * TexelSize));
+    float lumaSW = luma(fetch(uv + vec2(-1.0, 1.0) * TexelSize));
+    float lumaSE = luma(fetch(uv + vec2(1.0, 1.0) * TexelSize));
+    float lumaM = luma(m);
+    float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+    float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+
+    // blur along the edge, across the gradient
+    vec2 dir = vec2(-((lumaNW + lumaNE) - (lumaSW + lumaSE)), (lumaNW + lumaSW) - (lumaNE + lumaSE));
+    float reduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * 0.25 * REDUCE_MUL, REDUCE_MIN);
+    float scale = 1.0 / (min(abs(dir.x), abs(dir.y)) + reduce);
+    dir = clamp(dir * scale, vec2(-SPAN_MAX), vec2(SPAN_MAX)) * TexelSize;
+
+    vec3 a = 0.5 * (fetch(uv + dir * (1.0 / 3.0 - 0.5)) + fetch(uv + dir * (2.0 / 3.0 - 0.5)));
+    vec3 b = a * 0.5 + 0.25 * (fetch(uv - dir * 0.5) + fetch(uv + dir * 0.5));
+    // the wider blur went across another edge
+    float lumaB = luma(b);
+    color = vec4(lumaB < lumaMin || lumaB > lumaMax ? a : b, 1.0);
+}
+)";
+
+static const char* taaFragmentShader = R"(#version 330 core
+uniform sampler2D Color;
+uniform sampler2D Depth;
+uniform sampler2D History;
+uniform vec2 RegionScale;
+uniform vec2 UVMax;
+uniform vec2 TexelSize;
+// this frame's offset in clip space, the reprojection undoes it
+uniform vec2 Jitter;
+// 0 when there is no usable history
+uniform float HistoryWeight;
+uniform mat4 InverseViewProjection;
+uniform mat4 PrevViewProjection;
+in vec2 uv;
+out vec4 color;
+
+void main() {
+    vec3 current = texture(Color, uv).rgb;
+
+    // what the history may be, the range of the pixel's neighbourhood this frame
+    vec3 lo = current, hi = current;
+    for(int y=-1; y<=1; y++) {
+        for(int x=-1; x<=1; x++) {
+            vec3 c = texture(Color, clamp(uv + vec2(x, y) * TexelSize, TexelSize * 0.5, UVMax)).rgb;
+            lo = min(lo, c);
+            hi = max(hi, c);
+        }
+    }
+
+    // where the surface seen through this pixel was on screen last frame
+    float depth = texture(Depth, uv).r;
+    vec2 ndc = uv / RegionScale * 2.0 - 1.0 - Jitter;
+    vec4 world = InverseViewProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    vec4 prev = PrevViewProjection * vec4(world.xyz / world.w, 1.0);
+    vec2 prevUV = prev.xy / prev.w * 0.5 + 0.5;
+
+    if(HistoryWeight == 0.0 || any(lessThan(prevUV, vec2(0.0))) || any(greaterThan(prevUV, vec2(1.0)))) {
+        // off screen last frame, or there was no last frame (and prevUV may be nan)
+        color = vec4(current, 1.0);
+        return;
+    }
+    vec3 history = clamp(texture(History, clamp(prevUV * RegionScale, TexelSize * 0.5, UVMax)).rgb, lo, hi);
+    color = vec4(mix(current, history, HistoryWeight), 1.0);
+}
+)";
+
+inline GLuint compilePostShader(GLenum type, const char* src, const char* name) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+
+    GLint rc;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &rc);
+    if(rc != GL_TRUE) {
+        char msg[2048];
+        glGetShaderInfoLog(shader, sizeof(msg), NULL, msg);
+        std::cerr << "The " << name << " shader doesn't compile:\n" << msg << "\n";
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+inline GLuint linkPostProgram(const char* fragmentSrc, const char* name) {
+    GLuint vert = compilePostShader(GL_VERTEX_SHADER, postVertexShader, name);
+    GLuint frag = compilePostShader(GL_FRAGMENT_SHADER, fragmentSrc, name);
+    if(!vert || !frag) {
+        glDeleteShader(vert);
+        glDeleteShader(frag);
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vert);
+    glAttachShader(program, frag);
+    glLinkProgram(program);
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+
+    GLint rc;
+    glGetProgramiv(program, GL_LINK_STATUS, &rc);
+    if(rc != GL_TRUE) {
+        char msg[2048];
+        glGetProgramInfoLog(program, sizeof(msg), NULL, msg);
+        std::cerr << "The " << name << " program doesn't link:\n" << msg << "\n";
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+// timing
+
+inline void resetPostTimer(PostTimer* t) {
+    for(int i=0; i<PASS_COUNT; i++) t->gpuMs[i] = t->cpuMs[i] = 0.0;
+    t->gpuFrames = t->cpuFrames = 0;
+}
+
+// the frame's first timestamp, and the results of the frame that used these queries last
+inline void beginPostTimer(PostTimer* t) {
+    GLuint* q = t->queries[t->frame % POST_TIMER_FRAMES];
+    if(t->frame >= POST_TIMER_FRAMES) {
+        GLint available = 0;
+        glGetQueryObjectiv(q[PASS_COUNT], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available) {
+            GLuint64 stamps[PASS_COUNT + 1];
+            for(int i=0; i<=PASS_COUNT; i++) glGetQueryObjectui64v(q[i], GL_QUERY_RESULT, &stamps[i]);
+            for(int i=0; i<PASS_COUNT; i++) t->gpuMs[i] += (stamps[i+1] - stamps[i]) / 1e6;
+            t->gpuFrames++;
+        }
+    }
+    glQueryCounter(q[0], GL_TIMESTAMP);
+    t->last = std::chrono::steady_clock::now();
+}
+
+// passes end in order, one that didn't run this frame still ends (and takes no time)
+inline void endPostPass(PostTimer* t, PostPass pass) {
+    glQueryCounter(t->queries[t->frame % POST_TIMER_FRAMES][pass + 1], GL_TIMESTAMP);
+    auto now = std::chrono::steady_clock::now();
+    t->cpuMs[pass] += std::chrono::duration<double, std::milli>(now - t->last).count();
+    t->last = now;
+    if(pass == PASS_COUNT - 1) {
+        t->cpuFrames++;
+        t->frame++;
+    }
+}
+
+// mean time per pass since the last reset, one line
+inline void printPostTimer(std::ostream& out, const PostProcess* p) {
+    const PostTimer* t = &p->timer;
+    out << "aa " << aaModeNames[p->mode] << ", ms per frame gpu / cpu:";
+    for(int i=0; i<PASS_COUNT; i++) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), " %s %.3f / %.3f", postPassNames[i],
+            t->gpuFrames ? t->gpuMs[i] / t->gpuFrames : 0.0, t->cpuFrames ? t->cpuMs[i] / t->cpuFrames : 0.0);
+        out << buf;
+    }
+    out << "\n";
+}
+
+// targets
+
+inline void deletePostTargets(PostProcess* p) {
+    glDeleteFramebuffers(2, p->fbos);
+    glDeleteTextures(2, p->targets);
+    p->fbos[0] = p->fbos[1] = p->targets[0] = p->targets[1] = 0;
+    p->allocWidth = p->allocHeight = 0;
+    p->historyValid = false;
+}
+
+// follows the resolution's allocation, only fxaa and taa have any
+inline void updatePostTargets(PostProcess* p, const DynamicResolution* r) {
+    bool wanted = p->mode == AA_FXAA || p->mode == AA_TAA;
+    if(!wanted) {
+        if(p->targets[0]) deletePostTargets(p);
+        return;
+    }
+    if(p->targets[0] && p->allocWidth == r->allocWidth && p->allocHeight == r->allocHeight) return;
+
+    deletePostTargets(p);
+    p->allocWidth = r->allocWidth;
+    p->allocHeight = r->allocHeight;
+    glGenTextures(2, p->targets);
+    glGenFramebuffers(2, p->fbos);
+    for(int i=0; i<2; i++) {
+        glBindTexture(GL_TEXTURE_2D, p->targets[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, p->allocWidth, p->allocHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindFramebuffer(GL_FRAMEBUFFER, p->fbos[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, p->targets[i], 0);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// the mode named s, AA_MODE_COUNT if there is none
+inline AAMode parseAAMode(const char* s) {
+    for(int i=0; i<AA_MODE_COUNT; i++) {
+        if(strcmp(s, aaModeNames[i]) == 0) return (AAMode)i;
+    }
+    return AA_MODE_COUNT;
+}
+
+inline void setAAMode(PostProcess* p, DynamicResolution* r, AAMode mode) {
+    // the programs failed to build, msaa it is
+    if((mode == AA_FXAA && !p->fxaaProgram) || (mode == AA_TAA && !p->taaProgram)) mode = AA_MSAA4;
+    p->mode = mode;
+    setResolutionSamples(r, mode == AA_MSAA2 ? 2 : mode == AA_MSAA4 ? 4 : 0);
+    updatePostTargets(p, r);
+    p->historyValid = false;
+    resetPostTimer(&p->timer);
+}
+
+inline void initPostProcess(PostProcess* p, DynamicResolution* r, AAMode mode) {
+    *p = {};
+    glGenVertexArrays(1, &p->vao);
+    glGenQueries(POST_TIMER_FRAMES * (PASS_COUNT + 1), &p->timer.queries[0][0]);
+
+    p->fxaaProgram = linkPostProgram(fxaaFragmentShader, "fxaa");
+    if(p->fxaaProgram) {
+        p->fxaa.color = glGetUniformLocation(p->fxaaProgram, "Color");
+        p->fxaa.regionScale = glGetUniformLocation(p->fxaaProgram, "RegionScale");
+        p->fxaa.uvMax = glGetUniformLocation(p->fxaaProgram, "UVMax");
+        p->fxaa.texelSize = glGetUniformLocation(p->fxaaProgram, "TexelSize");
+    }
+    p->taaProgram = linkPostProgram(taaFragmentShader, "taa");
+    if(p->taaProgram) {
+        p->taa.color = glGetUniformLocation(p->taaProgram, "Color");
+        p->taa.depth = glGetUniformLocation(p->taaProgram, "Depth");
+        p->taa.history = glGetUniformLocation(p->taaProgram, "History");
+        p->taa.regionScale = glGetUniformLocation(p->taaProgram, "RegionScale");
+        p->taa.uvMax = glGetUniformLocation(p->taaProgram, "UVMax");
+        p->taa.texelSize = glGetUniformLocation(p->taaProgram, "TexelSize");
+        p->taa.jitter = glGetUniformLocation(p->taaProgram, "Jitter");
+        p->taa.historyWeight = glGetUniformLocation(p->taaProgram, "HistoryWeight");
+        p->taa.inverseViewProjection = glGetUniformLocation(p->taaProgram, "InverseViewProjection");
+        p->taa.prevViewProjection = glGetUniformLocation(p->taaProgram, "PrevViewProjection");
+    }
+
+    setAAMode(p, r, mode);
+}
+
+inline void deletePostProcess(PostProcess* p) {
+    deletePostTargets(p);
+    glDeleteProgram(p->fxaaProgram);
+    glDeleteProgram(p->taaProgram);
+    glDeleteVertexArrays(1, &p->vao);
+    glDeleteQueries(POST_TIMER_FRAMES * (PASS_COUNT + 1), &p->timer.queries[0][0]);
+}
+
+// the frame
+
+// radical inverse, the halton sequence's i-th element in base b
+inline float halton(int i, int b) {
+    float f = 1.f, x = 0.f;
+    for(; i > 0; i /= b) {
+        f /= b;
+        x += f * (i % b);
+    }
+    return x;
+}
+
+// call after beginResolutionFrame (the camera needs the viewport) and before the game's
+// Draw. frameCamera is the game's FrameCamera, NULL if it doesn't have one
+inline void beginPostFrame(PostProcess* p, const DynamicResolution* r, FrameCameraFunction frameCamera) {
+    beginPostTimer(&p->timer);
+
+    p->jitter[0] = p->jitter[1] = 0.f;
+    if(p->mode == AA_TAA && frameCamera) {
+        // within the pixel, in clip space that is 2 / size wide
+        int i = p->frame % TAA_JITTER_SAMPLES + 1;
+        p->jitter[0] = (halton(i, 2) - .5f) * 2.f / r->width;
+        p->jitter[1] = (halton(i, 3) - .5f) * 2.f / r->height;
+    }
+    memcpy(p->prevViewProjection, p->viewProjection, sizeof(p->viewProjection));
+    if(frameCamera) frameCamera(p->jitter[0], p->jitter[1], p->viewProjection, p->inverseViewProjection);
+    p->haveCamera = frameCamera != NULL;
+    p->frame++;
+}
+
+inline void setPostRegionUniforms(const DynamicResolution* r, GLint regionScale, GLint uvMax, GLint texelSize) {
+    glUniform2f(regionScale, (float)r->width / r->allocWidth, (float)r->height / r->allocHeight);
+    glUniform2f(uvMax, (r->width - .5f) / r->allocWidth, (r->height - .5f) / r->allocHeight);
+    glUniform2f(texelSize, 1.f / r->allocWidth, 1.f / r->allocHeight);
+}
+
+// call after the game's Draw, returns the framebuffer endResolutionFrame scales into the window
+inline GLuint runPostProcess(PostProcess* p, DynamicResolution* r) {
+    endPostPass(&p->timer, PASS_SCENE);
+
+    if(p->mode != AA_FXAA && p->mode != AA_TAA) {
+        // endResolutionFrame resolves if it has to
+        endPostPass(&p->timer, PASS_RESOLVE);
+        endPostPass(&p->timer, PASS_AA);
+        return r->fbo;
+    }
+
+    updatePostTargets(p, r);
+    resolveScene(r, p->mode == AA_TAA);
+    endPostPass(&p->timer, PASS_RESOLVE);
+
+    // the game leaves these the way it set them up in Initialize, put them back after
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+    glViewport(0, 0, r->width, r->height);
+    glBindVertexArray(p->vao);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, r->resolveColor);
+
+    GLuint out;
+    if(p->mode == AA_FXAA) {
+        out = p->fbos[0];
+        glBindFramebuffer(GL_FRAMEBUFFER, out);
+        glUseProgram(p->fxaaProgram);
+        glUniform1i(p->fxaa.color, 0);
+        setPostRegionUniforms(r, p->fxaa.regionScale, p->fxaa.uvMax, p->fxaa.texelSize);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    } else {
+        // a different render size means the history is at the wrong scale
+        if(p->historyWidth != r->width || p->historyHeight != r->height) p->historyValid = false;
+        int history = p->current;
+        p->current = 1 - p->current;
+        out = p->fbos[p->current];
+
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, r->resolveDepth);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, p->targets[history]);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, out);
+        glUseProgram(p->taaProgram);
+        glUniform1i(p->taa.color, 0);
+        glUniform1i(p->taa.depth, 1);
+        glUniform1i(p->taa.history, 2);
+        setPostRegionUniforms(r, p->taa.regionScale, p->taa.uvMax, p->taa.texelSize);
+        glUniform2f(p->taa.jitter, p->jitter[0], p->jitter[1]);
+        glUniform1f(p->taa.historyWeight, p->historyValid ? TAA_HISTORY_WEIGHT : 0.f);
+        // without the game's camera the history stays where it is
+        static const float identity[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+        glUniformMatrix4fv(p->taa.inverseViewProjection, 1, GL_FALSE, p->haveCamera ? p->inverseViewProjection : identity);
+        glUniformMatrix4fv(p->taa.prevViewProjection, 1, GL_FALSE, p->haveCamera ? p->prevViewProjection : identity);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        p->historyValid = true;
+        p->historyWidth = r->width;
+        p->historyHeight = r->height;
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    if(depthTest) glEnable(GL_DEPTH_TEST);
+    endPostPass(&p->timer, PASS_AA);
+    return out;
+}
+
+// call after endResolutionFrame
+inline void endPostFrame(PostProcess* p) {
+    endPostPass(&p->timer, PASS_UPSCALE);
+}
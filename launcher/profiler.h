@@ -0,0 +1,237 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+
+#include <backward.hpp>
+
+// sampling profiler, opt in with BOUNCY_PROFILE=<out file> (and BOUNCY_PROFILE_HZ)
+// a SIGPROF interval timer interrupts whichever thread is burning cpu, the handler only
+// copies the raw return addresses into a preallocated ring (claimed with a CAS, so
+// several threads can be sampled at once without locks). a background thread drains
+// the ring, symbolizes through backward and adds the stacks up in collapsed form
+// ("main;Draw;drawDrawable 42"), ready for flamegraph.pl or speedscope
+// symbols in the game library are only valid while it is loaded, so CollectProfile has
+// to be called before every unload
+
+#define PROFILE_MAX_DEPTH 48
+// the interval timer doesn't get much finer than the kernel's tick anyway
+#define PROFILE_MAX_HZ 10000
+#define PROFILE_RING_SIZE 8192
+// the signal handler and the trampoline the kernel returns through
+#define PROFILE_SKIP_FRAMES 2
+
+struct ProfileSample {
+    // index + 1 of the sample stored here, set once the frames are complete
+    std::atomic<uint64_t> seq;
+    int depth;
+    void* frames[PROFILE_MAX_DEPTH];
+};
+
+struct Profiler {
+    std::string path;
+    int hz;
+
+    ProfileSample ring[PROFILE_RING_SIZE];
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    std::atomic<uint64_t> dropped;
+
+    // everything below belongs to whoever holds the lock
+    std::mutex lock;
+    backward::TraceResolver resolver;
+    std::unordered_map<void*, std::string> symbols;
+    std::map<std::string, uint64_t> stacks;
+    uint64_t samples;
+
+    std::thread collector;
+    std::condition_variable wakeup;
+    bool stopping;
+};
+
+static std::atomic<Profiler*> activeProfiler;
+
+inline void ProfilerSignalHandler(int) {
+    int savedErrno = errno;
+    Profiler* p = activeProfiler.load(std::memory_order_acquire);
+    if(p) {
+        void* frames[PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES];
+        int n = backtrace(frames, PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES) - PROFILE_SKIP_FRAMES;
+
+        uint64_t h = p->head.load(std::memory_order_relaxed);
+        bool claimed = false;
+        while(n > 0 && h - p->tail.load(std::memory_order_acquire) < PROFILE_RING_SIZE) {
+            if(p->head.compare_exchange_weak(h, h + 1, std::memory_order_acq_rel)) {
+                claimed = true;
+                break;
+            }
+        }
+
+        if(claimed) {
+            ProfileSample* s = &p->ring[h % PROFILE_RING_SIZE];
+            s->depth = n;
+            memcpy(s->frames, frames + PROFILE_SKIP_FRAMES, n * sizeof(void*));
+            s->seq.store(h + 1, std::memory_order_release);
+        } else {
+            p->dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    errno = savedErrno;
+}
+
+// needs p->lock
+inline const std::string& ProfileSymbol(Profiler* p, void* addr) {
+    auto it = p->symbols.find(addr);
+    if(it != p->symbols.end()) return it->second;
+
+    // some resolvers (backtrace_symbols) work on the batch passed to load_addresses
+    p->resolver.load_addresses(&addr, 1);
+    backward::ResolvedTrace t = p->resolver.resolve(backward::ResolvedTrace(backward::Trace(addr, 0)));
+    std::string name = t.object_function;
+    if(name.empty()) {
+        // no symbol, at least tell which library it is in
+        Dl_info info;
+        if(dladdr(addr, &info) && info.dli_fname) {
+            const char* slash = strrchr(info.dli_fname, '/');
+            name = std::string("[") + (slash ? slash + 1 : info.dli_fname) + "]";
+        } else {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%p", addr);
+            name = buf;
+        }
+    }
+    // ';' separates frames and the count follows the last space
+    for(char& c : name) {
+        if(c == ';') c = ':';
+        if(c == ' ' || c == '\n') c = '_';
+    }
+    return p->symbols[addr] = name;
+}
+
+// drains the ring and symbolizes what was in it
+// call it with unloading = true before unloading a library, its addresses mean nothing
+// afterwards and the next library may end up at the same ones
+inline void CollectProfile(Profiler* p, bool unloading) {
+    if(!p) return;
+    std::lock_guard<std::mutex> guard(p->lock);
+
+    uint64_t t = p->tail.load(std::memory_order_relaxed);
+    uint64_t h = p->head.load(std::memory_order_acquire);
+    for(; t < h; t++) {
+        ProfileSample* s = &p->ring[t % PROFILE_RING_SIZE];
+        // claimed but still being written, pick it up next time
+        if(s->seq.load(std::memory_order_acquire) != t + 1) break;
+
+        std::string stack;
+        for(int i=s->depth-1; i>=0; i--) {
+            // return addresses point after the call, step back into it
+            void* addr = i > 0 ? (void*)((char*)s->frames[i] - 1) : s->frames[i];
+            if(!stack.empty()) stack += ';';
+            stack += ProfileSymbol(p, addr);
+        }
+        p->stacks[stack]++;
+        p->samples++;
+        p->tail.store(t + 1, std::memory_order_release);
+    }
+
+    if(unloading) p->symbols.clear();
+}
+
+// returns NULL unless BOUNCY_PROFILE is set
+inline Profiler* StartProfiler() {
+    const char* path = getenv("BOUNCY_PROFILE");
+    if(!path || !*path) return NULL;
+
+    Profiler* p = new Profiler();
+    p->path = path;
+    const char* hz = getenv("BOUNCY_PROFILE_HZ");
+    p->hz = hz ? atoi(hz) : 1000;
+    if(p->hz <= 0) p->hz = 1000;
+    if(p->hz > PROFILE_MAX_HZ) p->hz = PROFILE_MAX_HZ;
+    p->samples = 0;
+    p->stopping = false;
+
+    // the first backtrace() loads the unwinder, which allocates, so get it out of the way
+    // here rather than inside the signal handler
+    void* warmup[4];
+    backtrace(warmup, 4);
+
+    // symbolizing takes far longer than sampling, so it stays off the frame loop
+    p->collector = std::thread([p] {
+        std::unique_lock<std::mutex> wait(p->lock);
+        while(!p->stopping) {
+            p->wakeup.wait_for(wait, std::chrono::milliseconds(250));
+            wait.unlock();
+            CollectProfile(p, false);
+            wait.lock();
+        }
+    });
+
+    activeProfiler.store(p, std::memory_order_release);
+
+    struct sigaction sa = {};
+    sa.sa_handler = ProfilerSignalHandler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+
+    // tv_usec has to stay below a second, so 1hz is a whole tv_sec
+    long period = 1000000 / p->hz;
+    struct itimerval timer = {};
+    timer.it_interval.tv_sec = period / 1000000;
+    timer.it_interval.tv_usec = period % 1000000;
+    timer.it_value = timer.it_interval;
+    if(setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        // the profiler is still stopped and written as usual, just without samples
+        std::cerr << "Could not start the profiling timer: " << strerror(errno) << "\n";
+        return p;
+    }
+
+    std::cerr << "Profiling at " << p->hz << "hz into " << p->path << "\n";
+    return p;
+}
+
+// stops sampling and writes the collapsed stacks
+inline void StopProfiler(Profiler* p) {
+    if(!p) return;
+
+    struct itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+    activeProfiler.store(NULL, std::memory_order_release);
+
+    // a handler that is already running may still finish its sample, which is fine as
+    // long as p is still around
+    {
+        std::lock_guard<std::mutex> guard(p->lock);
+        p->stopping = true;
+    }
+    p->wakeup.notify_all();
+    p->collector.join();
+    CollectProfile(p, true);
+
+    std::ofstream out(p->path);
+    if(!out.is_open()) {
+        std::cerr << "Could not open " << p->path << " for writing\n";
+    } else {
+        for(auto& s : p->stacks) out << s.first << " " << s.second << "\n";
+        std::cerr << "Wrote " << p->samples << " samples (" << p->dropped.load() << " dropped) to " << p->path << "\n";
+    }
+
+    delete p;
+}
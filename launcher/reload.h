@@ -0,0 +1,155 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// background reloading of the game library
+// the library is copied to a uniquely named file first, so dlopen can't hand back the
+// already loaded image and the compiler can keep overwriting the original. copying,
+// dlopen and dlsym all happen on a worker thread; the frame loop only swaps the new
+// library in at a frame boundary, and keeps the old one loaded until the new one has
+// initialized successfully. needs KeyState to be defined
+
+// see game/glstate.h
+struct GLCallCounts;
+
+struct GameLib {
+    void* handle;
+    // the private copy that is actually loaded, removed on unload
+    std::string path;
+
+    int (*Initialize)(bool, void*);
+    void (*Update)(KeyState, uint64_t);
+    void (*Draw)();
+    void (*Cleanup)();
+    // optional, NULL if the game doesn't have it (see postprocess.h)
+    void (*FrameCamera)(float, float, float*, float*);
+    // optional too (see game/glstate.h)
+    void (*FrameGLCalls)(GLCallCounts*);
+};
+
+// modification time of a file in nanoseconds, 0 if it can't be read
+inline uint64_t ModifiedTime(const char* path) {
+    struct stat fileInfo;
+    if(stat(path, &fileInfo) != 0) return 0;
+#ifdef __APPLE__
+    const struct timespec& ts = fileInfo.st_mtimespec;
+#else
+    const struct timespec& ts = fileInfo.st_mtim;
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+inline bool CopyFile(const std::string& from, const std::string& to) {
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    if(!in.is_open() || !out.is_open()) return false;
+    out << in.rdbuf();
+    out.close();
+    return !out.fail();
+}
+
+inline void UnloadGamelib(GameLib* lib) {
+    if(lib->handle) dlclose(lib->handle);
+    if(!lib->path.empty()) unlink(lib->path.c_str());
+    *lib = GameLib();
+}
+
+// safe to call from any thread
+inline int LoadGamelib(const char* path, GameLib* lib, std::string* error) {
+    static std::atomic<int> copies(0);
+
+    *lib = GameLib();
+    lib->path = std::string(path) + "." + std::to_string(getpid()) + "." + std::to_string(copies++);
+    if(!CopyFile(path, lib->path)) {
+        *error = "Could not copy " + std::string(path) + " to " + lib->path;
+        unlink(lib->path.c_str());
+        lib->path.clear();
+        return 1;
+    }
+
+    // resolve everything now, on this thread, instead of lazily in the middle of a frame
+    lib->handle = dlopen(lib->path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if(!lib->handle) {
+        *error = "Could not open the shared library " + std::string(path) + ": " + dlerror();
+        UnloadGamelib(lib);
+        return 1;
+    }
+
+    lib->Initialize = (int (*)(bool, void*))dlsym(lib->handle, "Initialize");
+    lib->Update = (void (*)(KeyState, uint64_t))dlsym(lib->handle, "Update");
+    lib->Draw = (void (*)())dlsym(lib->handle, "Draw");
+    lib->Cleanup = (void (*)())dlsym(lib->handle, "Cleanup");
+    lib->FrameCamera = (void (*)(float, float, float*, float*))dlsym(lib->handle, "FrameCamera");
+    lib->FrameGLCalls = (void (*)(GLCallCounts*))dlsym(lib->handle, "FrameGLCalls");
+
+    if(!lib->Initialize || !lib->Update || !lib->Draw || !lib->Cleanup) {
+        *error = "Could not load functions from the shared library " + std::string(path);
+        UnloadGamelib(lib);
+        return 1;
+    }
+
+    return 0;
+}
+
+struct Reloader {
+    std::thread worker;
+    // set by the worker once result / rc / error are filled in
+    std::atomic<bool> done;
+    bool busy;
+
+    // whether the swapped in library should keep the current game or restart it
+    bool reinit;
+
+    GameLib result;
+    int rc;
+    std::string error;
+};
+
+inline void StartReload(Reloader* r, const char* path, bool reinit) {
+    if(r->busy) {
+        // already loading, but a restart request still turns the pending swap into a restart
+        if(!reinit) r->reinit = false;
+        return;
+    }
+
+    r->busy = true;
+    r->reinit = reinit;
+    r->done = false;
+    std::string p = path;
+    r->worker = std::thread([r, p] {
+        r->rc = LoadGamelib(p.c_str(), &r->result, &r->error);
+        r->done.store(true, std::memory_order_release);
+    });
+}
+
+// returns true once a load has finished, lib then holds the loaded library
+// (or rc is set and lib is empty)
+inline bool PollReload(Reloader* r, GameLib* lib, int* rc) {
+    if(!r->busy || !r->done.load(std::memory_order_acquire)) return false;
+
+    r->worker.join();
+    r->busy = false;
+    *rc = r->rc;
+    if(r->rc) {
+        std::cerr << r->error << "\n";
+        *lib = GameLib();
+    } else {
+        *lib = r->result;
+    }
+    r->result = GameLib();
+    return true;
+}
+
+inline void StopReloader(Reloader* r) {
+    if(!r->busy) return;
+    r->worker.join();
+    r->busy = false;
+    if(r->rc == 0) UnloadGamelib(&r->result);
+}
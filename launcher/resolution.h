@@ -0,0 +1,248 @@
+#pragma once
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <stdlib.h>
+
+// dynamic resolution
+// the game draws into an offscreen framebuffer some fraction (the scale) of the window's
+// size, which then gets scaled up into the window. the scale follows what drawing a frame
+// costs: it drops right away when frames go over the budget, and creeps back up when there
+// is room. the cost is the larger of the gpu time, from timer queries that are read a few
+// frames late so they never stall, and the cpu time from the start of the game's Draw,
+// through the post processing (which runs at the same size), to the end of the scaling.
+// software GL (llvmpipe) rasterizes on the cpu, in the draw calls and the blits, and its
+// timer queries only see a fraction of that. the framebuffer is allocated at the largest
+// size the scale can reach and smaller resolutions use its lower left corner, so changing
+// the scale never reallocates
+// BOUNCY_MIN_SCALE and BOUNCY_MAX_SCALE bound the scale (.5 and 1 by default), setting both
+// to the same value fixes it
+// needs GL 3.3 (timer queries) and the GL headers included before this
+
+// queries in flight, a result is read this many frames after it was issued
+#define RESOLUTION_QUERIES 4
+// frames between two adjustments
+#define RESOLUTION_ADJUST_FRAMES 8
+// frames before the first one, these compile shaders and upload meshes
+#define RESOLUTION_WARMUP_FRAMES 30
+
+struct DynamicResolution {
+    // the window's drawable size, in pixels
+    int windowWidth, windowHeight;
+    int samples;
+
+    float minScale, maxScale;
+    float scale;
+    // what drawing a frame may cost, 0 for no limit (always at maxScale)
+    double budgetMs;
+
+    // what the game draws at
+    int width, height;
+    // where it draws, multisampled unless samples is 0
+    GLuint fbo, color, depth;
+    // single sampled copy as textures, for post processing (see postprocess.h) and for
+    // scaling a multisampled image
+    GLuint resolveFbo, resolveColor, resolveDepth;
+    // the size all of them are allocated at
+    int allocWidth, allocHeight;
+
+    GLuint queries[RESOLUTION_QUERIES];
+    uint64_t frame;
+    // smoothed, 0 until the first result came in
+    double gpuMs, cpuMs;
+    std::chrono::steady_clock::time_point drawStart;
+    // negative while the results of frames drawn before the last change are still coming in,
+    // and during the warm up
+    int framesSinceAdjust;
+    int changes;
+};
+
+inline float scaleFromEnv(const char* name, float fallback) {
+    const char* s = getenv(name);
+    float v = s ? (float)atof(s) : 0.f;
+    return v > 0.f ? std::min(v, 1.f) : fallback;
+}
+
+inline void deleteResolutionTargets(DynamicResolution* r) {
+    glDeleteFramebuffers(1, &r->fbo);
+    glDeleteFramebuffers(1, &r->resolveFbo);
+    GLuint renderbuffers[] = { r->color, r->depth };
+    glDeleteRenderbuffers(2, renderbuffers);
+    GLuint textures[] = { r->resolveColor, r->resolveDepth };
+    glDeleteTextures(2, textures);
+    r->fbo = r->resolveFbo = r->color = r->depth = r->resolveColor = r->resolveDepth = 0;
+}
+
+// makes the render size follow the scale
+inline void applyResolutionScale(DynamicResolution* r) {
+    // multiples of 4 keep the scaling from shimmering between two neighbouring sizes
+    r->width = std::max(4, (int)(r->windowWidth * r->scale) & ~3);
+    r->height = std::max(4, (int)(r->windowHeight * r->scale) & ~3);
+}
+
+// (re)allocates the framebuffers for a window of the given size
+inline bool resizeDynamicResolution(DynamicResolution* r, int windowWidth, int windowHeight) {
+    deleteResolutionTargets(r);
+    r->windowWidth = std::max(windowWidth, 1);
+    r->windowHeight = std::max(windowHeight, 1);
+    applyResolutionScale(r);
+
+    int w = r->allocWidth = std::max(4, (int)(r->windowWidth * r->maxScale + 3) & ~3);
+    int h = r->allocHeight = std::max(4, (int)(r->windowHeight * r->maxScale + 3) & ~3);
+
+    glGenRenderbuffers(1, &r->color);
+    glBindRenderbuffer(GL_RENDERBUFFER, r->color);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, r->samples, GL_RGBA8, w, h);
+    glGenRenderbuffers(1, &r->depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, r->depth);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, r->samples, GL_DEPTH_COMPONENT24, w, h);
+    glGenFramebuffers(1, &r->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, r->fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, r->color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, r->depth);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    glGenTextures(1, &r->resolveColor);
+    glBindTexture(GL_TEXTURE_2D, r->resolveColor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // filtering at the left and bottom edges mustn't wrap around to the far side
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glGenTextures(1, &r->resolveDepth);
+    glBindTexture(GL_TEXTURE_2D, r->resolveDepth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, w, h, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &r->resolveFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, r->resolveFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, r->resolveColor, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, r->resolveDepth, 0);
+    complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if(!complete) std::cerr << "The offscreen framebuffer (" << w << "x" << h << ", " << r->samples << " samples) is incomplete\n";
+    return complete;
+}
+
+inline bool initDynamicResolution(DynamicResolution* r, int windowWidth, int windowHeight, int samples, double budgetMs) {
+    *r = {};
+    r->samples = samples;
+    r->budgetMs = budgetMs;
+    r->maxScale = scaleFromEnv("BOUNCY_MAX_SCALE", 1.f);
+    r->minScale = std::min(scaleFromEnv("BOUNCY_MIN_SCALE", .5f), r->maxScale);
+    r->scale = r->maxScale;
+    r->framesSinceAdjust = -RESOLUTION_WARMUP_FRAMES;
+    glGenQueries(RESOLUTION_QUERIES, r->queries);
+    return resizeDynamicResolution(r, windowWidth, windowHeight);
+}
+
+// reallocates for a different multisampling, 0 is none
+inline bool setResolutionSamples(DynamicResolution* r, int samples) {
+    if(samples == r->samples) return true;
+    r->samples = samples;
+    return resizeDynamicResolution(r, r->windowWidth, r->windowHeight);
+}
+
+inline void deleteDynamicResolution(DynamicResolution* r) {
+    deleteResolutionTargets(r);
+    glDeleteQueries(RESOLUTION_QUERIES, r->queries);
+}
+
+// picks the next scale from the measured cost
+inline void adjustResolutionScale(DynamicResolution* r) {
+    if(r->budgetMs <= 0.0) {
+        if(r->scale != r->maxScale) {
+            r->scale = r->maxScale;
+            applyResolutionScale(r);
+            r->changes++;
+        }
+        return;
+    }
+
+    double cost = std::max(r->gpuMs, r->cpuMs);
+    if(cost <= 0.0 || ++r->framesSinceAdjust < RESOLUTION_ADJUST_FRAMES) return;
+    r->framesSinceAdjust = 0;
+
+    // the cost is about proportional to the pixels, so the square root of the time ratio.
+    // over budget goes straight to where it should fit with a bit of headroom, under it
+    // grows by at most 5% at a time so it doesn't overshoot and bounce back down
+    float ratio = (float)std::sqrt(r->budgetMs / cost);
+    float next = r->scale;
+    if(cost > r->budgetMs) next = r->scale * ratio * .95f;
+    else if(cost < .8 * r->budgetMs) next = r->scale * std::min(ratio * .95f, 1.05f);
+    next = std::min(std::max(next, r->minScale), r->maxScale);
+    if(std::fabs(next - r->scale) < .01f) return;
+
+    r->scale = next;
+    applyResolutionScale(r);
+    r->changes++;
+    // the frames still in flight were drawn at the old size
+    r->framesSinceAdjust = -RESOLUTION_QUERIES;
+    r->gpuMs = r->cpuMs = 0.0;
+}
+
+inline void smoothResolutionCost(double* smoothed, double ms) {
+    *smoothed = *smoothed > 0.0 ? *smoothed * .75 + ms * .25 : ms;
+}
+
+// binds the offscreen framebuffer, call right before the game's Draw
+inline void beginResolutionFrame(DynamicResolution* r) {
+    // the query issued RESOLUTION_QUERIES frames ago, if the gpu got to it by now
+    GLuint query = r->queries[r->frame % RESOLUTION_QUERIES];
+    if(r->frame >= RESOLUTION_QUERIES) {
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            smoothResolutionCost(&r->gpuMs, ns / 1e6);
+        }
+    }
+    r->drawStart = std::chrono::steady_clock::now();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, r->fbo);
+    glViewport(0, 0, r->width, r->height);
+    // keeps the game's clear to the part that is used
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(0, 0, r->width, r->height);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+// copies what the game drew into the resolve textures, with the depth if asked for
+inline void resolveScene(DynamicResolution* r, bool depth) {
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, r->fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, r->resolveFbo);
+    GLbitfield mask = GL_COLOR_BUFFER_BIT | (depth ? GL_DEPTH_BUFFER_BIT : 0);
+    glBlitFramebuffer(0, 0, r->width, r->height, 0, 0, r->width, r->height, mask, GL_NEAREST);
+}
+
+// scales the image in the lower left corner of source (r->fbo if there was no post
+// processing) into target (0 is the window), call last thing in the frame before the swap
+inline void endResolutionFrame(DynamicResolution* r, GLuint source, GLuint target) {
+    glDisable(GL_SCISSOR_TEST);
+
+    bool sameSize = r->width == r->windowWidth && r->height == r->windowHeight;
+    if(source == r->fbo && r->samples > 0 && !sameSize) {
+        // multisampled framebuffers can only be blitted 1:1, resolve first
+        resolveScene(r, false);
+        source = r->resolveFbo;
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, source);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+    glBlitFramebuffer(0, 0, r->width, r->height, 0, 0, r->windowWidth, r->windowHeight,
+        GL_COLOR_BUFFER_BIT, sameSize ? GL_NEAREST : GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+    glEndQuery(GL_TIME_ELAPSED);
+    r->frame++;
+
+    auto end = std::chrono::steady_clock::now();
+    smoothResolutionCost(&r->cpuMs, std::chrono::duration<double, std::milli>(end - r->drawStart).count());
+    adjustResolutionScale(r);
+}
@@ -0,0 +1,247 @@
+#include <iostream>
+#include <string>
+#include <SDL.h>
+#define GL_GLEXT_PROTOTYPES 1
+#include <SDL_opengl.h>
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "../game/spectate.h"
+
+// watches a game someone else is playing: receives the stream a game started with
+// BOUNCY_SPECTATE=<socket> sends (see game/spectate.h), and renders it with its own copy
+// of the game library. every packet steps the game by the player's delta t (so bounces and
+// broken levels look the same), then the state is overwritten with what the player's
+// game had, so it never drifts
+//
+// usage: spectator [-s socket] [-r record.bin] [-p playback.bin] <gamelib>
+// -s defaults to BOUNCY_SPECTATE, or /tmp/bouncy-spectate.sock
+// -r writes every packet to a file, -p plays such a file back instead of listening
+// run it from the launcher directory, the game loads its shaders from the working dir
+
+struct KeyState {
+    // virtual game pad with 2 analogs, a d-pad and 16 "regular" buttons
+
+    float a1x, a1y;
+    float a2x, a2y;
+
+    union {
+        bool elements[4];
+        struct {
+            bool up, down, left, right;
+        };
+    } dirs;
+
+    bool buttons[16];
+};
+
+#include "../launcher/reload.h"
+
+GameLib game;
+bool initialized;
+SpectateScene scene;
+
+// the tower the player is on, built from scratch: the state the packet describes goes
+// into the block first, so Initialize restores it like it would after a reload (the
+// levels above the ball are broken, without a burst of particles)
+int StartScene(const SpectateFrame& f, void* gameState) {
+    if(initialized) game.Cleanup();
+    initialized = false;
+    scene = f.scene;
+
+    // the game would stream back to us otherwise
+    unsetenv("BOUNCY_SPECTATE");
+    setenv("BOUNCY_LEVELS", to_string(scene.levels).c_str(), 1);
+    setenv("BOUNCY_SECTIONS", to_string(scene.sections).c_str(), 1);
+    setenv("BOUNCY_LIGHTS", to_string(scene.lights).c_str(), 1);
+    setenv("BOUNCY_DETAIL", to_string(scene.detail).c_str(), 1);
+    setenv("BOUNCY_BALLS", "1", 1);
+
+    GameState* st = stateFromBlock(gameState);
+    writeStateHeader((StateHeader*)gameState);
+    *st = GameState();
+    st->ballForce = glm::vec3(0.f, 10.f, 0.f);
+    st->randomSeed = scene.seed;
+    dequantizeSpectateState(f.values, st);
+
+    int rc = game.Initialize(true, gameState);
+    if(rc) return rc;
+    initialized = true;
+    cout << "spectating seed " << scene.seed << ", " << scene.levels << " levels x "
+         << (int)scene.sections << " sections\n";
+    return 0;
+}
+
+int ApplyFrame(const SpectateFrame& f, void* gameState) {
+    bool sameScene = initialized && scene.seed == f.scene.seed && scene.levels == f.scene.levels &&
+        scene.sections == f.scene.sections && scene.lights == f.scene.lights && scene.detail == f.scene.detail;
+    if(!sameScene) return StartScene(f, gameState);
+
+    for(int i=0; i<f.numEvents; i++) cout << "level " << f.brokenLevels[i] << " broken\n";
+    KeyState keys = {};
+    game.Update(keys, f.dtMs);
+    dequantizeSpectateState(f.values, stateFromBlock(gameState));
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    const char* socketPath = getenv("BOUNCY_SPECTATE");
+    if(!socketPath || !*socketPath) socketPath = "/tmp/bouncy-spectate.sock";
+    const char* recordPath = NULL;
+    const char* playbackPath = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "s:r:p:")) != -1) {
+        switch(opt) {
+        case 's': socketPath = optarg; break;
+        case 'r': recordPath = optarg; break;
+        case 'p': playbackPath = optarg; break;
+        default:
+            cerr << "usage: " << argv[0] << " [-s socket] [-r record.bin] [-p playback.bin] <gamelib>\n";
+            return 1;
+        }
+    }
+    if(optind >= argc) {
+        cerr << "usage: " << argv[0] << " [-s socket] [-r record.bin] [-p playback.bin] <gamelib>\n";
+        return 1;
+    }
+
+    // a recording is every packet as it came in, each after its size as 2 bytes
+    int fd = -1;
+    FILE* playback = NULL;
+    FILE* record = NULL;
+    if(playbackPath) {
+        playback = fopen(playbackPath, "rb");
+        if(!playback) {
+            cerr << "Could not open " << playbackPath << "\n";
+            return 1;
+        }
+    } else {
+        fd = bindSpectateSocket(socketPath);
+        if(fd < 0) {
+            cerr << "Could not bind " << socketPath << "\n";
+            return 1;
+        }
+        cout << "waiting for a game on " << socketPath << "\n";
+    }
+    if(recordPath) {
+        record = fopen(recordPath, "wb");
+        if(!record) {
+            cerr << "Could not open " << recordPath << " for writing\n";
+            return 1;
+        }
+    }
+
+    SDL_Init(SDL_INIT_VIDEO);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
+    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 4);
+
+    SDL_Window* win = SDL_CreateWindow("spectator",
+        SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+        800, 600,
+        SDL_WINDOW_SHOWN | SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
+    assert(win);
+    SDL_GLContext ctx = SDL_GL_CreateContext(win);
+    SDL_GL_MakeCurrent(win, ctx);
+    SDL_GL_SetSwapInterval(1);
+
+    int drawableWidth, drawableHeight;
+    SDL_GL_GetDrawableSize(win, &drawableWidth, &drawableHeight);
+    glViewport(0, 0, drawableWidth, drawableHeight);
+
+    string error;
+    int rc = LoadGamelib(argv[optind], &game, &error);
+    if(rc) {
+        cerr << error << "\n";
+        return rc;
+    }
+    void* gameState = (void*)(new uint8_t[1 << 27]);
+    memset(gameState, 0, 1 << 27);
+
+    SpectateDecoder decoder = {};
+    SpectateFrame frame;
+    uint8_t packet[SPECTATE_MAX_PACKET];
+    // a recording plays back at the pace it was played
+    uint64_t playbackStart = SDL_GetTicks64();
+    uint64_t playedMs = 0;
+
+    bool running = true;
+    while(running) {
+        SDL_Event e;
+        while(SDL_PollEvent(&e)) {
+            if(e.type == SDL_QUIT) running = false;
+            if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE) running = false;
+            if(e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                SDL_GL_GetDrawableSize(win, &drawableWidth, &drawableHeight);
+                glViewport(0, 0, drawableWidth, drawableHeight);
+            }
+        }
+
+        // everything that came in since the last frame, one Update per packet
+        while(running) {
+            ssize_t n;
+            if(playback) {
+                if(playedMs > SDL_GetTicks64() - playbackStart) break;
+                uint16_t size;
+                if(fread(&size, 2, 1, playback) != 1 || size > sizeof(packet) ||
+                   fread(packet, 1, size, playback) != size) {
+                    cout << "end of the recording\n";
+                    running = false;
+                    break;
+                }
+                n = size;
+            } else {
+                n = recv(fd, packet, sizeof(packet), 0);
+                if(n <= 0) break;
+            }
+
+            if(record) {
+                uint16_t size = (uint16_t)n;
+                fwrite(&size, 2, 1, record);
+                fwrite(packet, 1, n, record);
+            }
+            if(!decodeSpectateFrame(&decoder, packet, n, &frame)) continue;
+            playedMs += frame.dtMs;
+            rc = ApplyFrame(frame, gameState);
+            if(rc) {
+                cerr << "The game library failed to initialize\n";
+                running = false;
+            }
+        }
+
+        if(initialized) {
+            game.Draw();
+        } else {
+            glClearColor(0.f, 0.f, 0.f, 1.f);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+        SDL_GL_SwapWindow(win);
+    }
+
+    printf("%llu packets, %llu bytes (%.1f per packet), %llu gaps\n",
+        (unsigned long long)decoder.packets, (unsigned long long)decoder.bytes,
+        decoder.packets ? (double)decoder.bytes / decoder.packets : 0.0, (unsigned long long)decoder.gaps);
+
+    if(initialized) game.Cleanup();
+    UnloadGamelib(&game);
+    if(record) fclose(record);
+    if(playback) fclose(playback);
+    if(fd >= 0) {
+        close(fd);
+        unlink(socketPath);
+    }
+
+    SDL_GL_DeleteContext(ctx);
+    SDL_DestroyWindow(win);
+    SDL_Quit();
+    return 0;
+}